@@ -4,7 +4,11 @@
 int BlockDevInit(void);
 
 int BlockDevWrite(U32 dwAddress, U8* pbBuf);
+int BlockDevWriteStart(U32 dwAddress, U32 dwCount);
+int BlockDevWriteStop(void);
 int BlockDevRead(U32 dwAddress, U8* pbBuf);
+int BlockDevReadStart(U32 dwAddress);
+int BlockDevReadPoll(U8* pbBuf);
 
 int BlockDevGetSize(U32 *pdwDriveSize);
 int BlockDevGetStatus(void);
@@ -31,330 +31,159 @@
 #include "rprintf.h"
 
 #include "blockdev.h"
-#include "spi.h"
-
-#define CMD_GOIDLESTATE     0
-#define CMD_SENDOPCOND      1
-#define CMD_READCSD         9
-#define CMD_READCID         10
-#define CMD_SENDSTATUS      13
-#define CMD_READSINGLEBLOCK 17
-#define CMD_WRITE           24
-#define CMD_WRITE_MULTIPLE  25
-
-static void Command(U8 cmd, U32 param)
-{
-    U8  abCmd[8];
-
-    // create buffer
-    abCmd[0] = 0xff;
-    abCmd[1] = 0x40 | cmd;
-    abCmd[2] = (U8)(param >> 24);
-    abCmd[3] = (U8)(param >> 16);
-    abCmd[4] = (U8)(param >> 8);
-    abCmd[5] = (U8)(param);
-    abCmd[6] = 0x95;            /* Checksum (should be only valid for first command (0) */
-    abCmd[7] = 0xff;            /* eat empty command - response */
-
-    SPISendN(abCmd, 8);
-}
+#include "sd_raw.h"
+
+/*
+    The card is driven by sd_raw, which the bootloader uses as well.
+    This way the card is only initialised once, and blocks already
+    in the sd_raw cache are served without touching the card.
+*/
 
 /*****************************************************************************/
 
-static U8 Resp8b(void)
+static offset_t Offset(U32 dwAddress)
 {
-    U8 i;
-    U8 resp;
-
-    /* Respone will come after 1 - 8 pings */
-    for (i = 0; i < 8; i++)
-    {
-        resp = SPISend(0xff);
-        if (resp != 0xff)
-        {
-            return resp;
-        }
-    }
-
-    return resp;
+    return (offset_t) dwAddress * 512;
 }
 
 /*****************************************************************************/
 
-static void Resp8bError(U8 value)
+int BlockDevInit(void)
 {
-    switch (value)
+    /* the bootloader usually has the card up and running already */
+    if (sd_raw_initialized())
     {
-        case 0x40:  rprintf("Argument out of bounds.\n");               break;
-        case 0x20:  rprintf("Address out of bounds.\n");                break;
-        case 0x10:  rprintf("Error during erase sequence.\n");          break;
-        case 0x08:  rprintf("CRC failed.\n");                           break;
-        case 0x04:  rprintf("Illegal command.\n");                      break;
-        case 0x02:  rprintf("Erase reset (see SanDisk docs p5-13).\n"); break;
-//        case 0x01:  rprintf("Card is initialising.\n");                 break;
-        case 0x01:  rprintf(".");                 break;
-            default:
-            rprintf("Unknown error 0x%x (see SanDisk docs p5-13).\n", value);
-            break;
+        return 0;
     }
-}
 
+    if (!sd_raw_init())
+    {
+        rprintf("SD Init failed\n");
+        return -1;
+    }
+
+    rprintf("SD Init done...\n");
+
+    return 0;
+}
 
 /* ****************************************************************************
- calculates size of card from CSD
- (extension by Martin Thomas, inspired by code from Holger Klabunde)
+ calculates size of card in 512 byte blocks
  */
 int BlockDevGetSize(U32 *pdwDriveSize)
 {
-    U8 cardresp, i, by;
-    U8 iob[16];
-    U16 c_size, c_size_mult, read_bl_len;
-
-    Command(CMD_READCSD, 0);
-    do
-    {
-        cardresp = Resp8b();
-    }
-    while (cardresp != 0xFE);
+    struct sd_raw_info info;
 
-    rprintf("CSD:");
-    for (i = 0; i < 16; i++)
+    if (!sd_raw_get_info(&info))
     {
-        iob[i] = SPISend(0xFF);
-        rprintf(" %02x", iob[i]);
+        return -1;
     }
-    rprintf("\n");
-
-    SPISend(0xff);
-    SPISend(0xff);
-
-    c_size = iob[6] & 0x03;     // bits 1..0
-    c_size <<= 10;
-    c_size += (U16) iob[7] << 2;
-    c_size += iob[8] >> 6;
-
-    by = iob[5] & 0x0F;
-    read_bl_len = 1 << by;
-
-    by = iob[9] & 0x03;
-    by <<= 1;
-    by += iob[10] >> 7;
-
-    c_size_mult = 1 << (2 + by);
 
-    *pdwDriveSize = (U32) (c_size + 1) * (U32) c_size_mult *(U32) read_bl_len;
+    *pdwDriveSize = (U32) (info.capacity / 512);
 
     return 0;
 }
 
 /*****************************************************************************/
 
-static U16 Resp16b(void)
-{
-    U16 resp;
+/* ****************************************************************************
+ * Announces a write of dwCount consecutive blocks starting at dwAddress.
+ * The following BlockDevWrite calls for these blocks are streamed to the
+ * card, the stream is closed after the last one, or as soon as anything
+ * else is done with the card.
+ * The card may pre-erase all announced blocks, so if the host aborts the
+ * transfer, the blocks it did not send have undefined contents.
+ */
 
-    resp = (Resp8b() << 8) & 0xff00;
-    resp |= SPISend(0xff);
+int BlockDevWriteStart(U32 dwAddress, U32 dwCount)
+{
+    if (dwCount == 0)
+    {
+        return 0;
+    }
 
-    return resp;
+    return sd_raw_write_start(Offset(dwAddress), (U16) dwCount) ? 0 : -1;
 }
 
 /*****************************************************************************/
 
-static int State(void)
+int BlockDevWriteStop(void)
 {
-    U16 value;
-
-    Command(CMD_SENDSTATUS, 0);
-    value = Resp16b();
+    sd_raw_write_stop();
 
-    switch (value)
-    {
-        case 0x0000: return 1;
-        case 0x0001: rprintf("Card is Locked.\n");                                                  break;
-        case 0x0002: rprintf("WP Erase Skip, Lock/Unlock Cmd Failed.\n");                           break;
-        case 0x0004: rprintf("General / Unknown error -- card broken?.\n");                         break;
-        case 0x0008: rprintf("Internal card controller error.\n");                                  break;
-        case 0x0010: rprintf("Card internal ECC was applied, but failed to correct the data.\n");   break;
-        case 0x0020: rprintf("Write protect violation.\n");                                         break;
-        case 0x0040: rprintf("An invalid selection, sectors for erase.\n");                         break;
-        case 0x0080: rprintf("Out of Range, CSD_Overwrite.\n");                                     break;
-            default:
-            if (value > 0x00FF)
-            {
-                Resp8bError((U8) (value >> 8));
-            }
-            else
-            {
-                rprintf("Unknown error: 0x%x (see SanDisk docs p5-14).\n", value);
-            }
-            break;
-    }
-    return -1;
+    return 0;
 }
 
 /*****************************************************************************/
 
+/* ****************************************************************************
+ * Returns as soon as the card has accepted the block, the card's
+ * programming time is waited out before the next access.
+ */
 
-int BlockDevInit(void)
+int BlockDevWrite(U32 dwAddress, U8 * pbBuf)
 {
-    int i;
-    U8 resp;
-
-    SPIInit();              /* init at low speed */
-
-    /* Try to send reset command up to 100 times */
-    i = 100;
-    do
-    {
-        Command(CMD_GOIDLESTATE, 0);
-        resp = Resp8b();
-    }
-    while (resp != 1 && i--);
-
-    if (resp != 1)
-    {
-        if (resp == 0xff)
-        {
-            rprintf("resp=0xff\n");
-            return -1;
-        }
-        else
-        {
-            Resp8bError(resp);
-            rprintf("resp!=0xff\n");
-            return -2;
-        }
-    }
-
-    /* Wait till card is ready initialising (returns 0 on CMD_1) */
-    /* Try up to 32000 times. */
-    i = 32000;
-    do
-    {
-        Command(CMD_SENDOPCOND, 0);
-
-        resp = Resp8b();
-        if (resp != 0)
-        {
-            Resp8bError(resp);
-        }
-    }
-    while (resp == 1 && i--);
-
-    if (resp != 0)
+    /* continue the announced stream if the block is the next one */
+    if (sd_raw_write_next(Offset(dwAddress), pbBuf))
     {
-        Resp8bError(resp);
-        return -3;
+        return 0;
     }
 
-    /* increase speed after init */
-    SPISetSpeed(SPI_PRESCALE_MIN);
+    /* the stream, if any, was meant for other blocks */
+    sd_raw_write_stop();
 
-    if (State() < 0)
-    {
-        rprintf("Card didn't return the ready state, breaking up...\n");
-        return -2;
-    }
-
-    rprintf("SD Init done...\n");
-
-    return 0;
+    return sd_raw_write_blocks(Offset(dwAddress), pbBuf, 1) ? 0 : -1;
 }
 
 /*****************************************************************************/
 
+/* ****************************************************************************
+ * Sends the read command and returns without waiting for the card,
+ * BlockDevReadPoll fetches the block once the card has it ready.
+ */
 
-
-/*****************************************************************************/
-
+int BlockDevReadStart(U32 dwAddress)
+{
+    return sd_raw_read_start(Offset(dwAddress)) ? 0 : -1;
+}
 
 /*****************************************************************************/
 
 /* ****************************************************************************
- * WAIT ?? -- FIXME
- * CMD_WRITE
- * WAIT
- * CARD RESP
- * WAIT
- * DATA BLOCK OUT
- *      START BLOCK
- *      DATA
- *      CHKS (2B)
- * BUSY...
+ * Checks a few bytes for the start block of the read begun with
+ * BlockDevReadStart, and receives the block once it arrives.
+ * Returns 0 when the block is in pbBuf, 1 while the card is still
+ * busy, < 0 on errors and timeouts.
  */
 
-int BlockDevWrite(U32 dwAddress, U8 * pbBuf)
+int BlockDevReadPoll(U8 * pbBuf)
 {
-    U32 place;
-    U16 t = 0;
-
-    place = 512 * dwAddress;
-    Command(CMD_WRITE, place);
-
-    Resp8b();               /* Card response */
-
-    SPISend(0xfe);          /* Start block */
-    SPISendN(pbBuf, 512);
-    SPISend(0xff);          /* Checksum part 1 */
-    SPISend(0xff);          /* Checksum part 2 */
-
-    SPISend(0xff);
-
-    while (SPISend(0xff) != 0xff)
+    switch (sd_raw_read_poll(pbBuf))
     {
-        t++;
+        case SD_RAW_READ_DONE:  return 0;
+        case SD_RAW_READ_BUSY:  return 1;
+        default:                return -1;
     }
-
-    return 0;
 }
 
 /*****************************************************************************/
 
-/* ****************************************************************************
- * WAIT ?? -- FIXME
- * CMD_CMD_
- * WAIT
- * CARD RESP
- * WAIT
- * DATA BLOCK IN
- *      START BLOCK
- *      DATA
- *      CHKS (2B)
- */
-
 int BlockDevRead(U32 dwAddress, U8 * pbBuf)
 {
-    U8 cardresp;
-    U8 firstblock;
-    U16 fb_timeout = 0xffff;
-    U32 place;
-
-    place = 512 * dwAddress;
-    Command(CMD_READSINGLEBLOCK, place);
+    int iResult;
 
-    cardresp = Resp8b();        /* Card response */
-
-    /* Wait for startblock */
-    do
+    if (BlockDevReadStart(dwAddress) < 0)
     {
-        firstblock = Resp8b();
+        return -1;
     }
-    while (firstblock == 0xff && fb_timeout--);
 
-    if (cardresp != 0x00 || firstblock != 0xfe)
+    do
     {
-        Resp8bError(firstblock);
-        return -1;
+        iResult = BlockDevReadPoll(pbBuf);
     }
+    while (iResult > 0);
 
-    SPIRecvN(pbBuf, 512);
-
-    /* Checksum (2 byte) - ignore for now */
-    SPISend(0xff);
-    SPISend(0xff);
-
-    return 0;
+    return iResult;
 }
 
 /*****************************************************************************/
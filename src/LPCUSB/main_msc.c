@@ -178,7 +178,8 @@ int main_msc(void)
     USBInit();
 
     // enable bulk-in interrupts on NAKs
-    // these are required to get the BOT protocol going again after a STALL
+    // these are required to get the BOT protocol going again after a STALL,
+    // and they keep polling a block read while the card is still busy
     USBHwNakIntEnable(INACK_BI);
 
     // register descriptors
@@ -205,6 +206,9 @@ int main_msc(void)
 		//rprintf("ISR success\n");
     }
 
+    // let the card finish what the host wrote last
+    BlockDevWriteStop();
+
     return 0;
 }
 
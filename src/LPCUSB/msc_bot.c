@@ -185,9 +185,16 @@ static void BOTStall(void)
 static void HandleDataIn(void)
 {
     int iChunk;
+    U8  *pbNext;
 
     // process data for host in SCSI layer
-    pbData = SCSIHandleData(CBW.CBWCB, CBW.bCBWCBLength, pbData, dwOffset);
+    pbNext = SCSIHandleData(CBW.CBWCB, CBW.bCBWCBLength, pbData, dwOffset);
+    if (pbNext == SCSI_DATA_PENDING)
+    {
+        // card still busy, try again on the next IN NAK
+        return;
+    }
+    pbData = pbNext;
     if (pbData == NULL)
     {
         BOTStall();
@@ -82,6 +82,9 @@ static const U8 abSense[] =
 //  Buffer for holding one block of disk data
 static U8 abBlockBuf[512];
 
+//  TRUE while the block device is fetching a block for READ (10)
+static BOOL fReadPending;
+
 
 typedef struct
 {
@@ -102,6 +105,7 @@ TCDB6;
 void SCSIReset(void)
 {
     dwSense = 0;
+    fReadPending = FALSE;
 }
 
 
@@ -186,6 +190,13 @@ U8 * SCSIHandleCmd(U8 *pbCDB, int iCDBLen, int *piRspLen, BOOL *pfDevIn)
             dwLBA = (pbCDB[2] << 24) | (pbCDB[3] << 16) | (pbCDB[4] << 8) | (pbCDB[5]);
             dwLen = (pbCDB[7] << 8) | pbCDB[8];
             DBG("WRITE10, LBA=%d, len=%d\n", dwLBA, dwLen);
+            // stream the blocks to the card with a single write command
+            if (BlockDevWriteStart(dwLBA, dwLen) < 0)
+            {
+                dwSense = WRITE_ERROR;
+                DBG("BlockDevWriteStart failed\n");
+                return NULL;
+            }
             *piRspLen = dwLen * BLOCKSIZE;
             *pfDevIn = FALSE;
             break;
@@ -219,6 +230,7 @@ U8 * SCSIHandleCmd(U8 *pbCDB, int iCDBLen, int *piRspLen, BOOL *pfDevIn)
     IN      dwOffset    Offset in data
 
     Returns a pointer to the next data to be exchanged if successful,
+    SCSI_DATA_PENDING if the data is not available yet,
     returns NULL otherwise.
 **************************************************************************/
 U8 * SCSIHandleData(U8 *pbCDB, int iCDBLen, U8 *pbData, U32 dwOffset)
@@ -227,6 +239,7 @@ U8 * SCSIHandleData(U8 *pbCDB, int iCDBLen, U8 *pbData, U32 dwOffset)
     U32     dwLBA;
     U32     dwBufPos, dwBlockNr;
     U32     dwNumBlocks, dwMaxBlock;
+    int     iResult;
 
 	//pCDB = (TCDB6 *)pbCDB;
 	//Compiler warning fix
@@ -263,10 +276,10 @@ U8 * SCSIHandleData(U8 *pbCDB, int iCDBLen, U8 *pbData, U32 dwOffset)
 
         // read capacity
         case SCSI_CMD_READ_CAPACITY:
-        // get size of drive (bytes)
+        // get size of drive (blocks)
             BlockDevGetSize(&dwNumBlocks);
             // calculate highest LBA
-            dwMaxBlock = (dwNumBlocks - 1) / 512;
+            dwMaxBlock = dwNumBlocks - 1;
 
             pbData[0] = (dwMaxBlock >> 24) & 0xFF;
             pbData[1] = (dwMaxBlock >> 16) & 0xFF;
@@ -286,13 +299,29 @@ U8 * SCSIHandleData(U8 *pbCDB, int iCDBLen, U8 *pbData, U32 dwOffset)
             dwBufPos = (dwOffset & (BLOCKSIZE - 1));
             if (dwBufPos == 0)
             {
-                // read new block
-                dwBlockNr = dwLBA + (dwOffset / BLOCKSIZE);
-                DBG("R");
-                if (BlockDevRead(dwBlockNr, abBlockBuf) < 0)
+                // read new block, without waiting for the card
+                if (!fReadPending)
+                {
+                    dwBlockNr = dwLBA + (dwOffset / BLOCKSIZE);
+                    DBG("R");
+                    if (BlockDevReadStart(dwBlockNr) < 0)
+                    {
+                        dwSense = READ_ERROR;
+                        DBG("BlockDevReadStart failed\n");
+                        return NULL;
+                    }
+                    fReadPending = TRUE;
+                }
+                iResult = BlockDevReadPoll(abBlockBuf);
+                if (iResult > 0)
+                {
+                    return SCSI_DATA_PENDING;
+                }
+                fReadPending = FALSE;
+                if (iResult < 0)
                 {
                     dwSense = READ_ERROR;
-                    DBG("BlockDevRead failed\n");
+                    DBG("BlockDevReadPoll failed\n");
                     return NULL;
                 }
             }
@@ -1,5 +1,9 @@
 #include "type.h"
 
+// returned by SCSIHandleData while the block device is still busy,
+// the call has to be repeated later on
+#define SCSI_DATA_PENDING	((U8 *)-1)
+
 void	SCSIReset(void);
 U8 *	SCSIHandleCmd(U8 *pbCDB, int iCDBLen, int *piRspLen, BOOL *pfDevIn);
 U8 *	SCSIHandleData(U8 *pbCDB, int iCDBLen, U8 *pbData, U32 dwOffset);
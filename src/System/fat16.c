@@ -13,13 +13,12 @@
 #include "fat16_config.h"
 #include "sd_raw.h"
 
-#include <stdlib.h>
 #include <string.h>
 
 /**
  * \addtogroup fat16 FAT16 support
  *
- * This module implements FAT16 read and write access.
+ * This module implements FAT16 and FAT32 read and write access.
  *
  * The following features are supported:
  * - File names up to 31 characters long.
@@ -29,6 +28,7 @@
  * - Reading and writing from and to files.
  * - File resizing.
  * - File sizes of up to 4 gigabytes.
+ * - FAT32 filesystems, if FAT16_FAT32_SUPPORT is enabled.
  *
  * @{
  */
@@ -63,12 +63,38 @@
  * @}
  */
 
+#if FAT16_FAT32_SUPPORT
+/* FAT16 entries are widened to these values, see fat16_read_fat_entry() */
+#define FAT16_CLUSTER_FREE 0x00000000
+#define FAT16_CLUSTER_RESERVED_MIN (cluster_t)0x0ffffff0
+#define FAT16_CLUSTER_RESERVED_MAX (cluster_t)0x0ffffff6
+#define FAT16_CLUSTER_BAD (cluster_t)0x0ffffff7
+#define FAT16_CLUSTER_LAST_MIN (cluster_t)0x0ffffff8
+#define FAT16_CLUSTER_LAST_MAX (cluster_t)0x0fffffff
+#else
 #define FAT16_CLUSTER_FREE 0x0000
 #define FAT16_CLUSTER_RESERVED_MIN (uint16_t)0xfff0
 #define FAT16_CLUSTER_RESERVED_MAX (uint16_t)0xfff6
 #define FAT16_CLUSTER_BAD (uint16_t)0xfff7
 #define FAT16_CLUSTER_LAST_MIN (uint16_t)0xfff8
 #define FAT16_CLUSTER_LAST_MAX (uint16_t)0xffff
+#endif
+
+/* number of free clusters which is not known */
+#define FAT16_CLUSTER_COUNT_UNKNOWN 0xffffffff
+
+#if FAT16_FAT32_SUPPORT
+#define FAT16_IS_FAT32(fs) ((fs)->partition->type == PARTITION_TYPE_FAT32)
+#else
+#define FAT16_IS_FAT32(fs) 0
+#endif
+/* size of a fat entry in bytes */
+#define FAT16_FAT_ENTRY_SIZE(fs) (FAT16_IS_FAT32(fs) ? 4 : 2)
+/* slot of a handle within its pool, -1 if it is none of the pool's handles */
+#define FAT16_POOL_SLOT(handles, count, handle) \
+    ((handle) >= (handles) && (handle) < (handles) + (count) ? (int16_t) ((handle) - (handles)) : -1)
+/* number of FAT32 fat entries searched for runs of free clusters */
+#define FAT16_FAT32_RUNS_SEARCH 16384
 
 #define FAT16_DIRENTRY_DELETED 0xe5
 #define FAT16_DIRENTRY_LFNLAST (1 << 6)
@@ -125,27 +151,95 @@
  * The ordinal field contains a descending number, from n to 1.
  * For the n'th lfn entry the ordinal field is or'ed with 0x40.
  * For deleted lfn entries, the ordinal field is set to 0xe5.
+ *
+ * On FAT32, bytes 20 and 21 of an 8.3 entry hold the upper half
+ * of the cluster number.
+ *
+ * FAT32 fsinfo sector:
+ * ====================
+ * offset  length  description
+ *      0       4  signature "RRaA"
+ *    484       4  signature "rrAa"
+ *    488       4  number of free clusters, 0xffffffff if unknown
+ *    492       4  cluster where to search for free clusters, 0xffffffff if unknown
  */
 
 struct fat16_header_struct
 {
-    uint32_t size;
+    offset_t size;
 
-    uint32_t fat_offset;
+    offset_t fat_offset;
     uint32_t fat_size;
+    /* number of bytes from one copy of the fat to the next */
+    uint32_t fat_copy_size;
+    uint8_t fat_copies;
 
     uint16_t sector_size;
     uint16_t cluster_size;
 
-    uint32_t root_dir_offset;
+    offset_t root_dir_offset;
+
+    offset_t cluster_zero_offset;
+
+#if FAT16_FAT32_SUPPORT
+    /* first cluster of the root directory of a FAT32 */
+    cluster_t root_dir_cluster;
+    /* device offset of the fsinfo sector of a FAT32, 0 if there is none */
+    offset_t fsinfo_offset;
+#endif
+};
+
+/* fat cache line flags */
+#define FAT16_FAT_CACHE_VALID 0x01
+#define FAT16_FAT_CACHE_DIRTY 0x02
 
-    uint32_t cluster_zero_offset;
+/* a sector of the file allocation table held in memory */
+struct fat16_fat_cache_struct
+{
+    union
+    {
+        uint8_t buffer[512];
+        /* the buffer read as words, see fat16_count_free_clusters() */
+        uint32_t words[128];
+    };
+    /* number of the sector within the fat */
+    uint32_t sector;
+    /* time of the last access, used to find the least recently used sector */
+    uint16_t stamp;
+    /* combination of the FAT16_FAT_CACHE_* flags */
+    uint8_t flags;
+};
+
+/* a run of consecutive clusters */
+struct fat16_cluster_run_struct
+{
+    cluster_t cluster;
+    cluster_t count;
 };
 
 struct fat16_fs_struct
 {
     struct partition_struct* partition;
     struct fat16_header_struct header;
+    struct fat16_fat_cache_struct fat_cache[FAT16_FAT_CACHE_SECTORS];
+    uint16_t fat_cache_stamp;
+    /* cluster at which the search for a free cluster starts */
+    cluster_t cluster_free_hint;
+    /* number of free clusters */
+    uint32_t cluster_free_count;
+#if FAT16_FAT32_SUPPORT
+    /* set once the free cluster count of the fsinfo sector has been invalidated */
+    uint8_t fsinfo_dirty;
+#endif
+#if FAT16_FREE_RUNS
+    /* the longest runs of free clusters, collected on the first allocation */
+    struct fat16_cluster_run_struct free_runs[FAT16_FREE_RUNS];
+    uint8_t free_runs_valid;
+#endif
+#if FAT16_DIR_INDEX_ENTRIES
+    /* the open directory handles, whose indexes have to learn about changes */
+    struct fat16_dir_struct* dirs;
+#endif
 };
 
 struct fat16_file_struct
@@ -153,7 +247,30 @@ struct fat16_file_struct
     struct fat16_fs_struct* fs;
     struct fat16_dir_entry_struct dir_entry;
     uint32_t pos;
-    uint16_t pos_cluster;
+    cluster_t pos_cluster;
+#if FAT16_FILE_EXTENTS
+    /* the runs of consecutive clusters the file starts with */
+    struct fat16_cluster_run_struct extents[FAT16_FILE_EXTENTS];
+    /* the cluster last reached beyond a full map, and its index in the chain */
+    cluster_t walk_cluster;
+    uint32_t walk_index;
+#endif
+    uint8_t extent_count;
+    /* set if clusters beyond the end of the file may have been reserved */
+    uint8_t preallocated;
+#if FAT16_FILE_BUFFER
+    /* the sector last written to partially */
+    uint8_t buffer[512];
+    /* device offset of the buffered sector, 0 if there is none */
+    offset_t buffer_offset;
+    uint8_t buffer_dirty;
+#endif
+    /* set if the directory entry on disk is outdated */
+    uint8_t dir_entry_dirty;
+#if FAT16_DIR_ENTRY_SYNC_BYTES
+    /* the file size last written to the directory entry */
+    uint32_t dir_entry_size;
+#endif
 };
 
 struct fat16_dir_struct
@@ -161,35 +278,97 @@ struct fat16_dir_struct
     struct fat16_fs_struct* fs;
     struct fat16_dir_entry_struct dir_entry;
     uint16_t entry_next;
+    /* offset of the next raw entry to read, 0 if reading has to restart */
+    offset_t entry_offset;
+    /* cluster containing entry_offset, 0 within the root directory of a FAT16 */
+    cluster_t entry_cluster;
+#if FAT16_DIR_INDEX_ENTRIES
+    /* hashes of the names in the directory, and where their entries start in units of 32 bytes */
+    uint16_t index_hash[FAT16_DIR_INDEX_ENTRIES];
+    uint32_t index_slot[FAT16_DIR_INDEX_ENTRIES];
+    uint16_t index_count;
+    /* set if the index does not hold all names of the directory */
+    uint8_t index_incomplete;
+    /* the next open directory handle of the filesystem */
+    struct fat16_dir_struct* dir_next;
+#endif
+};
+
+/* a pool of statically allocated handles */
+struct fat16_pool_struct
+{
+    /* slots given back, which are taken again first */
+    uint8_t* free_slots;
+    uint8_t free_count;
+    /* number of slots taken so far, which is the most ever in use at once */
+    uint8_t used;
+    uint8_t size;
 };
 
+static struct fat16_fs_struct fat16_fs_handles[FAT16_FS_HANDLES];
+static uint8_t fat16_fs_free_slots[FAT16_FS_HANDLES];
+static struct fat16_pool_struct fat16_fs_pool = { fat16_fs_free_slots, 0, 0, FAT16_FS_HANDLES };
+
+static struct fat16_file_struct fat16_file_handles[FAT16_FILE_HANDLES];
+static uint8_t fat16_file_free_slots[FAT16_FILE_HANDLES];
+static struct fat16_pool_struct fat16_file_pool = { fat16_file_free_slots, 0, 0, FAT16_FILE_HANDLES };
+
+static struct fat16_dir_struct fat16_dir_handles[FAT16_DIR_HANDLES];
+static uint8_t fat16_dir_free_slots[FAT16_DIR_HANDLES];
+static struct fat16_pool_struct fat16_dir_pool = { fat16_dir_free_slots, 0, 0, FAT16_DIR_HANDLES };
+
 struct fat16_read_callback_arg
 {
-    uint16_t entry_cur;
-    uint16_t entry_num;
-    uint32_t entry_offset;
-    uint8_t byte_count;
+    struct fat16_dir_entry_struct* dir_entry;
+    offset_t entry_offset_next;
+    uint8_t result;
 };
 
-struct fat16_usage_count_callback_arg
+struct fat16_stream_callback_arg
 {
-    uint16_t cluster_count;
-    uint8_t buffer_size;
+    struct fat16_file_struct* fd;
+    device_read_callback_t callback;
+    void* p;
+    uint8_t stopped;
 };
 
+static int16_t fat16_pool_take(struct fat16_pool_struct* pool);
+static uint8_t fat16_pool_give(struct fat16_pool_struct* pool, int16_t slot);
 static uint8_t fat16_read_header(struct fat16_fs_struct* fs);
-static uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, uint16_t entry_num, struct fat16_dir_entry_struct* dir_entry);
-static uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, uint16_t entry_num, const struct fat16_dir_entry_struct* parent, struct fat16_dir_entry_struct* dir_entry);
-static uint8_t fat16_dir_entry_seek_callback(uint8_t* buffer, uint32_t offset, void* p);
-static uint8_t fat16_dir_entry_read_callback(uint8_t* buffer, uint32_t offset, void* p);
+static uint8_t fat16_read_dir_next(struct fat16_dir_struct* dd, struct fat16_dir_entry_struct* dir_entry);
+static uint8_t fat16_dir_entry_read_callback(uint8_t* buffer, offset_t offset, void* p);
+static uint16_t fat16_hash_name(const char* name);
+static void fat16_index_dir(struct fat16_dir_struct* dd);
+static void fat16_index_add(struct fat16_dir_struct* dd, const struct fat16_dir_entry_struct* dir_entry);
+static void fat16_index_outdate(const struct fat16_dir_struct* dd);
+static void fat16_index_remove(struct fat16_fs_struct* fs, offset_t entry_offset);
+static uint8_t fat16_index_find(struct fat16_dir_struct* dd, const char* name, struct fat16_dir_entry_struct* dir_entry);
 static uint8_t fat16_interpret_dir_entry(struct fat16_dir_entry_struct* dir_entry, const uint8_t* raw_entry);
-static uint16_t fat16_get_next_cluster(const struct fat16_fs_struct* fs, uint16_t cluster_num);
-static uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num, uint16_t count);
-static uint8_t fat16_free_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num);
-static uint8_t fat16_terminate_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num);
+static cluster_t fat16_get_next_cluster(struct fat16_fs_struct* fs, cluster_t cluster_num);
+static cluster_t fat16_find_file_cluster(struct fat16_file_struct* fd, uint32_t pos);
+static cluster_t fat16_append_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num, cluster_t count);
+static uint8_t fat16_free_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num);
+static uint8_t fat16_terminate_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num);
+static cluster_t fat16_append_file_clusters(struct fat16_file_struct* fd, cluster_t cluster_num, uint16_t length);
+static uint8_t fat16_write_file_data(struct fat16_file_struct* fd, offset_t offset, const uint8_t* buffer, uint16_t length);
+static uint8_t fat16_flush_file_buffer(struct fat16_file_struct* fd);
+static uint8_t fat16_flush_dir_entry(struct fat16_file_struct* fd);
 static uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, const struct fat16_dir_entry_struct* dir_entry);
-
-static uint8_t fat16_get_fs_free_callback(uint8_t* buffer, uint32_t offset, void* p);
+static uint8_t* fat16_get_fat_entry(struct fat16_fs_struct* fs, cluster_t cluster_num, uint8_t modify);
+static uint8_t fat16_flush_fat_cache(struct fat16_fs_struct* fs);
+static uint8_t fat16_write_fat_sector(struct fat16_fs_struct* fs, const struct fat16_fat_cache_struct* line);
+static cluster_t fat16_read_fat_entry(const struct fat16_fs_struct* fs, const uint8_t* fat_entry);
+static void fat16_write_fat_entry(const struct fat16_fs_struct* fs, uint8_t* fat_entry, cluster_t value);
+static cluster_t fat16_find_free_cluster(struct fat16_fs_struct* fs, cluster_t cluster_prev, cluster_t count);
+static uint8_t fat16_collect_free_runs(struct fat16_fs_struct* fs);
+static uint8_t fat16_count_free_clusters(struct fat16_fs_struct* fs);
+static void fat16_take_free_run(struct fat16_fs_struct* fs, cluster_t cluster_num);
+static void fat16_add_free_run(struct fat16_fs_struct* fs, cluster_t cluster_num);
+#if FAT16_FAT32_SUPPORT
+static uint8_t fat16_write_fsinfo(struct fat16_fs_struct* fs, uint32_t free_count);
+#endif
+
+static uint8_t fat16_stream_file_callback(uint8_t* buffer, offset_t offset, void* p);
 
 /**
  * \ingroup fat16_fs
@@ -210,19 +389,28 @@ struct fat16_fs_struct* fat16_open(struct partition_struct* partition)
        )
     return 0;
 
-    struct fat16_fs_struct* fs = malloc(sizeof(*fs));
-    if(!fs)
+    int16_t slot = fat16_pool_take(&fat16_fs_pool);
+    if(slot < 0)
     {
-        rprintf("MALLOC FAILS\n\r");
+        rprintf("NO FREE FS HANDLE\n\r");
         return 0;
     }
+    struct fat16_fs_struct* fs = &fat16_fs_handles[slot];
     memset(fs, 0, sizeof(*fs));
 
     fs->partition = partition;
     if(!fat16_read_header(fs))
     {
         rprintf("Failed Reading Header\n\r");
-        free(fs);
+        fat16_pool_give(&fat16_fs_pool, slot);
+        return 0;
+    }
+
+    /* count the free clusters, unless the fsinfo sector told us */
+    if(fs->cluster_free_count == FAT16_CLUSTER_COUNT_UNKNOWN &&
+       !fat16_count_free_clusters(fs))
+    {
+        fat16_pool_give(&fat16_fs_pool, slot);
         return 0;
     }
 
@@ -234,23 +422,131 @@ struct fat16_fs_struct* fat16_open(struct partition_struct* partition)
  * Closes a FAT16 filesystem.
  *
  * When this function returns, the given filesystem descriptor
- * will be invalid.
+ * will be invalid. Pending changes are written beforehand.
  *
  * \param[in] fs The filesystem to close.
- * \see fat16_open
+ * \see fat16_open, fat16_sync
  */
 void fat16_close(struct fat16_fs_struct* fs)
 {
-    if(!fs)
+    int16_t slot = FAT16_POOL_SLOT(fat16_fs_handles, FAT16_FS_HANDLES, fs);
+    if(slot < 0)
         return;
 
-    free(fs);
+    fat16_sync(fs);
+
+    fat16_pool_give(&fat16_fs_pool, slot);
+}
+
+/**
+ * \ingroup fat16_fs
+ * Takes a handle from a pool.
+ *
+ * Handles given back are taken again first. Only if there are none,
+ * the next handle never used before is taken.
+ *
+ * \param[in] pool The pool from which to take the handle.
+ * \returns The slot of the handle, or -1 if all handles are in use.
+ * \see fat16_pool_give
+ */
+int16_t fat16_pool_take(struct fat16_pool_struct* pool)
+{
+    if(pool->free_count)
+        return pool->free_slots[--pool->free_count];
+    if(pool->used < pool->size)
+        return pool->used++;
+
+    return -1;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Gives a handle back to its pool.
+ *
+ * Slots which are not in use are refused, so closing a handle twice
+ * does not make the pool hand it out twice.
+ *
+ * \param[in] pool The pool the handle was taken from.
+ * \param[in] slot The slot of the handle, as found by FAT16_POOL_SLOT.
+ * \returns 0 if the slot is not in use, 1 on success.
+ * \see fat16_pool_take
+ */
+uint8_t fat16_pool_give(struct fat16_pool_struct* pool, int16_t slot)
+{
+    if(slot < 0 || slot >= pool->used)
+        return 0;
+
+    uint8_t i;
+    for(i = 0; i < pool->free_count; ++i)
+    {
+        if(pool->free_slots[i] == slot)
+            return 0;
+    }
+
+    pool->free_slots[pool->free_count++] = slot;
+    return 1;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Returns the most handles of each pool which were in use at once.
+ *
+ * Compared with FAT16_FS_HANDLES, FAT16_FILE_HANDLES and FAT16_DIR_HANDLES,
+ * this shows whether the pools are sized right.
+ *
+ * \param[out] fs_peak The most filesystem handles in use at once.
+ * \param[out] file_peak The most file handles in use at once.
+ * \param[out] dir_peak The most directory handles in use at once.
+ */
+void fat16_get_pool_peaks(uint8_t* fs_peak, uint8_t* file_peak, uint8_t* dir_peak)
+{
+    *fs_peak = fat16_fs_pool.used;
+    *file_peak = fat16_file_pool.used;
+    *dir_peak = fat16_dir_pool.used;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Writes pending changes of a FAT16 filesystem to the device.
+ *
+ * Modified fat sectors are kept in memory until they are replaced
+ * or this function is called. Each of them is then written once to
+ * every copy of the fat. On a FAT32, the number of free clusters is
+ * recorded in the fsinfo sector.
+ *
+ * \note The device may buffer writes itself, see sd_raw_sync().
+ *
+ * \param[in] fs The filesystem to synchronize.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_close, fat16_close_file
+ */
+uint8_t fat16_sync(struct fat16_fs_struct* fs)
+{
+    if(!fs)
+        return 0;
+
+    if(!fat16_flush_fat_cache(fs))
+        return 0;
+
+#if FAT16_FAT32_SUPPORT
+    if(fs->fsinfo_dirty)
+    {
+        if(!fat16_write_fsinfo(fs, fs->cluster_free_count))
+            return 0;
+        fs->fsinfo_dirty = 0;
+    }
+#endif
+
+    return 1;
 }
 
 /**
  * \ingroup fat16_fs
  * Reads and parses the header of a FAT16 filesystem.
  *
+ * For a FAT32, the number of free clusters and the cluster where to
+ * search for free ones are taken from the fsinfo sector, if it is valid.
+ *
  * \param[inout] fs The filesystem for which to parse the header.
  * \returns 0 on failure, 1 on success.
  */
@@ -267,8 +563,8 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
     }
 
     /* read fat parameters */
-    uint8_t buffer[25];
-    uint32_t partition_offset = partition->offset * 512;
+    uint8_t buffer[39];
+    offset_t partition_offset = (offset_t) partition->offset * 512;
 
     if(!partition->device_read(partition_offset + 0x0b, buffer, sizeof(buffer)))
         return 0;
@@ -283,14 +579,30 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
     ((uint16_t) buffer[0x07] << 8);
     uint16_t sector_count_16 = ((uint16_t) buffer[0x08]) |
     ((uint16_t) buffer[0x09] << 8);
-    uint16_t sectors_per_fat = ((uint16_t) buffer[0x0b]) |
+    uint32_t sectors_per_fat = ((uint16_t) buffer[0x0b]) |
     ((uint16_t) buffer[0x0c] << 8);
     uint32_t sector_count = ((uint32_t) buffer[0x15]) |
     ((uint32_t) buffer[0x16] << 8) |
     ((uint32_t) buffer[0x17] << 16) |
     ((uint32_t) buffer[0x18] << 24);
+#if FAT16_FAT32_SUPPORT
+    uint32_t sectors_per_fat32 = ((uint32_t) buffer[0x19]) |
+    ((uint32_t) buffer[0x1a] << 8) |
+    ((uint32_t) buffer[0x1b] << 16) |
+    ((uint32_t) buffer[0x1c] << 24);
+    cluster_t root_dir_cluster = ((uint32_t) buffer[0x21]) |
+    ((uint32_t) buffer[0x22] << 8) |
+    ((uint32_t) buffer[0x23] << 16) |
+    ((uint32_t) buffer[0x24] << 24);
+    uint16_t fsinfo_sector = ((uint16_t) buffer[0x25]) |
+    ((uint16_t) buffer[0x26] << 8);
 
     if(sectors_per_fat == 0)
+    /* this may be a FAT32 */
+        sectors_per_fat = sectors_per_fat32;
+#endif
+
+    if(sectors_per_fat == 0 || fat_copies == 0)
     /* this is not a FAT16 */
         return 0;
 
@@ -303,29 +615,39 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
             sector_count = sector_count_16;
     }
 
-    /* ensure we really have a FAT16 fs here */
+    /* ensure we really have a FAT16 or FAT32 fs here */
     uint32_t data_sector_count = sector_count
     - reserved_sectors
     - (uint32_t) sectors_per_fat * fat_copies
     - ((max_root_entries * 32 + bytes_per_sector - 1) / bytes_per_sector);
     uint32_t data_cluster_count = data_sector_count / sectors_per_cluster;
-    if(data_cluster_count < 4085 || data_cluster_count >= 65525)
-    /* this is not a FAT16 */
+    if(data_cluster_count < 4085)
+    /* this is a FAT12 */
+        return 0;
+    if(data_cluster_count < 65525)
+        partition->type = PARTITION_TYPE_FAT16;
+#if FAT16_FAT32_SUPPORT
+    else if(max_root_entries == 0 && data_cluster_count < 0x0ffffff5 &&
+            root_dir_cluster >= 2 && root_dir_cluster < data_cluster_count + 2)
+        partition->type = PARTITION_TYPE_FAT32;
+#endif
+    else
+    /* this is neither a FAT16 nor a FAT32 */
         return 0;
-
-    partition->type = PARTITION_TYPE_FAT16;
 
     /* fill header information */
     struct fat16_header_struct* header = &fs->header;
     memset(header, 0, sizeof(*header));
 
-    header->size = sector_count * bytes_per_sector;
+    header->size = (offset_t) sector_count * bytes_per_sector;
 
     header->fat_offset = /* jump to partition */
     partition_offset +
     /* jump to fat */
-    (uint32_t) reserved_sectors * bytes_per_sector;
-    header->fat_size = (data_cluster_count + 2) * 2;
+    (offset_t) reserved_sectors * bytes_per_sector;
+    header->fat_size = (data_cluster_count + 2) * FAT16_FAT_ENTRY_SIZE(fs);
+    header->fat_copy_size = sectors_per_fat * bytes_per_sector;
+    header->fat_copies = fat_copies;
 
     header->sector_size = bytes_per_sector;
     header->cluster_size = (uint32_t) bytes_per_sector * sectors_per_cluster;
@@ -333,184 +655,150 @@ uint8_t fat16_read_header(struct fat16_fs_struct* fs)
     header->root_dir_offset = /* jump to fats */
     header->fat_offset +
     /* jump to root directory entries */
-    (uint32_t) fat_copies * sectors_per_fat * bytes_per_sector;
+    (offset_t) fat_copies * sectors_per_fat * bytes_per_sector;
 
     header->cluster_zero_offset = /* jump to root directory entries */
     header->root_dir_offset +
     /* skip root directory entries */
     (uint32_t) max_root_entries * 32;
 
-    return 1;
-}
-
-/**
- * \ingroup fat16_fs
- * Reads a directory entry of the root directory.
- *
- * \param[in] fs Descriptor of file system to use.
- * \param[in] entry_num The index of the directory entry to read.
- * \param[out] dir_entry Directory entry descriptor which will get filled.
- * \returns 0 on failure, 1 on success
- * \see fat16_read_sub_dir_entry, fat16_read_dir_entry_by_path
- */
-uint8_t fat16_read_root_dir_entry(const struct fat16_fs_struct* fs, uint16_t entry_num, struct fat16_dir_entry_struct* dir_entry)
-{
-    if(!fs || !dir_entry)
-        return 0;
+    fs->cluster_free_count = FAT16_CLUSTER_COUNT_UNKNOWN;
 
-    /* we read from the root directory entry */
-    const struct fat16_header_struct* header = &fs->header;
-    device_read_interval_t device_read_interval = fs->partition->device_read_interval;
-    uint8_t buffer[32];
+#if FAT16_FAT32_SUPPORT
+    if(FAT16_IS_FAT32(fs))
+    {
+        header->root_dir_cluster = root_dir_cluster;
 
-    /* seek to the n-th entry */
-    struct fat16_read_callback_arg arg;
-    memset(&arg, 0, sizeof(arg));
-    arg.entry_num = entry_num;
-    if(!device_read_interval(header->root_dir_offset,
-        buffer,
-       sizeof(buffer),
-       header->cluster_zero_offset - header->root_dir_offset,
-       fat16_dir_entry_seek_callback,
-       &arg) ||
-       arg.entry_offset == 0
-       )
-    return 0;
+        if(fsinfo_sector != 0 && fsinfo_sector < reserved_sectors)
+        {
+            offset_t fsinfo_offset = partition_offset + (offset_t) fsinfo_sector * bytes_per_sector;
+            if(!partition->device_read(fsinfo_offset, buffer, 4) ||
+               !partition->device_read(fsinfo_offset + 484, buffer + 4, 12))
+                return 0;
 
-    /* read entry */
-    memset(dir_entry, 0, sizeof(*dir_entry));
-    if(!device_read_interval(arg.entry_offset,
-        buffer,
-       sizeof(buffer),
-       arg.byte_count,
-       fat16_dir_entry_read_callback,
-       dir_entry))
-    return 0;
+            if(memcmp(buffer, "RRaA", 4) == 0 && memcmp(buffer + 4, "rrAa", 4) == 0)
+            {
+                uint32_t free_count = ((uint32_t) buffer[8]) |
+                ((uint32_t) buffer[9] << 8) |
+                ((uint32_t) buffer[10] << 16) |
+                ((uint32_t) buffer[11] << 24);
+                uint32_t free_next = ((uint32_t) buffer[12]) |
+                ((uint32_t) buffer[13] << 8) |
+                ((uint32_t) buffer[14] << 16) |
+                ((uint32_t) buffer[15] << 24);
+
+                header->fsinfo_offset = fsinfo_offset;
+                if(free_count <= data_cluster_count)
+                    fs->cluster_free_count = free_count;
+                if(free_next >= 2 && free_next < data_cluster_count + 2)
+                    fs->cluster_free_hint = free_next;
+            }
+        }
+    }
+#endif
 
-    return dir_entry->long_name[0] != '\0' ? 1 : 0;
+    return 1;
 }
 
 /**
  * \ingroup fat16_fs
- * Reads a directory entry of a given parent directory.
+ * Reads the directory entry at the cursor of a directory handle.
+ *
+ * Reading continues at the raw entry following the one last read, so
+ * iterating through a directory reads each raw entry only once. In a
+ * subdirectory, the cursor moves on to the next cluster when the
+ * current one is exhausted.
  *
- * \param[in] fs Descriptor of file system to use.
- * \param[in] entry_num The index of the directory entry to read.
- * \param[in] parent Directory entry descriptor in which to read directory entry.
+ * \param[in] dd The directory handle, with a valid cursor.
  * \param[out] dir_entry Directory entry descriptor which will get filled.
- * \returns 0 on failure, 1 on success
- * \see fat16_read_root_dir_entry, fat16_read_dir_entry_by_path
+ * \returns 0 on failure or at the end of the directory, 1 on success
+ * \see fat16_read_dir
  */
-uint8_t fat16_read_sub_dir_entry(const struct fat16_fs_struct* fs, uint16_t entry_num, const struct fat16_dir_entry_struct* parent, struct fat16_dir_entry_struct* dir_entry)
+uint8_t fat16_read_dir_next(struct fat16_dir_struct* dd, struct fat16_dir_entry_struct* dir_entry)
 {
-    if(!fs || !parent || !dir_entry)
-        return 0;
-
-    /* we are in a parent directory and want to search within its directory entry table */
-    if(!(parent->attributes & FAT16_ATTRIB_DIR))
-        return 0;
-
-    /* loop through all clusters of the directory */
+    struct fat16_fs_struct* fs = dd->fs;
+    const struct fat16_header_struct* header = &fs->header;
     uint8_t buffer[32];
-    uint32_t cluster_offset;
-    uint16_t cluster_size = fs->header.cluster_size;
-    uint16_t cluster_num = parent->cluster;
     struct fat16_read_callback_arg arg;
 
+    memset(dir_entry, 0, sizeof(*dir_entry));
+    memset(&arg, 0, sizeof(arg));
+    arg.dir_entry = dir_entry;
+
     while(1)
     {
-        /* calculate new cluster offset */
-        cluster_offset = fs->header.cluster_zero_offset + (uint32_t) (cluster_num - 2) * cluster_size;
-
-        /* seek to the n-th entry */
-        memset(&arg, 0, sizeof(arg));
-        arg.entry_num = entry_num;
-        if(!fs->partition->device_read_interval(cluster_offset,
-            buffer,
-           sizeof(buffer),
-           cluster_size,
-           fat16_dir_entry_seek_callback,
-           &arg)
-           )
-        return 0;
+        /* the root directory of a FAT16 is a single area, other directories consist of clusters */
+        offset_t offset_end;
+        if(dd->entry_cluster == 0)
+            offset_end = header->cluster_zero_offset;
+        else
+            offset_end = header->cluster_zero_offset + (offset_t) (dd->entry_cluster - 1) * header->cluster_size;
 
-        /* check if we found the entry */
-        if(arg.entry_offset)
-            break;
+        if(dd->entry_offset < offset_end)
+        {
+            if(!fs->partition->device_read_interval(dd->entry_offset,
+                                                    buffer,
+                                                    sizeof(buffer),
+                                                    offset_end - dd->entry_offset,
+                                                    fat16_dir_entry_read_callback,
+                                                    &arg
+                                                   ))
+                return 0;
 
-        /* get number of next cluster */
-        if(!(cluster_num = fat16_get_next_cluster(fs, cluster_num)))
-            return 0; /* directory entry not found */
-    }
+            if(arg.result == 2)
+            {
+                dd->entry_offset = arg.entry_offset_next;
+                return 1;
+            }
+            if(arg.result)
+                return 0;
+        }
 
-    memset(dir_entry, 0, sizeof(*dir_entry));
+        if(dd->entry_cluster == 0)
+            return 0;
 
-    /* read entry */
-    if(!fs->partition->device_read_interval(arg.entry_offset,
-        buffer,
-       sizeof(buffer),
-       arg.byte_count,
-       fat16_dir_entry_read_callback,
-       dir_entry))
-    return 0;
+        /* continue with the next cluster of the directory */
+        cluster_t cluster_num = fat16_get_next_cluster(fs, dd->entry_cluster);
+        if(!cluster_num)
+            return 0;
 
-    return dir_entry->long_name[0] != '\0' ? 1 : 0;
+        dd->entry_cluster = cluster_num;
+        dd->entry_offset = header->cluster_zero_offset + (offset_t) (cluster_num - 2) * header->cluster_size;
+    }
 }
 
 /**
  * \ingroup fat16_fs
- * Callback function for seeking through subdirectory entries.
+ * Callback function for reading a directory entry.
  */
-uint8_t fat16_dir_entry_seek_callback(uint8_t* buffer, uint32_t offset, void* p)
+uint8_t fat16_dir_entry_read_callback(uint8_t* buffer, offset_t offset, void* p)
 {
     struct fat16_read_callback_arg* arg = p;
+    struct fat16_dir_entry_struct* dir_entry = arg->dir_entry;
 
-    /* skip deleted or empty entries */
+    /* skip deleted or empty entries, together with lfn entries read before */
     if(buffer[0] == FAT16_DIRENTRY_DELETED || !buffer[0])
-        return 1;
-
-    if(arg->entry_cur == arg->entry_num)
     {
-        arg->entry_offset = offset;
-        arg->byte_count = buffer[11] == 0x0f ?
-        ((buffer[0] & FAT16_DIRENTRY_LFNSEQMASK) + 1) * 32 :
-        32;
-        return 0;
+        memset(dir_entry, 0, sizeof(*dir_entry));
+        return 1;
     }
 
-    /* if we read a 8.3 entry, we reached a new directory entry */
-    if(buffer[11] != 0x0f)
-        ++arg->entry_cur;
-
-    return 1;
-}
-
-/**
- * \ingroup fat16_fs
- * Callback function for reading a directory entry.
- */
-uint8_t fat16_dir_entry_read_callback(uint8_t* buffer, uint32_t offset, void* p)
-{
-    struct fat16_dir_entry_struct* dir_entry = p;
-
-    /* there should not be any deleted or empty entries */
-    if(buffer[0] == FAT16_DIRENTRY_DELETED || !buffer[0])
-        return 0;
-
     if(!dir_entry->entry_offset)
         dir_entry->entry_offset = offset;
 
-    switch(fat16_interpret_dir_entry(dir_entry, buffer))
+    arg->result = fat16_interpret_dir_entry(dir_entry, buffer);
+    switch(arg->result)
     {
-        case 0: /* failure */
-            return 0;
-            case 1: /* buffer successfully parsed, continue */
+        case 1: /* buffer successfully parsed, continue */
+            arg->result = 0;
             return 1;
-            case 2: /* directory entry complete, finish */
+        case 2: /* directory entry complete, finish */
+            arg->entry_offset_next = offset + 32;
             return 0;
-        }
-
-    return 0;
+        default: /* failure */
+            arg->result = 1;
+            return 0;
+    }
 }
 
 /**
@@ -597,8 +885,13 @@ uint8_t fat16_interpret_dir_entry(struct fat16_dir_entry_struct* dir_entry, cons
 
         /* extract properties of file and store them within the structure */
         dir_entry->attributes = raw_entry[11];
-        dir_entry->cluster = ((uint16_t) raw_entry[26]) |
-        ((uint16_t) raw_entry[27] << 8);
+        dir_entry->cluster = ((cluster_t) raw_entry[26]) |
+        ((cluster_t) raw_entry[27] << 8);
+#if FAT16_FAT32_SUPPORT
+        /* the upper half is only used by FAT32, and zero on FAT16 */
+        dir_entry->cluster |= ((cluster_t) raw_entry[20] << 16) |
+        ((cluster_t) raw_entry[21] << 24);
+#endif
         dir_entry->file_size = ((uint32_t) raw_entry[28]) |
         ((uint32_t) raw_entry[29] << 8) |
         ((uint32_t) raw_entry[30] << 16) |
@@ -681,109 +974,683 @@ uint8_t fat16_get_dir_entry_of_path(struct fat16_fs_struct* fs, const char* path
 
 /**
  * \ingroup fat16_fs
- * Retrieves the next following cluster of a given cluster.
+ * Locates the fat entry of a cluster in the fat cache.
  *
- * Using the filesystem file allocation table, this function returns
- * the number of the cluster containing the data directly following
- * the data within the cluster with the given number.
+ * Loads the fat sector containing the entry if it is not cached yet,
+ * replacing the least recently used sector. Unmodified sectors are
+ * replaced first, which saves writing back a sector still in use
+ * while the fat is searched.
  *
- * \param[in] fs The filesystem for which to determine the next cluster.
- * \param[in] cluster_num The number of the cluster for which to determine its successor.
- * \returns The wanted cluster number, or 0 on error.
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The cluster whose fat entry to locate.
+ * \param[in] modify Set to 1 if the entry is going to be changed.
+ * \returns A pointer to the two (FAT16) or four (FAT32) bytes of the entry, or 0 on failure.
+ * \see fat16_read_fat_entry, fat16_write_fat_entry, fat16_flush_fat_cache
  */
-uint16_t fat16_get_next_cluster(const struct fat16_fs_struct* fs, uint16_t cluster_num)
+uint8_t* fat16_get_fat_entry(struct fat16_fs_struct* fs, cluster_t cluster_num, uint8_t modify)
 {
-    if(!fs || cluster_num < 2)
-        return 0;
+#if FAT16_FAT32_SUPPORT
+    /* the free cluster count of the fsinfo sector is about to become wrong,
+     * and has to be marked unknown before any modified fat sector may be
+     * written back, see fat16_write_fsinfo()
+     */
+    if(modify && !fs->fsinfo_dirty)
+    {
+        if(!fat16_write_fsinfo(fs, FAT16_CLUSTER_COUNT_UNKNOWN))
+            return 0;
+        fs->fsinfo_dirty = 1;
+    }
+#endif
 
-    /* read appropriate fat entry */
-    uint8_t fat_entry[2];
-    if(!fs->partition->device_read(fs->header.fat_offset + 2 * cluster_num, fat_entry, 2))
-        return 0;
+    uint8_t entry_size = FAT16_FAT_ENTRY_SIZE(fs);
+    uint32_t sector = cluster_num / (512 / entry_size);
+    struct fat16_fat_cache_struct* line = 0;
+    uint8_t i;
+    for(i = 0; i < FAT16_FAT_CACHE_SECTORS; ++i)
+    {
+        struct fat16_fat_cache_struct* l = &fs->fat_cache[i];
+        if(!(l->flags & FAT16_FAT_CACHE_VALID))
+        {
+            if(!line || (line->flags & FAT16_FAT_CACHE_VALID))
+                line = l;
+            continue;
+        }
+        if(l->sector == sector)
+        {
+            line = l;
+            break;
+        }
+        /* replace the least recently used sector, preferring unmodified ones */
+        if(!line)
+        {
+            line = l;
+        }
+        else if(line->flags & FAT16_FAT_CACHE_VALID)
+        {
+            uint8_t l_dirty = l->flags & FAT16_FAT_CACHE_DIRTY;
+            uint8_t line_dirty = line->flags & FAT16_FAT_CACHE_DIRTY;
+            /* compare the ages, which stay right when the stamp wraps around */
+            uint16_t l_age = fs->fat_cache_stamp - l->stamp;
+            uint16_t line_age = fs->fat_cache_stamp - line->stamp;
+            if(l_dirty < line_dirty || (l_dirty == line_dirty && l_age > line_age))
+                line = l;
+        }
+    }
 
-    /* determine next cluster from fat */
-    cluster_num = ((uint16_t) fat_entry[0]) |
-    ((uint16_t) fat_entry[1] << 8);
-	///*
-    if(cluster_num == FAT16_CLUSTER_FREE ||
-        cluster_num == FAT16_CLUSTER_BAD ||
-       (cluster_num >= FAT16_CLUSTER_RESERVED_MIN && cluster_num <= FAT16_CLUSTER_RESERVED_MAX) ||
-       (cluster_num >= FAT16_CLUSTER_LAST_MIN && cluster_num <= FAT16_CLUSTER_LAST_MAX))
-    //*/
-	return 0;
+    if(!(line->flags & FAT16_FAT_CACHE_VALID) || line->sector != sector)
+    {
+        /* write back the sector we replace */
+        if(line->flags & FAT16_FAT_CACHE_DIRTY)
+        {
+            if(!fat16_write_fat_sector(fs, line))
+                return 0;
+        }
 
-    return cluster_num;
+        line->flags = 0;
+        if(!fs->partition->device_read(fs->header.fat_offset + (offset_t) sector * 512, line->buffer, 512))
+            return 0;
+
+        line->sector = sector;
+        line->flags = FAT16_FAT_CACHE_VALID;
+    }
+
+    line->stamp = ++fs->fat_cache_stamp;
+    if(modify)
+        line->flags |= FAT16_FAT_CACHE_DIRTY;
+
+    return line->buffer + (cluster_num % (512 / entry_size)) * entry_size;
 }
 
 /**
  * \ingroup fat16_fs
- * Appends a new cluster chain to an existing one.
+ * Writes all modified sectors of the fat cache to the device.
  *
- * Set cluster_num to zero to create a completely new one.
+ * Changes to the fat are collected in the cache and only written
+ * when a sector is replaced or the filesystem is synchronized, each
+ * sector once to every copy of the fat.
  *
- * \param[in] fs The file system on which to operate.
- * \param[in] cluster_num The cluster to which to append the new chain.
- * \param[in] count The number of clusters to allocate.
- * \returns 0 on failure, the number of the first new cluster on success.
+ * \param[in] fs The filesystem on which to operate.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_get_fat_entry
  */
-uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num, uint16_t count)
+uint8_t fat16_flush_fat_cache(struct fat16_fs_struct* fs)
 {
-    #if FAT16_WRITE_SUPPORT
-        if(!fs)
+    uint8_t i;
+    for(i = 0; i < FAT16_FAT_CACHE_SECTORS; ++i)
+    {
+        struct fat16_fat_cache_struct* line = &fs->fat_cache[i];
+        if(!(line->flags & FAT16_FAT_CACHE_DIRTY))
+            continue;
+
+        if(!fat16_write_fat_sector(fs, line))
             return 0;
-    
-        device_read_t device_read = fs->partition->device_read;
-        device_write_t device_write = fs->partition->device_write;
-        uint32_t fat_offset = fs->header.fat_offset;
-        uint16_t cluster_max = fs->header.fat_size / 2;
-        uint16_t cluster_next = 0;
-        uint16_t count_left = count;
-        uint8_t buffer[2];
-        uint16_t cluster_new;
-        for(cluster_new = 0; cluster_new < cluster_max; ++cluster_new)
-        {
-            if(!device_read(fat_offset + 2 * cluster_new, buffer, sizeof(buffer)))
-                return 0;
-    
-            /* check if this is a free cluster */
-            if(buffer[0] == (FAT16_CLUSTER_FREE & 0xff) &&
-                buffer[1] == ((FAT16_CLUSTER_FREE >> 8) & 0xff))
-            {
-                /* allocate cluster */
-                if(count_left == count)
-                {
-                    buffer[0] = FAT16_CLUSTER_LAST_MAX & 0xff;
-                    buffer[1] = (FAT16_CLUSTER_LAST_MAX >> 8) & 0xff;
-                }
-                else
-                {
-                    buffer[0] = cluster_next & 0xff;
-                    buffer[1] = (cluster_next >> 8) & 0xff;
-                }
-    
-                if(!device_write(fat_offset + 2 * cluster_new, buffer, sizeof(buffer)))
-                    break;
-    
-                cluster_next = cluster_new;
-                if(--count_left == 0)
-                    break;
-            }
-        }
-    
-        do
-        {
-            if(count_left > 0)
-                break;
-    
-            /* We allocated a new cluster chain. Now join
-                                             * it with the existing one.
-                                             */
-            if(cluster_num >= 2)
+
+        line->flags &= ~FAT16_FAT_CACHE_DIRTY;
+    }
+
+    return 1;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Writes a sector of the fat cache to every copy of the fat.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] line The cached sector to write.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_flush_fat_cache
+ */
+uint8_t fat16_write_fat_sector(struct fat16_fs_struct* fs, const struct fat16_fat_cache_struct* line)
+{
+    offset_t offset = fs->header.fat_offset + (offset_t) line->sector * 512;
+    uint8_t i;
+    for(i = 0; i < fs->header.fat_copies; ++i)
+    {
+        if(!fs->partition->device_write(offset, line->buffer, 512))
+            return 0;
+        offset += fs->header.fat_copy_size;
+    }
+
+    return 1;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Reads the value of a fat entry.
+ *
+ * The values of FAT16 entries marking reserved, bad or last clusters
+ * are widened to the ones of FAT32, so the FAT16_CLUSTER_* constants
+ * apply to both.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] fat_entry The entry, as returned by fat16_get_fat_entry().
+ * \returns The number of the next cluster, or one of the FAT16_CLUSTER_* values.
+ * \see fat16_write_fat_entry
+ */
+cluster_t fat16_read_fat_entry(const struct fat16_fs_struct* fs, const uint8_t* fat_entry)
+{
+    cluster_t value = ((cluster_t) fat_entry[0]) |
+    ((cluster_t) fat_entry[1] << 8);
+
+#if FAT16_FAT32_SUPPORT
+    if(FAT16_IS_FAT32(fs))
+        /* the upper four bits are reserved */
+        value |= ((cluster_t) fat_entry[2] << 16) |
+        ((cluster_t) (fat_entry[3] & 0x0f) << 24);
+    else if(value >= 0xfff0)
+        value |= 0x0fff0000;
+#endif
+
+    return value;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Changes the value of a fat entry.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] fat_entry The entry, as returned by fat16_get_fat_entry() for modification.
+ * \param[in] value The number of the next cluster, or one of the FAT16_CLUSTER_* values.
+ * \see fat16_read_fat_entry
+ */
+void fat16_write_fat_entry(const struct fat16_fs_struct* fs, uint8_t* fat_entry, cluster_t value)
+{
+    fat_entry[0] = (value >> 0) & 0xff;
+    fat_entry[1] = (value >> 8) & 0xff;
+
+#if FAT16_FAT32_SUPPORT
+    if(FAT16_IS_FAT32(fs))
+    {
+        /* keep the reserved upper four bits */
+        fat_entry[2] = (value >> 16) & 0xff;
+        fat_entry[3] = (fat_entry[3] & 0xf0) | ((value >> 24) & 0x0f);
+    }
+#endif
+}
+
+#if FAT16_FAT32_SUPPORT
+/**
+ * \ingroup fat16_fs
+ * Updates the fsinfo sector of a FAT32.
+ *
+ * The fsinfo sector records the number of free clusters and where to
+ * search for the next free one, which spares searching the fat after
+ * mounting. As the number changes with every allocation, it is marked
+ * as unknown when the fat is first modified, and only written once
+ * the filesystem is synchronized.
+ *
+ * Marking it unknown cannot wait for the synchronization. A modified
+ * fat sector may be written back as soon as it is replaced in the fat
+ * cache. If power is lost before the real count follows, the old
+ * count would stay on the card as valid, and other systems would
+ * report free space the fat no longer has without ever counting it
+ * again. An unknown count just makes them count at mount.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] free_count The number of free clusters to record.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t fat16_write_fsinfo(struct fat16_fs_struct* fs, uint32_t free_count)
+{
+    #if FAT16_WRITE_SUPPORT
+        if(!fs->header.fsinfo_offset)
+            return 1;
+
+        uint32_t free_next = fs->cluster_free_hint;
+        if(free_next < 2)
+            free_next = 0xffffffff;
+
+        uint8_t buffer[8];
+        buffer[0] = (free_count >> 0) & 0xff;
+        buffer[1] = (free_count >> 8) & 0xff;
+        buffer[2] = (free_count >> 16) & 0xff;
+        buffer[3] = (free_count >> 24) & 0xff;
+        buffer[4] = (free_next >> 0) & 0xff;
+        buffer[5] = (free_next >> 8) & 0xff;
+        buffer[6] = (free_next >> 16) & 0xff;
+        buffer[7] = (free_next >> 24) & 0xff;
+
+        return fs->partition->device_write(fs->header.fsinfo_offset + 488, buffer, sizeof(buffer));
+    #else
+        return 0;
+    #endif
+}
+#endif
+
+/**
+ * \ingroup fat16_fs
+ * Retrieves the next following cluster of a given cluster.
+ *
+ * Using the filesystem file allocation table, this function returns
+ * the number of the cluster containing the data directly following
+ * the data within the cluster with the given number.
+ *
+ * \param[in] fs The filesystem for which to determine the next cluster.
+ * \param[in] cluster_num The number of the cluster for which to determine its successor.
+ * \returns The wanted cluster number, or 0 on error.
+ */
+cluster_t fat16_get_next_cluster(struct fat16_fs_struct* fs, cluster_t cluster_num)
+{
+    if(!fs || cluster_num < 2)
+        return 0;
+
+    /* read appropriate fat entry */
+    const uint8_t* fat_entry = fat16_get_fat_entry(fs, cluster_num, 0);
+    if(!fat_entry)
+        return 0;
+
+    /* determine next cluster from fat */
+    cluster_num = fat16_read_fat_entry(fs, fat_entry);
+	///*
+    if(cluster_num == FAT16_CLUSTER_FREE ||
+        cluster_num == FAT16_CLUSTER_BAD ||
+       (cluster_num >= FAT16_CLUSTER_RESERVED_MIN && cluster_num <= FAT16_CLUSTER_RESERVED_MAX) ||
+       (cluster_num >= FAT16_CLUSTER_LAST_MIN && cluster_num <= FAT16_CLUSTER_LAST_MAX))
+    //*/
+	return 0;
+
+    return cluster_num;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Looks for a free cluster to allocate.
+ *
+ * The cluster following cluster_prev is preferred, so that chains stay
+ * contiguous. Otherwise a cluster is taken from the longest of the
+ * remembered runs of free clusters, or from a run which holds all of the
+ * clusters still needed if count is known to be larger than one. As a
+ * last resort, the fat is searched starting at the cluster following the
+ * last allocation.
+ *
+ * The cluster returned is removed from the free cluster bookkeeping, so
+ * the caller is expected to allocate it.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_prev The cluster after which to allocate, or zero.
+ * \param[in] count The number of clusters still to allocate.
+ * \returns 0 on failure or if there is no free cluster, the cluster number on success.
+ */
+cluster_t fat16_find_free_cluster(struct fat16_fs_struct* fs, cluster_t cluster_prev, cluster_t count)
+{
+    cluster_t cluster_max = fs->header.fat_size / FAT16_FAT_ENTRY_SIZE(fs);
+    cluster_t cluster_num = 0;
+    const uint8_t* fat_entry;
+
+    /* continue the chain contiguously if possible */
+    if(cluster_prev >= 2 && cluster_prev + 1 < cluster_max)
+    {
+        fat_entry = fat16_get_fat_entry(fs, cluster_prev + 1, 0);
+        if(!fat_entry)
+            return 0;
+        if(fat16_read_fat_entry(fs, fat_entry) == FAT16_CLUSTER_FREE)
+            cluster_num = cluster_prev + 1;
+    }
+
+#if FAT16_FREE_RUNS
+    if(!cluster_num)
+    {
+        if(!fs->free_runs_valid && !fat16_collect_free_runs(fs))
+            return 0;
+
+        while(!cluster_num)
+        {
+            /* prefer the shortest run holding more than a single cluster
+             * requested, otherwise the longest one
+             */
+            struct fat16_cluster_run_struct* run = 0;
+            uint8_t i;
+            for(i = 0; i < FAT16_FREE_RUNS; ++i)
+            {
+                struct fat16_cluster_run_struct* r = &fs->free_runs[i];
+                if(!r->count)
+                    continue;
+                if(!run ||
+                   (count > 1 && r->count >= count && (run->count < count || r->count < run->count)) ||
+                   ((count <= 1 || run->count < count) && r->count > run->count))
+                    run = r;
+            }
+            if(!run)
+                break;
+
+            fat_entry = fat16_get_fat_entry(fs, run->cluster, 0);
+            if(!fat_entry)
+                return 0;
+            if(fat16_read_fat_entry(fs, fat_entry) == FAT16_CLUSTER_FREE)
             {
-                buffer[0] = cluster_next & 0xff;
-                buffer[1] = (cluster_next >> 8) & 0xff;
-                if(!device_write(fat_offset + 2 * cluster_num, buffer, sizeof(buffer)))
+                cluster_num = run->cluster;
+            }
+            else
+            {
+                /* the run is outdated, skip its first cluster */
+                ++run->cluster;
+                --run->count;
+            }
+        }
+    }
+#endif
+
+    if(!cluster_num)
+    {
+        /* search the fat, wrapping around at its end */
+        cluster_t i;
+        cluster_num = fs->cluster_free_hint;
+        if(cluster_num < 2 || cluster_num >= cluster_max)
+            cluster_num = 2;
+        for(i = 2; i < cluster_max; ++i)
+        {
+            fat_entry = fat16_get_fat_entry(fs, cluster_num, 0);
+            if(!fat_entry)
+                return 0;
+            if(fat16_read_fat_entry(fs, fat_entry) == FAT16_CLUSTER_FREE)
+                break;
+
+            if(++cluster_num >= cluster_max)
+                cluster_num = 2;
+        }
+        if(i >= cluster_max)
+            return 0;
+    }
+
+    fs->cluster_free_hint = cluster_num + 1;
+    fat16_take_free_run(fs, cluster_num);
+
+    return cluster_num;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Searches the fat for the longest runs of free clusters.
+ *
+ * The fat of a large FAT32 spans megabytes. Only FAT16_FAT32_RUNS_SEARCH
+ * entries of it are searched, starting at the free cluster hint.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_find_free_cluster
+ */
+uint8_t fat16_collect_free_runs(struct fat16_fs_struct* fs)
+{
+#if FAT16_FREE_RUNS
+    cluster_t cluster_max = fs->header.fat_size / FAT16_FAT_ENTRY_SIZE(fs);
+    cluster_t run_cluster = 0;
+    cluster_t run_count = 0;
+    cluster_t cluster_num = 2;
+
+#if FAT16_FAT32_SUPPORT
+    if(FAT16_IS_FAT32(fs))
+    {
+        if(fs->cluster_free_hint >= 2 && fs->cluster_free_hint < cluster_max)
+            cluster_num = fs->cluster_free_hint;
+        if(cluster_max - cluster_num > FAT16_FAT32_RUNS_SEARCH)
+            cluster_max = cluster_num + FAT16_FAT32_RUNS_SEARCH;
+    }
+#endif
+
+    memset(fs->free_runs, 0, sizeof(fs->free_runs));
+
+    for(; cluster_num <= cluster_max; ++cluster_num)
+    {
+        if(cluster_num < cluster_max)
+        {
+            const uint8_t* fat_entry = fat16_get_fat_entry(fs, cluster_num, 0);
+            if(!fat_entry)
+                return 0;
+            if(fat16_read_fat_entry(fs, fat_entry) == FAT16_CLUSTER_FREE)
+            {
+                if(!run_count++)
+                    run_cluster = cluster_num;
+                continue;
+            }
+        }
+
+        if(!run_count)
+            continue;
+
+        /* the run ended, replace the shortest one remembered */
+        struct fat16_cluster_run_struct* run = &fs->free_runs[0];
+        uint8_t i;
+        for(i = 1; i < FAT16_FREE_RUNS; ++i)
+        {
+            if(fs->free_runs[i].count < run->count)
+                run = &fs->free_runs[i];
+        }
+        if(run->count < run_count)
+        {
+            run->cluster = run_cluster;
+            run->count = run_count;
+        }
+
+        run_count = 0;
+    }
+
+    fs->free_runs_valid = 1;
+#endif
+
+    return 1;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Removes a cluster about to be allocated from the runs of free clusters.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The cluster which gets allocated.
+ */
+void fat16_take_free_run(struct fat16_fs_struct* fs, cluster_t cluster_num)
+{
+#if FAT16_FREE_RUNS
+    uint8_t i;
+    for(i = 0; i < FAT16_FREE_RUNS; ++i)
+    {
+        struct fat16_cluster_run_struct* run = &fs->free_runs[i];
+        if(cluster_num < run->cluster || cluster_num - run->cluster >= run->count)
+            continue;
+
+        if(cluster_num == run->cluster)
+        {
+            ++run->cluster;
+            --run->count;
+        }
+        else
+        {
+            /* forget about the rest of the run */
+            run->count = cluster_num - run->cluster;
+        }
+    }
+#endif
+}
+
+/**
+ * \ingroup fat16_fs
+ * Adds a freed cluster to the runs of free clusters.
+ *
+ * The cluster extends a run it is adjacent to, or starts a new one
+ * if a slot is unused.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The cluster which has been freed.
+ */
+void fat16_add_free_run(struct fat16_fs_struct* fs, cluster_t cluster_num)
+{
+    if(cluster_num < fs->cluster_free_hint)
+        fs->cluster_free_hint = cluster_num;
+
+#if FAT16_FREE_RUNS
+    if(!fs->free_runs_valid)
+        return;
+
+    struct fat16_cluster_run_struct* run_unused = 0;
+    uint8_t i;
+    for(i = 0; i < FAT16_FREE_RUNS; ++i)
+    {
+        struct fat16_cluster_run_struct* run = &fs->free_runs[i];
+        if(!run->count)
+        {
+            run_unused = run;
+        }
+        else if(run->cluster + run->count == cluster_num)
+        {
+            ++run->count;
+            return;
+        }
+        else if(cluster_num + 1 == run->cluster)
+        {
+            --run->cluster;
+            ++run->count;
+            return;
+        }
+    }
+
+    if(run_unused)
+    {
+        run_unused->cluster = cluster_num;
+        run_unused->count = 1;
+    }
+#endif
+}
+
+/**
+ * \ingroup fat16_fs
+ * Counts the free clusters of the filesystem.
+ *
+ * The fat is read sector by sector through the fat cache and checked
+ * 32 bits, i.e. two FAT16 entries or one FAT32 entry, at a time. This
+ * is done once when the filesystem is opened, afterwards the count is
+ * kept up to date while clusters are allocated and freed. Unless the
+ * fsinfo sector gave one, the first free cluster becomes the hint
+ * where allocation starts.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_get_fs_free
+ */
+uint8_t fat16_count_free_clusters(struct fat16_fs_struct* fs)
+{
+    uint8_t entry_size = FAT16_FAT_ENTRY_SIZE(fs);
+    uint32_t fat_size = fs->header.fat_size;
+    uint32_t cluster_count = 0;
+    uint32_t offset = 0;
+
+    while(offset < fat_size)
+    {
+        const uint8_t* sector = fat16_get_fat_entry(fs, offset / entry_size, 0);
+        if(!sector)
+            return 0;
+
+        uint16_t length = 512;
+        if(fat_size - offset < length)
+            length = fat_size - offset;
+        uint32_t cluster_count_before = cluster_count;
+
+        /* the entry is the first of a fat cache buffer, which is word aligned */
+        const uint32_t* words = (const void*) sector;
+
+        /* the first two entries do not stand for clusters */
+        uint16_t i = offset ? 0 : 2 * entry_size;
+        for(; i + 4 <= length; i += 4)
+        {
+            uint32_t word = words[i / 4];
+            if(word == 0)
+                cluster_count += 4 / entry_size;
+            else if(entry_size == 2)
+                cluster_count += ((word & 0xffff) == 0) + ((word >> 16) == 0);
+            else if(!(sector[i] | sector[i + 1] | sector[i + 2] | (sector[i + 3] & 0x0f)))
+                /* the upper four bits of a FAT32 entry are reserved */
+                ++cluster_count;
+        }
+
+        /* the last of an odd number of FAT16 entries */
+        if(i < length && !(sector[i] | sector[i + 1]))
+            ++cluster_count;
+
+        if(fs->cluster_free_hint < 2 && cluster_count > cluster_count_before)
+        {
+            for(i = offset ? 0 : 2 * entry_size; i < length; i += entry_size)
+            {
+                if(fat16_read_fat_entry(fs, sector + i) == FAT16_CLUSTER_FREE)
+                {
+                    fs->cluster_free_hint = (offset + i) / entry_size;
                     break;
+                }
+            }
+        }
+
+        offset += length;
+    }
+
+    fs->cluster_free_count = cluster_count;
+    return 1;
+}
+
+/**
+ * \ingroup fat16_fs
+ * Appends a new cluster chain to an existing one.
+ *
+ * Set cluster_num to zero to create a completely new one.
+ *
+ * \param[in] fs The file system on which to operate.
+ * \param[in] cluster_num The cluster to which to append the new chain.
+ * \param[in] count The number of clusters to allocate.
+ * \returns 0 on failure, the number of the first new cluster on success.
+ */
+cluster_t fat16_append_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num, cluster_t count)
+{
+    #if FAT16_WRITE_SUPPORT
+        if(!fs)
+            return 0;
+    
+        cluster_t cluster_next = 0;
+        cluster_t cluster_prev = cluster_num;
+        cluster_t count_left = count;
+        uint8_t* buffer;
+        while(count_left > 0)
+        {
+            cluster_t cluster_new = fat16_find_free_cluster(fs, cluster_prev, count_left);
+            if(!cluster_new)
+                break;
+    
+            /* allocate cluster as the new end of the chain */
+            buffer = fat16_get_fat_entry(fs, cluster_new, 1);
+            if(!buffer)
+                break;
+            fat16_write_fat_entry(fs, buffer, FAT16_CLUSTER_LAST_MAX);
+            --fs->cluster_free_count;
+    
+            if(cluster_next)
+            {
+                /* link it to the clusters allocated before */
+                buffer = fat16_get_fat_entry(fs, cluster_prev, 1);
+                if(!buffer)
+                {
+                    fat16_free_clusters(fs, cluster_new);
+                    break;
+                }
+                fat16_write_fat_entry(fs, buffer, cluster_new);
+            }
+            else
+            {
+                cluster_next = cluster_new;
+            }
+    
+            cluster_prev = cluster_new;
+            --count_left;
+        }
+    
+        do
+        {
+            if(count_left > 0)
+                break;
+    
+            /* We allocated a new cluster chain. Now join
+                                             * it with the existing one.
+                                             */
+            if(cluster_num >= 2)
+            {
+                buffer = fat16_get_fat_entry(fs, cluster_num, 1);
+                if(!buffer)
+                    break;
+                fat16_write_fat_entry(fs, buffer, cluster_next);
             }
     
             return cluster_next;
@@ -794,7 +1661,8 @@ uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluste
         /* No space left on device or writing error.
                              * Free up all clusters already allocated.
                              */
-        fat16_free_clusters(fs, cluster_next);
+        if(cluster_next)
+            fat16_free_clusters(fs, cluster_next);
     
         return 0;
     #else
@@ -819,31 +1687,30 @@ uint16_t fat16_append_clusters(const struct fat16_fs_struct* fs, uint16_t cluste
  * \returns 0 on failure, 1 on success.
  * \see fat16_terminate_clusters
  */
-uint8_t fat16_free_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num)
+uint8_t fat16_free_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num)
 {
     #if FAT16_WRITE_SUPPORT
         if(!fs || cluster_num < 2)
             return 0;
     
-        uint32_t fat_offset = fs->header.fat_offset;
-        uint8_t buffer[2];
+        uint8_t* buffer;
         while(cluster_num)
         {
-            if(!fs->partition->device_read(fat_offset + 2 * cluster_num, buffer, 2))
+            buffer = fat16_get_fat_entry(fs, cluster_num, 1);
+            if(!buffer)
                 return 0;
     
             /* get next cluster of current cluster before freeing current cluster */
-            uint16_t cluster_num_next = ((uint16_t) buffer[0]) |
-            ((uint16_t) buffer[1] << 8);
+            cluster_t cluster_num_next = fat16_read_fat_entry(fs, buffer);
     
             if(cluster_num_next == FAT16_CLUSTER_FREE)
-                return 1;
+                break;
             if(cluster_num_next == FAT16_CLUSTER_BAD ||
                 (cluster_num_next >= FAT16_CLUSTER_RESERVED_MIN &&
                cluster_num_next <= FAT16_CLUSTER_RESERVED_MAX
                )
                )
-            return 0;
+                return 0;
 			///*
             if((cluster_num_next >= FAT16_CLUSTER_LAST_MIN) &&
                 (cluster_num_next <= FAT16_CLUSTER_LAST_MAX)
@@ -852,13 +1719,9 @@ uint8_t fat16_free_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_n
             cluster_num_next = 0;
     
             /* free cluster */
-            buffer[0] = FAT16_CLUSTER_FREE & 0xff;
-            buffer[1] = (FAT16_CLUSTER_FREE >> 8) & 0xff;
-            fs->partition->device_write(fat_offset + 2 * cluster_num, buffer, 2);
-    
-            /* We continue in any case here, even if freeing the cluster failed.
-                                             * The cluster is lost, but maybe we can still free up some later ones.
-                                             */
+            fat16_write_fat_entry(fs, buffer, FAT16_CLUSTER_FREE);
+            ++fs->cluster_free_count;
+            fat16_add_free_run(fs, cluster_num);
     
             cluster_num = cluster_num_next;
         }
@@ -876,74 +1739,337 @@ uint8_t fat16_free_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_n
  * Marks the specified cluster as the new end of a cluster chain and
  * frees all following clusters.
  *
- * \param[in] fs The filesystem on which to operate.
- * \param[in] cluster_num The new end of the cluster chain.
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The new end of the cluster chain.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_free_clusters
+ */
+uint8_t fat16_terminate_clusters(struct fat16_fs_struct* fs, cluster_t cluster_num)
+{
+    #if FAT16_WRITE_SUPPORT
+        if(!fs || cluster_num < 2)
+            return 0;
+    
+        /* fetch next cluster before overwriting the cluster entry */
+        cluster_t cluster_num_next = fat16_get_next_cluster(fs, cluster_num);
+    
+        /* mark cluster as the last one */
+        uint8_t* buffer = fat16_get_fat_entry(fs, cluster_num, 1);
+        if(!buffer)
+            return 0;
+        fat16_write_fat_entry(fs, buffer, FAT16_CLUSTER_LAST_MAX);
+    
+        /* free remaining clusters */
+        if(cluster_num_next)
+            return fat16_free_clusters(fs, cluster_num_next);
+        else
+            return 1;
+    #else
+        return 0;
+    #endif
+}
+
+/**
+ * \ingroup fat16_file
+ * Opens a file on a FAT16 filesystem.
+ *
+ * \param[in] fs The filesystem on which the file to open lies.
+ * \param[in] dir_entry The directory entry of the file to open.
+ * \returns The file handle, or 0 on failure.
+ * \see fat16_close_file
+ */
+struct fat16_file_struct* fat16_open_file(struct fat16_fs_struct* fs, const struct fat16_dir_entry_struct* dir_entry)
+{
+    if(!fs || !dir_entry || (dir_entry->attributes & FAT16_ATTRIB_DIR))
+        return 0;
+
+    int16_t slot = fat16_pool_take(&fat16_file_pool);
+    if(slot < 0)
+        return 0;
+    struct fat16_file_struct* fd = &fat16_file_handles[slot];
+
+    memcpy(&fd->dir_entry, dir_entry, sizeof(*dir_entry));
+    fd->fs = fs;
+    fd->pos = 0;
+    fd->pos_cluster = dir_entry->cluster;
+    fd->extent_count = 0;
+    fd->preallocated = 0;
+#if FAT16_FILE_BUFFER
+    fd->buffer_offset = 0;
+    fd->buffer_dirty = 0;
+#endif
+    fd->dir_entry_dirty = 0;
+#if FAT16_DIR_ENTRY_SYNC_BYTES
+    fd->dir_entry_size = dir_entry->file_size;
+#endif
+
+    return fd;
+}
+
+/**
+ * \ingroup fat16_file
+ * Closes a file.
+ *
+ * Clusters reserved beyond the end of the file are released. The
+ * buffered data and the directory entry of the file and the pending
+ * changes of the filesystem, e.g. the clusters allocated while writing
+ * the file, are written before.
+ *
+ * \param[in] fd The file handle of the file to close.
+ * \see fat16_open_file, fat16_preallocate_file, fat16_sync_file
+ */
+void fat16_close_file(struct fat16_file_struct* fd)
+{
+    int16_t slot = FAT16_POOL_SLOT(fat16_file_handles, FAT16_FILE_HANDLES, fd);
+    if(slot >= 0)
+    {
+#if FAT16_WRITE_SUPPORT
+        if(fd->preallocated)
+            fat16_resize_file(fd, fd->dir_entry.file_size);
+#endif
+        fat16_sync_file(fd);
+        fat16_pool_give(&fat16_file_pool, slot);
+    }
+}
+
+/**
+ * \ingroup fat16_file
+ * Writes the buffered data of a file, the pending changes of its
+ * filesystem and its directory entry to the device.
+ *
+ * \param[in] fd The file handle of the file to synchronize.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_sync, fat16_close_file
+ */
+uint8_t fat16_sync_file(struct fat16_file_struct* fd)
+{
+    if(!fd)
+        return 0;
+
+    /* the directory entry comes last, so it never refers to unwritten clusters */
+    return fat16_flush_file_buffer(fd) && fat16_sync(fd->fs) && fat16_flush_dir_entry(fd);
+}
+
+/**
+ * \ingroup fat16_file
+ * Writes the directory entry of a file if it has changed.
+ *
+ * \param[in] fd The file handle of the file.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_write_dir_entry
+ */
+uint8_t fat16_flush_dir_entry(struct fat16_file_struct* fd)
+{
+    if(fd->dir_entry_dirty)
+    {
+        if(!fat16_write_dir_entry(fd->fs, &fd->dir_entry))
+            return 0;
+        fd->dir_entry_dirty = 0;
+#if FAT16_DIR_ENTRY_SYNC_BYTES
+        fd->dir_entry_size = fd->dir_entry.file_size;
+#endif
+    }
+
+    return 1;
+}
+
+/**
+ * \ingroup fat16_file
+ * Writes the buffered sector of a file to the device.
+ *
+ * The sector stays buffered, so further writes to it do not have to
+ * read it again.
+ *
+ * \param[in] fd The file handle of the file.
  * \returns 0 on failure, 1 on success.
- * \see fat16_free_clusters
+ * \see fat16_write_file_data
  */
-uint8_t fat16_terminate_clusters(const struct fat16_fs_struct* fs, uint16_t cluster_num)
+uint8_t fat16_flush_file_buffer(struct fat16_file_struct* fd)
 {
-    #if FAT16_WRITE_SUPPORT
-        if(!fs || cluster_num < 2)
-            return 0;
-    
-        /* fetch next cluster before overwriting the cluster entry */
-        uint16_t cluster_num_next = fat16_get_next_cluster(fs, cluster_num);
-    
-        /* mark cluster as the last one */
-        uint8_t buffer[2];
-        buffer[0] = FAT16_CLUSTER_LAST_MAX & 0xff;
-        buffer[1] = (FAT16_CLUSTER_LAST_MAX >> 8) & 0xff;
-        if(!fs->partition->device_write(fs->header.fat_offset + 2 * cluster_num, buffer, 2))
+#if FAT16_FILE_BUFFER
+    if(fd->buffer_dirty)
+    {
+        if(!fd->fs->partition->device_write(fd->buffer_offset, fd->buffer, 512))
             return 0;
-    
-        /* free remaining clusters */
-        if(cluster_num_next)
-            return fat16_free_clusters(fs, cluster_num_next);
-        else
-            return 1;
-    #else
-        return 0;
-    #endif
+        fd->buffer_dirty = 0;
+    }
+#endif
+
+    return 1;
 }
 
 /**
  * \ingroup fat16_file
- * Opens a file on a FAT16 filesystem.
+ * Writes data of a file to the device.
  *
- * \param[in] fs The filesystem on which the file to open lies.
- * \param[in] dir_entry The directory entry of the file to open.
- * \returns The file handle, or 0 on failure.
- * \see fat16_close_file
+ * Whole sectors are written directly. Parts of sectors are collected
+ * in the sector buffer of the file, which is written as a whole when
+ * another sector is written to partially. The sector is only read
+ * from the device if it holds file data which is not overwritten.
+ *
+ * \param[in] fd The file handle of the file, positioned at the data.
+ * \param[in] offset The device offset where to write the data.
+ * \param[in] buffer The data to write.
+ * \param[in] length The number of bytes to write.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_flush_file_buffer
  */
-struct fat16_file_struct* fat16_open_file(struct fat16_fs_struct* fs, const struct fat16_dir_entry_struct* dir_entry)
+uint8_t fat16_write_file_data(struct fat16_file_struct* fd, offset_t offset, const uint8_t* buffer, uint16_t length)
 {
-    if(!fs || !dir_entry || (dir_entry->attributes & FAT16_ATTRIB_DIR))
-        return 0;
+#if FAT16_FILE_BUFFER
+    struct partition_struct* partition = fd->fs->partition;
+    uint32_t pos = fd->pos;
+    while(length > 0)
+    {
+        offset_t sector = offset & ~((offset_t) 0x1ff);
+        uint16_t sector_offset = offset & 0x1ff;
+        uint16_t write_length = 512 - sector_offset;
+        if(write_length > length)
+            write_length = length;
 
-    struct fat16_file_struct* fd = malloc(sizeof(*fd));
-    if(!fd)
-        return 0;
+        if(sector_offset == 0 && length >= 512)
+        {
+            write_length = length & ~0x1ff;
 
-    memcpy(&fd->dir_entry, dir_entry, sizeof(*dir_entry));
-    fd->fs = fs;
-    fd->pos = 0;
-    fd->pos_cluster = dir_entry->cluster;
+            /* the buffered sector would be overwritten */
+            if(fd->buffer_offset >= offset && fd->buffer_offset < offset + write_length)
+            {
+                fd->buffer_offset = 0;
+                fd->buffer_dirty = 0;
+            }
 
-    return fd;
+            if(!partition->device_write(offset, buffer, write_length))
+                return 0;
+        }
+        else
+        {
+            if(fd->buffer_offset != sector)
+            {
+                if(!fat16_flush_file_buffer(fd))
+                    return 0;
+
+                fd->buffer_offset = 0;
+                if(sector_offset > 0 || fd->dir_entry.file_size > pos + write_length)
+                {
+                    if(!partition->device_read(sector, fd->buffer, 512))
+                        return 0;
+                }
+                else
+                {
+                    memset(fd->buffer, 0, 512);
+                }
+                fd->buffer_offset = sector;
+            }
+
+            memcpy(fd->buffer + sector_offset, buffer, write_length);
+            fd->buffer_dirty = 1;
+        }
+
+        buffer += write_length;
+        offset += write_length;
+        pos += write_length;
+        length -= write_length;
+    }
+
+    return 1;
+#else
+    return fd->fs->partition->device_write(offset, buffer, length);
+#endif
 }
 
 /**
  * \ingroup fat16_file
- * Closes a file.
+ * Looks up the cluster holding a given file position.
  *
- * \param[in] fd The file handle of the file to close.
- * \see fat16_open_file
+ * Every file keeps a map of the runs of consecutive clusters its
+ * chain starts with. Positions covered by the map are found without
+ * accessing the fat. Otherwise the chain is followed from the end
+ * of the map, which is extended on the way while space is left. Once
+ * the map is full, the walk resumes at the cluster it reached last,
+ * so files written or read sequentially are not followed from the
+ * map again for every cluster.
+ *
+ * \param[in] fd The file handle of the file.
+ * \param[in] pos The file position to look up.
+ * \returns The cluster number, or 0 if the position lies beyond the cluster chain.
  */
-void fat16_close_file(struct fat16_file_struct* fd)
+cluster_t fat16_find_file_cluster(struct fat16_file_struct* fd, uint32_t pos)
 {
-    if(fd)
-        free(fd);
+    uint32_t index = pos / fd->fs->header.cluster_size;
+    cluster_t cluster_num = fd->dir_entry.cluster;
+    if(!cluster_num)
+        return 0;
+
+#if FAT16_FILE_EXTENTS
+    uint32_t target = index;
+    struct fat16_cluster_run_struct* extent = fd->extents;
+    uint8_t i;
+    if(!fd->extent_count)
+    {
+        fd->extents[0].cluster = cluster_num;
+        fd->extents[0].count = 1;
+        fd->extent_count = 1;
+        fd->walk_cluster = 0;
+    }
+
+    for(i = 0; i < fd->extent_count; ++i)
+    {
+        extent = &fd->extents[i];
+        if(index < extent->count)
+            return extent->cluster + index;
+        index -= extent->count;
+    }
+
+    /* continue after the last mapped cluster */
+    cluster_num = extent->cluster + extent->count - 1;
+    if(fd->walk_cluster && fd->walk_index <= target)
+    {
+        /* or after the cluster last reached beyond the full map */
+        if(fd->walk_index == target)
+            return fd->walk_cluster;
+        cluster_num = fd->walk_cluster;
+        index = target - fd->walk_index - 1;
+        extent = 0;
+    }
+    do
+    {
+        cluster_num = fat16_get_next_cluster(fd->fs, cluster_num);
+        if(!cluster_num)
+            return 0;
+
+        if(!extent)
+        {
+            fd->walk_cluster = cluster_num;
+            fd->walk_index = target - index;
+            continue;
+        }
+        if(cluster_num == extent->cluster + extent->count)
+        {
+            ++extent->count;
+        }
+        else if(fd->extent_count < FAT16_FILE_EXTENTS)
+        {
+            extent = &fd->extents[fd->extent_count++];
+            extent->cluster = cluster_num;
+            extent->count = 1;
+        }
+        else
+        {
+            /* the map is full */
+            extent = 0;
+        }
+    }
+    while(index-- > 0);
+#else
+    while(index-- > 0)
+    {
+        cluster_num = fat16_get_next_cluster(fd->fs, cluster_num);
+        if(!cluster_num)
+            return 0;
+    }
+#endif
+
+    return cluster_num;
 }
 
 /**
@@ -952,6 +2078,9 @@ void fat16_close_file(struct fat16_file_struct* fd)
  *
  * The data requested is read from the current file location.
  *
+ * Whole sectors are transferred directly into \c buffer if the partition
+ * supports reading multiple blocks, without passing through the cache.
+ *
  * \param[in] fd The file handle of the file from which to read.
  * \param[out] buffer The buffer into which to write.
  * \param[in] buffer_len The amount of data to read.
@@ -964,6 +2093,9 @@ int16_t fat16_read_file(struct fat16_file_struct* fd, uint8_t* buffer, uint16_t
     if(!fd || !buffer || buffer_len < 1)
         return -1;
 
+    if(!fat16_flush_file_buffer(fd))
+        return -1;
+
     /* determine number of bytes to read */
     if(fd->pos + buffer_len > fd->dir_entry.file_size)
         buffer_len = fd->dir_entry.file_size - fd->pos;
@@ -971,7 +2103,7 @@ int16_t fat16_read_file(struct fat16_file_struct* fd, uint8_t* buffer, uint16_t
         return 0;
 
     uint16_t cluster_size = fd->fs->header.cluster_size;
-    uint16_t cluster_num = fd->pos_cluster;
+    cluster_t cluster_num = fd->pos_cluster;
     uint16_t buffer_left = buffer_len;
     uint16_t first_cluster_offset = fd->pos % cluster_size;
 
@@ -990,14 +2122,9 @@ int16_t fat16_read_file(struct fat16_file_struct* fd, uint8_t* buffer, uint16_t
 
         if(fd->pos)
         {
-            uint32_t pos = fd->pos;
-            while(pos >= cluster_size)
-            {
-                pos -= cluster_size;
-                cluster_num = fat16_get_next_cluster(fd->fs, cluster_num);
-                if(!cluster_num)
-                    return -1;
-            }
+            cluster_num = fat16_find_file_cluster(fd, fd->pos);
+            if(!cluster_num)
+                return -1;
         }
     }
 
@@ -1005,22 +2132,53 @@ int16_t fat16_read_file(struct fat16_file_struct* fd, uint8_t* buffer, uint16_t
     do
     {
         /* calculate data size to copy from cluster */
-        uint32_t cluster_offset = fd->fs->header.cluster_zero_offset +
-        (uint32_t) (cluster_num - 2) * cluster_size + first_cluster_offset;
+        offset_t cluster_offset = fd->fs->header.cluster_zero_offset +
+        (offset_t) (cluster_num - 2) * cluster_size + first_cluster_offset;
         uint16_t copy_length = cluster_size - first_cluster_offset;
         if(copy_length > buffer_left)
             copy_length = buffer_left;
+        uint16_t cluster_end = first_cluster_offset + copy_length;
+
+        if(fd->fs->partition->device_read_blocks && !(cluster_offset & 0x1ff) && copy_length >= 512)
+        {
+            /* Whole sectors are read straight into the caller's buffer,
+             * bypassing the cache, across consecutive clusters.
+             */
+            cluster_t cluster_next;
+            while(cluster_end == cluster_size && buffer_left - copy_length >= 512 &&
+                  (cluster_next = fat16_get_next_cluster(fd->fs, cluster_num)) == cluster_num + 1)
+            {
+                cluster_num = cluster_next;
+                cluster_end = buffer_left - copy_length;
+                if(cluster_end > cluster_size)
+                    cluster_end = cluster_size;
+                copy_length += cluster_end;
+            }
+
+            /* a partial sector at the end is read through the cache */
+            copy_length -= cluster_end & 0x1ff;
+            cluster_end -= cluster_end & 0x1ff;
 
-        /* read data */
-        if(!fd->fs->partition->device_read(cluster_offset, buffer, copy_length))
-            return buffer_len - buffer_left;
+            if(!fd->fs->partition->device_read_blocks(cluster_offset, buffer, copy_length / 512, 0, 0))
+                return buffer_len - buffer_left;
+        }
+        else
+        {
+            /* read data */
+            if(!fd->fs->partition->device_read(cluster_offset, buffer, copy_length))
+                return buffer_len - buffer_left;
+        }
 
         /* calculate new file position */
         buffer += copy_length;
         buffer_left -= copy_length;
         fd->pos += copy_length;
 
-        if(first_cluster_offset + copy_length >= cluster_size)
+        if(cluster_end < cluster_size)
+        {
+            first_cluster_offset = cluster_end;
+        }
+        else
         {
             /* we are on a cluster boundary, so get the next cluster */
             if((cluster_num = fat16_get_next_cluster(fd->fs, cluster_num)))
@@ -1042,12 +2200,136 @@ int16_t fat16_read_file(struct fat16_file_struct* fd, uint8_t* buffer, uint16_t
     return buffer_len;
 }
 
+/**
+ * \ingroup fat16_file
+ * Streams a file sector by sector.
+ *
+ * Starting at the current file location, which has to lie on a sector
+ * border, the rest of the file is read in units of 512 bytes. Each run of
+ * consecutive clusters is fetched with a single multiple block transfer,
+ * if the partition supports it.
+ *
+ * Every sector is read into \c buffer and handed to the callback function
+ * together with its position within the file. Bytes beyond the end of the
+ * file are zeroed. By returning zero, the callback may stop reading.
+ *
+ * \note Within the callback function, you can not start another read or
+ *       write operation.
+ *
+ * \param[in] fd The file handle of the file from which to read.
+ * \param[in] buffer Pointer to a buffer which is at least 512 bytes in size.
+ * \param[in] callback The function to call for every sector.
+ * \param[in] p An opaque pointer directly passed to the callback function.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_read_file
+ */
+uint8_t fat16_stream_file(struct fat16_file_struct* fd, uint8_t* buffer, device_read_callback_t callback, void* p)
+{
+    if(!fd || !buffer || !callback || (fd->pos & 0x01ff))
+        return 0;
+
+    if(!fat16_flush_file_buffer(fd))
+        return 0;
+
+    struct fat16_fs_struct* fs = fd->fs;
+    uint16_t cluster_size = fs->header.cluster_size;
+    uint16_t cluster_offset = fd->pos % cluster_size;
+
+    if(fd->pos >= fd->dir_entry.file_size)
+        return 1;
+
+    /* find cluster in which to start reading */
+    cluster_t cluster_num = fat16_find_file_cluster(fd, fd->pos);
+    if(!cluster_num)
+        return 0;
+
+    struct fat16_stream_callback_arg arg;
+    arg.fd = fd;
+    arg.callback = callback;
+    arg.p = p;
+    arg.stopped = 0;
+
+    fd->pos_cluster = 0;
+    while(fd->pos < fd->dir_entry.file_size && !arg.stopped)
+    {
+        /* collect a run of consecutive clusters */
+        cluster_t run_start = cluster_num;
+        uint32_t run_size = cluster_size - cluster_offset;
+        uint32_t bytes_left = fd->dir_entry.file_size - fd->pos;
+        while(1)
+        {
+            cluster_num = fat16_get_next_cluster(fs, cluster_num);
+            if(run_size >= bytes_left ||
+               cluster_num != run_start + (run_size + cluster_offset) / cluster_size ||
+               run_size + cluster_size > (uint32_t) UINT16_MAX * 512)
+                break;
+
+            run_size += cluster_size;
+        }
+        if(run_size > bytes_left)
+            run_size = bytes_left;
+
+        offset_t offset = fs->header.cluster_zero_offset +
+                          (offset_t) (run_start - 2) * cluster_size + cluster_offset;
+        uint16_t count = (run_size + 511) / 512;
+
+        if(fs->partition->device_read_blocks)
+        {
+            if(!fs->partition->device_read_blocks(offset, buffer, count, fat16_stream_file_callback, &arg))
+                return 0;
+        }
+        else
+        {
+            while(count-- > 0 && !arg.stopped)
+            {
+                if(!fs->partition->device_read(offset, buffer, 512))
+                    return 0;
+                fat16_stream_file_callback(buffer, offset, &arg);
+                offset += 512;
+            }
+        }
+
+        if(!cluster_num)
+            break;
+        cluster_offset = 0;
+    }
+
+    return 1;
+}
+
+/**
+ * \ingroup fat16_file
+ * Callback function used for streaming a file.
+ */
+uint8_t fat16_stream_file_callback(uint8_t* buffer, offset_t offset, void* p)
+{
+    struct fat16_stream_callback_arg* arg = p;
+    struct fat16_file_struct* fd = arg->fd;
+
+    uint32_t length = fd->dir_entry.file_size - fd->pos;
+    if(length < 512)
+        memset(buffer + length, 0, 512 - length);
+    else
+        length = 512;
+
+    if(!arg->callback(buffer, fd->pos, arg->p))
+        arg->stopped = 1;
+
+    fd->pos += length;
+
+    return !arg->stopped && fd->pos < fd->dir_entry.file_size;
+}
+
 /**
  * \ingroup fat16_file
  * Writes data to a file.
  *
  * The data is written to the current file location.
  *
+ * \note Data not filling a whole sector may stay in the sector buffer
+ *       of the file until it is closed, synchronized, read or moved
+ *       away from, see FAT16_FILE_BUFFER.
+ *
  * \param[in] fd The file handle of the file to which to write.
  * \param[in] buffer The buffer from which to read the data to be written.
  * \param[in] buffer_len The amount of data to write.
@@ -1064,7 +2346,7 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
             return -1;
     
         uint16_t cluster_size = fd->fs->header.cluster_size;
-        uint16_t cluster_num = fd->pos_cluster;
+        cluster_t cluster_num = fd->pos_cluster;
         uint16_t buffer_left = buffer_len;
         uint16_t first_cluster_offset = fd->pos % cluster_size;
     
@@ -1078,7 +2360,7 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
                 if(!fd->pos)
                 {
                     /* empty file */
-                    fd->dir_entry.cluster = cluster_num = fat16_append_clusters(fd->fs, 0, 1);
+                    fd->dir_entry.cluster = cluster_num = fat16_append_file_clusters(fd, 0, buffer_len);
                     if(!cluster_num)
                         return -1;
                 }
@@ -1090,20 +2372,16 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
     
             if(fd->pos)
             {
-                uint32_t pos = fd->pos;
-                uint16_t cluster_num_next;
-                while(pos >= cluster_size)
+                cluster_num = fat16_find_file_cluster(fd, fd->pos);
+                if(!cluster_num && first_cluster_offset == 0)
                 {
-                    pos -= cluster_size;
-                    cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
-                    if(!cluster_num_next && pos == 0)
-        /* the file exactly ends on a cluster boundary, and we append to it */
-                        cluster_num_next = fat16_append_clusters(fd->fs, cluster_num, 1);
-                    if(!cluster_num_next)
-                        return -1;
-    
-                    cluster_num = cluster_num_next;
+                    /* the file exactly ends on a cluster boundary, and we append to it */
+                    cluster_num = fat16_find_file_cluster(fd, fd->pos - 1);
+                    if(cluster_num)
+                        cluster_num = fat16_append_file_clusters(fd, cluster_num, buffer_len);
                 }
+                if(!cluster_num)
+                    return -1;
             }
         }
     
@@ -1111,14 +2389,25 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
         do
         {
             /* calculate data size to write to cluster */
-            uint32_t cluster_offset = fd->fs->header.cluster_zero_offset +
-            (uint32_t) (cluster_num - 2) * cluster_size + first_cluster_offset;
-            uint16_t write_length = cluster_size - first_cluster_offset;
+            offset_t cluster_offset = fd->fs->header.cluster_zero_offset +
+            (offset_t) (cluster_num - 2) * cluster_size + first_cluster_offset;
+            uint32_t write_length = cluster_size - first_cluster_offset;
+    
+            /* include the clusters which follow contiguously */
+            cluster_t cluster_last = cluster_num;
+            while(write_length < buffer_left)
+            {
+                cluster_t cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_last);
+                if(cluster_num_next != cluster_last + 1)
+                    break;
+                cluster_last = cluster_num_next;
+                write_length += cluster_size;
+            }
             if(write_length > buffer_left)
                 write_length = buffer_left;
     
-            /* write data which fits into the current cluster */
-            if(!fd->fs->partition->device_write(cluster_offset, buffer, write_length))
+            /* write data which fits into these clusters at once */
+            if(!fat16_write_file_data(fd, cluster_offset, buffer, write_length))
                 break;
     
             /* calculate new file position */
@@ -1126,13 +2415,17 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
             buffer_left -= write_length;
             fd->pos += write_length;
     
-            if(first_cluster_offset + write_length >= cluster_size)
+            /* continue within the last cluster written to */
+            first_cluster_offset += write_length - (uint32_t) (cluster_last - cluster_num) * cluster_size;
+            cluster_num = cluster_last;
+    
+            if(first_cluster_offset >= cluster_size)
             {
                 /* we are on a cluster boundary, so get the next cluster */
-                uint16_t cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
+                cluster_t cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
                 if(!cluster_num_next && buffer_left > 0)
-        /* we reached the last cluster, append a new one */
-                    cluster_num_next = fat16_append_clusters(fd->fs, cluster_num, 1);
+        /* we reached the last cluster, append the ones needed */
+                    cluster_num_next = fat16_append_file_clusters(fd, cluster_num, buffer_left);
                 if(!cluster_num_next)
                 {
                     fd->pos_cluster = 0;
@@ -1151,20 +2444,18 @@ int16_t fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, ui
         /* update directory entry */
         if(fd->pos > fd->dir_entry.file_size)
         {
-            uint32_t size_old = fd->dir_entry.file_size;
-    
-            /* update file size */
+            /* update file size, the directory entry is written later */
             fd->dir_entry.file_size = fd->pos;
-            /* write directory entry */
-            if(!fat16_write_dir_entry(fd->fs, &fd->dir_entry))
-            {
-                /* We do not return an error here since we actually wrote
-                                                             * some data to disk. So we calculate the amount of data
-                                                             * we wrote to disk and which lies within the old file size.
-                                                             */
-                buffer_left = fd->pos - size_old;
-                fd->pos = size_old;
-            }
+            fd->dir_entry_dirty = 1;
+    
+#if FAT16_DIR_ENTRY_SYNC_BYTES
+            /* We do not return an error if this fails since we actually
+             * wrote some data to disk. The directory entry is tried again
+             * when the file is synchronized or closed.
+             */
+            if(fd->dir_entry.file_size - fd->dir_entry_size >= FAT16_DIR_ENTRY_SYNC_BYTES)
+                fat16_sync_file(fd);
+#endif
         }
     
         return buffer_len - buffer_left;
@@ -1221,6 +2512,10 @@ uint8_t fat16_seek_file(struct fat16_file_struct* fd, int32_t* offset, uint8_t w
             return 0;
     }
 
+    /* the buffered data is written once we move away */
+    if(new_pos != fd->pos && !fat16_flush_file_buffer(fd))
+        return 0;
+
     if(new_pos > fd->dir_entry.file_size && !fat16_resize_file(fd, new_pos))
         return 0;
 
@@ -1256,7 +2551,15 @@ uint8_t fat16_resize_file(struct fat16_file_struct* fd, uint32_t size)
         if(!fd)
             return 0;
     
-        uint16_t cluster_num = fd->dir_entry.cluster;
+        /* the buffered sector may be freed */
+        if(!fat16_flush_file_buffer(fd))
+            return 0;
+#if FAT16_FILE_BUFFER
+        fd->buffer_offset = 0;
+#endif
+    
+        cluster_t cluster_num = fd->dir_entry.cluster;
+        cluster_t cluster_start = cluster_num;
         uint16_t cluster_size = fd->fs->header.cluster_size;
         uint32_t size_new = size;
     
@@ -1270,7 +2573,7 @@ uint8_t fat16_resize_file(struct fat16_file_struct* fd, uint32_t size)
             while(size_new > cluster_size)
             {
                 /* get next cluster of file */
-                uint16_t cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
+                cluster_t cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
                 if(cluster_num_next)
                 {
                     cluster_num = cluster_num_next;
@@ -1287,36 +2590,45 @@ uint8_t fat16_resize_file(struct fat16_file_struct* fd, uint32_t size)
                 /* Allocate new cluster chain and append
                                                              * it to the existing one, if available.
                                                              */
-                uint16_t cluster_count = size_new / cluster_size;
-                if((uint32_t) cluster_count * cluster_size < size_new)
+                /* the last cluster of an existing chain already holds cluster_size bytes */
+                uint32_t size_append = cluster_num ? size_new - cluster_size : size_new;
+                cluster_t cluster_count = size_append / cluster_size;
+                if((uint32_t) cluster_count * cluster_size < size_append)
                     ++cluster_count;
-                uint16_t cluster_new_chain = fat16_append_clusters(fd->fs, cluster_num, cluster_count);
+                cluster_t cluster_new_chain = fat16_append_clusters(fd->fs, cluster_num, cluster_count);
                 if(!cluster_new_chain)
                     return 0;
     
                 if(!cluster_num)
                 {
                     cluster_num = cluster_new_chain;
-                    fd->dir_entry.cluster = cluster_num;
+                    cluster_start = cluster_num;
                 }
             }
     
-            /* write new directory entry */
-            fd->dir_entry.file_size = size;
+            /* write new directory entry, unless it stays the same */
             if(size == 0)
-                fd->dir_entry.cluster = 0;
-            if(!fat16_write_dir_entry(fd->fs, &fd->dir_entry))
+                cluster_start = 0;
+            if(fd->dir_entry.file_size != size || fd->dir_entry.cluster != cluster_start)
+            {
+                fd->dir_entry.file_size = size;
+                fd->dir_entry.cluster = cluster_start;
+                fd->dir_entry_dirty = 1;
+            }
+            if(!fat16_flush_dir_entry(fd))
                 return 0;
     
             if(size == 0)
             {
                 /* free all clusters of file */
                 fat16_free_clusters(fd->fs, cluster_num);
+                fd->extent_count = 0;
             }
-            else if(size_new <= cluster_size)
+            else if(size_new <= cluster_size && fat16_get_next_cluster(fd->fs, cluster_num))
             {
                 /* free all clusters no longer needed */
                 fat16_terminate_clusters(fd->fs, cluster_num);
+                fd->extent_count = 0;
             }
     
         }
@@ -1325,11 +2637,104 @@ uint8_t fat16_resize_file(struct fat16_file_struct* fd, uint32_t size)
         /* correct file position */
         if(size < fd->pos)
         {
-            fd->pos = size;
-            fd->pos_cluster = 0;
+            fd->pos = size;
+            fd->pos_cluster = 0;
+        }
+    
+        return 1;
+    #else
+        return 0;
+    #endif
+}
+
+/**
+ * \ingroup fat16_file
+ * Reserves disk space for a file without changing its size.
+ *
+ * Appends as many clusters to the file as it needs to hold the given
+ * number of bytes. They are taken from the smallest run of free clusters
+ * which holds all of them, or else from the longest runs, and linked
+ * with a single update of the fat. Data written into the reserved space
+ * afterwards goes to the device in large contiguous transfers.
+ *
+ * Clusters which have not been written to are released when the file
+ * is closed.
+ *
+ * \param[in] fd The file decriptor of the file for which to reserve space.
+ * \param[in] size The number of bytes, counted from the beginning of the file.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_resize_file, fat16_close_file
+ */
+uint8_t fat16_preallocate_file(struct fat16_file_struct* fd, uint32_t size)
+{
+    #if FAT16_WRITE_SUPPORT
+        if(!fd)
+            return 0;
+    
+        uint16_t cluster_size = fd->fs->header.cluster_size;
+        cluster_t cluster_count = size / cluster_size;
+        if(size % cluster_size)
+            ++cluster_count;
+    
+        /* find the end of the cluster chain */
+        cluster_t cluster_num = fd->dir_entry.cluster;
+        if(cluster_num && cluster_count > 0)
+        {
+            while(--cluster_count > 0)
+            {
+                cluster_t cluster_num_next = fat16_get_next_cluster(fd->fs, cluster_num);
+                if(!cluster_num_next)
+                    break;
+                cluster_num = cluster_num_next;
+            }
+        }
+        if(cluster_count == 0)
+        /* the space is allocated already */
+            return 1;
+    
+        cluster_t cluster_new_chain = fat16_append_clusters(fd->fs, cluster_num, cluster_count);
+        if(!cluster_new_chain)
+            return 0;
+    
+        /* the directory entry is written once data arrives */
+        if(!cluster_num)
+            fd->dir_entry.cluster = cluster_new_chain;
+        fd->preallocated = 1;
+    
+        return 1;
+    #else
+        return 0;
+    #endif
+}
+
+/**
+ * \ingroup fat16_file
+ * Appends the clusters needed to write a number of bytes to a file.
+ *
+ * If there is not enough space left, a single cluster is tried.
+ *
+ * \param[in] fd The file decriptor of the file to which to append.
+ * \param[in] cluster_num The last cluster of the file, 0 if it has none.
+ * \param[in] length The number of bytes which are going to be written.
+ * \returns 0 on failure, the number of the first new cluster on success.
+ */
+cluster_t fat16_append_file_clusters(struct fat16_file_struct* fd, cluster_t cluster_num, uint16_t length)
+{
+    #if FAT16_WRITE_SUPPORT
+        uint16_t cluster_size = fd->fs->header.cluster_size;
+        cluster_t cluster_count = (length - 1) / cluster_size + 1;
+        if(cluster_count > 1)
+        {
+            cluster_t cluster_new_chain = fat16_append_clusters(fd->fs, cluster_num, cluster_count);
+            if(cluster_new_chain)
+            {
+                /* writing may stop early */
+                fd->preallocated = 1;
+                return cluster_new_chain;
+            }
         }
     
-        return 1;
+        return fat16_append_clusters(fd->fs, cluster_num, 1);
     #else
         return 0;
     #endif
@@ -1349,17 +2754,199 @@ struct fat16_dir_struct* fat16_open_dir(struct fat16_fs_struct* fs, const struct
     if(!fs || !dir_entry || !(dir_entry->attributes & FAT16_ATTRIB_DIR))
         return 0;
 
-    struct fat16_dir_struct* dd = malloc(sizeof(*dd));
-    if(!dd)
+    int16_t slot = fat16_pool_take(&fat16_dir_pool);
+    if(slot < 0)
         return 0;
+    struct fat16_dir_struct* dd = &fat16_dir_handles[slot];
 
     memcpy(&dd->dir_entry, dir_entry, sizeof(*dir_entry));
     dd->fs = fs;
     dd->entry_next = 0;
+    dd->entry_offset = 0;
+
+    fat16_index_dir(dd);
+#if FAT16_DIR_INDEX_ENTRIES
+    dd->dir_next = fs->dirs;
+    fs->dirs = dd;
+#endif
 
     return dd;
 }
 
+/**
+ * \ingroup fat16_dir
+ * Calculates the hash of a file name used by the directory index.
+ *
+ * \param[in] name The file name.
+ * \returns The hash value.
+ */
+uint16_t fat16_hash_name(const char* name)
+{
+    uint16_t hash = 0;
+    while(*name)
+        hash = (hash << 5) + hash + (uint8_t) *name++;
+    return hash;
+}
+
+/**
+ * \ingroup fat16_dir
+ * Builds the name index of a directory handle.
+ *
+ * All entries of the directory are read once. If there are more
+ * names than FAT16_DIR_INDEX_ENTRIES, the index is marked as
+ * incomplete and lookups of names not found in it fall back to
+ * searching the directory.
+ *
+ * \param[in] dd The directory handle.
+ * \see find_file_in_dir
+ */
+void fat16_index_dir(struct fat16_dir_struct* dd)
+{
+#if FAT16_DIR_INDEX_ENTRIES
+    struct fat16_dir_entry_struct dir_entry;
+
+    dd->index_count = 0;
+    dd->index_incomplete = 0;
+
+    while(fat16_read_dir(dd, &dir_entry))
+        fat16_index_add(dd, &dir_entry);
+#endif
+}
+
+/**
+ * \ingroup fat16_dir
+ * Adds a directory entry to the name index of a directory handle.
+ *
+ * \param[in] dd The directory handle.
+ * \param[in] dir_entry The directory entry to add.
+ */
+void fat16_index_add(struct fat16_dir_struct* dd, const struct fat16_dir_entry_struct* dir_entry)
+{
+#if FAT16_DIR_INDEX_ENTRIES
+    if(dd->index_count >= FAT16_DIR_INDEX_ENTRIES)
+    {
+        dd->index_incomplete = 1;
+        return;
+    }
+
+    dd->index_hash[dd->index_count] = fat16_hash_name(dir_entry->long_name);
+    dd->index_slot[dd->index_count] = dir_entry->entry_offset / 32;
+    ++dd->index_count;
+#endif
+}
+
+/**
+ * \ingroup fat16_dir
+ * Marks the indexes of other handles of a directory as incomplete.
+ *
+ * Only the handle through which a file is created learns about it.
+ * Other handles open on the same directory have to fall back to
+ * searching the directory for names they do not find in their index.
+ *
+ * \param[in] dd The directory handle the directory was changed through.
+ * \see fat16_create_file
+ */
+void fat16_index_outdate(const struct fat16_dir_struct* dd)
+{
+#if FAT16_DIR_INDEX_ENTRIES
+    struct fat16_dir_struct* other;
+    for(other = dd->fs->dirs; other; other = other->dir_next)
+    {
+        if(other != dd && other->dir_entry.cluster == dd->dir_entry.cluster)
+            other->index_incomplete = 1;
+    }
+#endif
+}
+
+/**
+ * \ingroup fat16_dir
+ * Removes a directory entry from the indexes of all open directory handles.
+ *
+ * \param[in] fs The filesystem the directory entry is on.
+ * \param[in] entry_offset The offset at which the directory entry starts.
+ * \see fat16_delete_files
+ */
+void fat16_index_remove(struct fat16_fs_struct* fs, offset_t entry_offset)
+{
+#if FAT16_DIR_INDEX_ENTRIES
+    uint32_t slot = entry_offset / 32;
+    struct fat16_dir_struct* dd;
+    for(dd = fs->dirs; dd; dd = dd->dir_next)
+    {
+        uint16_t i;
+        for(i = 0; i < dd->index_count; ++i)
+        {
+            if(dd->index_slot[i] != slot)
+                continue;
+
+            --dd->index_count;
+            dd->index_hash[i] = dd->index_hash[dd->index_count];
+            dd->index_slot[i] = dd->index_slot[dd->index_count];
+            break;
+        }
+    }
+#endif
+}
+
+/**
+ * \ingroup fat16_dir
+ * Looks up a file name in the index of a directory.
+ *
+ * Only the entries whose names have the same hash are read. Entries
+ * found to be outdated are removed from the index.
+ *
+ * \param[in] dd The directory handle.
+ * \param[in] name The file name to look for.
+ * \param[out] dir_entry The directory entry to fill if the file is found.
+ * \returns 1 if the file is found, 0 if it is not indexed.
+ * \see fat16_index_add
+ */
+uint8_t fat16_index_find(struct fat16_dir_struct* dd, const char* name, struct fat16_dir_entry_struct* dir_entry)
+{
+#if FAT16_DIR_INDEX_ENTRIES
+    /* check the entries whose names have the same hash */
+    uint16_t hash = fat16_hash_name(name);
+    uint16_t i;
+    for(i = 0; i < dd->index_count; ++i)
+    {
+        if(dd->index_hash[i] != hash)
+            continue;
+
+        uint8_t buffer[32];
+        struct fat16_read_callback_arg arg;
+        memset(dir_entry, 0, sizeof(*dir_entry));
+        memset(&arg, 0, sizeof(arg));
+        arg.dir_entry = dir_entry;
+
+        /* an entry consists of up to 20 lfn entries and the 8.3 one */
+        if(!dd->fs->partition->device_read_interval((offset_t) dd->index_slot[i] * 32,
+                                                    buffer,
+                                                    sizeof(buffer),
+                                                    21 * sizeof(buffer),
+                                                    fat16_dir_entry_read_callback,
+                                                    &arg
+                                                   ))
+            return 0;
+
+        if(arg.result == 2 && dir_entry->entry_offset == (offset_t) dd->index_slot[i] * 32)
+        {
+            if(strcmp(dir_entry->long_name, name) == 0)
+                return 1;
+            if(fat16_hash_name(dir_entry->long_name) == hash)
+                continue;
+        }
+
+        /* the file has been deleted or replaced, forget about it */
+        --dd->index_count;
+        dd->index_hash[i] = dd->index_hash[dd->index_count];
+        dd->index_slot[i] = dd->index_slot[dd->index_count];
+        --i;
+    }
+#endif
+
+    return 0;
+}
+
 /**
  * \ingroup fat16_dir
  * Closes a directory descriptor.
@@ -1373,8 +2960,18 @@ struct fat16_dir_struct* fat16_open_dir(struct fat16_fs_struct* fs, const struct
  */
 void fat16_close_dir(struct fat16_dir_struct* dd)
 {
-    if(dd)
-        free(dd);
+    int16_t slot = FAT16_POOL_SLOT(fat16_dir_handles, FAT16_DIR_HANDLES, dd);
+    if(slot < 0)
+        return;
+
+#if FAT16_DIR_INDEX_ENTRIES
+    struct fat16_dir_struct** link = &dd->fs->dirs;
+    while(*link && *link != dd)
+        link = &(*link)->dir_next;
+    if(*link)
+        *link = dd->dir_next;
+#endif
+    fat16_pool_give(&fat16_dir_pool, slot);
 }
 
 /**
@@ -1391,27 +2988,37 @@ uint8_t fat16_read_dir(struct fat16_dir_struct* dd, struct fat16_dir_entry_struc
     if(!dd || !dir_entry)
         return 0;
 
-    if(dd->dir_entry.cluster == 0)
+    uint8_t found = 1;
+    if(!dd->entry_offset)
     {
-        /* read entry from root directory */
-        if(fat16_read_root_dir_entry(dd->fs, dd->entry_next, dir_entry))
-        {
-            ++dd->entry_next;
-            return 1;
-        }
+        /* place the cursor on the first entry */
+        const struct fat16_header_struct* header = &dd->fs->header;
+        dd->entry_cluster = dd->dir_entry.cluster;
+#if FAT16_FAT32_SUPPORT
+        /* the root directory of a FAT32 is a cluster chain */
+        if(dd->entry_cluster == 0 && FAT16_IS_FAT32(dd->fs))
+            dd->entry_cluster = header->root_dir_cluster;
+#endif
+        if(dd->entry_cluster == 0)
+            dd->entry_offset = header->root_dir_offset;
+        else
+            dd->entry_offset = header->cluster_zero_offset + (offset_t) (dd->entry_cluster - 2) * header->cluster_size;
+
+        /* skip the entries already read, see fat16_set_dir() */
+        uint16_t i;
+        for(i = 0; i < dd->entry_next && found; ++i)
+            found = fat16_read_dir_next(dd, dir_entry);
     }
-    else
+
+    if(found && fat16_read_dir_next(dd, dir_entry))
     {
-        /* read entry from a subdirectory */
-        if(fat16_read_sub_dir_entry(dd->fs, dd->entry_next, &dd->dir_entry, dir_entry))
-        {
-            ++dd->entry_next;
-            return 1;
-        }
+        ++dd->entry_next;
+        return 1;
     }
 
     /* restart reading */
     dd->entry_next = 0;
+    dd->entry_offset = 0;
 
     return 0;
 }
@@ -1433,6 +3040,7 @@ uint8_t fat16_reset_dir(struct fat16_dir_struct* dd)
         return 0;
 
     dd->entry_next = 0;
+    dd->entry_offset = 0;
     return 1;
 }
 
@@ -1442,6 +3050,7 @@ uint8_t fat16_set_dir(struct fat16_dir_struct* dd, uint16_t offset)
         return 0;
 
     dd->entry_next = offset;
+    dd->entry_offset = 0;
     return 1;
 }
 
@@ -1449,6 +3058,9 @@ uint8_t fat16_set_dir(struct fat16_dir_struct* dd, uint16_t offset)
  * \ingroup fat16_fs
  * Writes a directory entry to disk.
  *
+ * The lfn entries and the 8.3 entry are assembled in memory and
+ * written with a single device access.
+ *
  * \note The file name is not checked for invalid characters.
  *
  * \note The generation of the short 8.3 file name is quite
@@ -1471,12 +3083,15 @@ uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, const struct fat
             return 0;
     
         device_write_t device_write = fs->partition->device_write;
-        uint32_t offset = dir_entry->entry_offset;
+        offset_t offset = dir_entry->entry_offset;
         uint8_t name_len = strlen(dir_entry->long_name);
         uint8_t lfn_entry_count = (name_len + 12) / 13;
-        uint8_t buffer[32];
     
-        /* write 8.3 entry */
+        /* the lfn entries followed by the 8.3 entry, written at once */
+        uint8_t entries[32 * ((sizeof(dir_entry->long_name) - 1 + 12) / 13 + 1)];
+        uint8_t* buffer = entries + (uint16_t) lfn_entry_count * 32;
+    
+        /* assemble 8.3 entry */
     
         /* generate 8.3 file name */
         memset(&buffer[0], ' ', 11);
@@ -1513,7 +3128,7 @@ uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, const struct fat
         }
     
         /* fill directory entry buffer */
-        memset(&buffer[11], 0, sizeof(buffer) - 11);
+        memset(&buffer[11], 0, 32 - 11);
         buffer[0x0b] = dir_entry->attributes;
 
         //Not used in bootloader
@@ -1569,6 +3184,10 @@ uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, const struct fat
 			//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 		#endif
 
+#if FAT16_FAT32_SUPPORT
+        buffer[0x14] = (dir_entry->cluster >> 16) & 0xff;
+        buffer[0x15] = (dir_entry->cluster >> 24) & 0xff;
+#endif
         buffer[0x1a] = (dir_entry->cluster >> 0) & 0xff;
         buffer[0x1b] = (dir_entry->cluster >> 8) & 0xff;
         buffer[0x1c] = (dir_entry->file_size >> 0) & 0xff;
@@ -1576,21 +3195,18 @@ uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, const struct fat
         buffer[0x1e] = (dir_entry->file_size >> 16) & 0xff;
         buffer[0x1f] = (dir_entry->file_size >> 24) & 0xff;
     
-        /* write to disk */
-        if(!device_write(offset + (uint32_t) lfn_entry_count * 32, buffer, sizeof(buffer)))
-            return 0;
-    
         /* calculate checksum of 8.3 name */
         uint8_t checksum = buffer[0];
         uint8_t i;
         for(i = 1; i < 11; ++i)
             checksum = ((checksum >> 1) | (checksum << 7)) + buffer[i];
     
-        /* write lfn entries */
+        /* assemble lfn entries */
         uint8_t lfn_entry;
         for(lfn_entry = lfn_entry_count; lfn_entry > 0; --lfn_entry)
         {
-            memset(buffer, 0, sizeof(buffer));
+            buffer = entries + (uint16_t) (lfn_entry_count - lfn_entry) * 32;
+            memset(buffer, 0, 32);
             memset(&buffer[0x01], 0xff, 10);
             memset(&buffer[0x0e], 0xff, 12);
             memset(&buffer[0x1c], 0xff, 4);
@@ -1626,14 +3242,10 @@ uint8_t fat16_write_dir_entry(const struct fat16_fs_struct* fs, const struct fat
     
             /* set checksum */
             buffer[0x0d] = checksum;
-    
-            /* write entry */
-            device_write(offset, buffer, sizeof(buffer));
-    
-            offset += sizeof(buffer);
         }
     
-        return 1;
+        /* write all entries to disk */
+        return device_write(offset, entries, (uint16_t) (lfn_entry_count + 1) * 32);
     
     #else
         return 0;
@@ -1672,110 +3284,175 @@ uint8_t fat16_create_file(struct fat16_dir_struct* parent, const char* file, str
         if(!parent || !file || !file[0])
             return 0;
     
-        /* check if the file already exists */
-        while(1)
-        {
-            if(!fat16_read_dir(parent, dir_entry))
-                break;
+        struct fat16_fs_struct* fs = parent->fs;
+        uint8_t free_dir_entries_needed = strlen(file) / 13 + 1 + 1;
     
-            if(strcmp(file, dir_entry->long_name) == 0)
-            {
-                fat16_reset_dir(parent);
-                return 1;
-            }
-        }
+        /* A name which is not found in a complete index of the directory
+         * does not exist, so searching may stop at the first free space.
+         */
+        uint8_t check_name = 1;
+#if FAT16_DIR_INDEX_ENTRIES
+        if(fat16_index_find(parent, file, dir_entry))
+            return 1;
+        check_name = parent->index_incomplete;
+#endif
     
+        struct fat16_read_callback_arg arg;
+        memset(&arg, 0, sizeof(arg));
         memset(dir_entry, 0, sizeof(*dir_entry));
-        strncpy(dir_entry->long_name, file, sizeof(dir_entry->long_name) - 1);
+        arg.dir_entry = dir_entry;
     
-        /* search for a place where to write the directory entry to disk */
-        uint8_t free_dir_entries_needed = strlen(file) / 13 + 1 + 1;
-        uint8_t free_dir_entries_found = 0;
-        struct fat16_fs_struct* fs = parent->fs;
-        uint16_t cluster_num = parent->dir_entry.cluster;
-        uint32_t dir_entry_offset = 0;
-        uint32_t offset = 0;
-        uint32_t offset_to = 0;
+        cluster_t cluster_num = parent->dir_entry.cluster;
+        offset_t offset;
+        offset_t offset_to;
     
+#if FAT16_FAT32_SUPPORT
+        /* the root directory of a FAT32 is a cluster chain */
+        if(cluster_num == 0 && FAT16_IS_FAT32(fs))
+            cluster_num = fs->header.root_dir_cluster;
+#endif
         if(cluster_num == 0)
         {
             /* we read/write from the root directory entry */
             offset = fs->header.root_dir_offset;
             offset_to = fs->header.cluster_zero_offset;
-            dir_entry_offset = offset;
+        }
+        else
+        {
+            offset = fs->header.cluster_zero_offset +
+            (offset_t) (cluster_num - 2) * fs->header.cluster_size;
+            offset_to = offset + fs->header.cluster_size;
         }
     
-        while(1)
+        /* In a single pass over the directory sectors, look for the file
+         * and remember the first place with enough free entries.
+         */
+        uint8_t sector[512];
+        offset_t dir_entry_offset = 0;
+        offset_t free_offset = 0;
+        offset_t end_offset = 0;
+        uint8_t free_dir_entries_found = 0;
+        while(check_name || !dir_entry_offset)
         {
             if(offset == offset_to)
             {
+                /* free entries must not span clusters */
+                free_dir_entries_found = 0;
+    
                 if(cluster_num == 0)
-				/* We iterated through the whole root directory entry
-                * and could not find enough space for the directory entry.
-                */
+                /* we reached the end of the root directory */
+                    break;
+    
+                cluster_t cluster_next = fat16_get_next_cluster(fs, cluster_num);
+                if(!cluster_next)
+                    break;
+    
+                cluster_num = cluster_next;
+                offset = fs->header.cluster_zero_offset +
+                (offset_t) (cluster_num - 2) * fs->header.cluster_size;
+                offset_to = offset + fs->header.cluster_size;
+            }
+    
+            if(!fs->partition->device_read(offset, sector, sizeof(sector)))
                 return 0;
     
-                if(offset)
+            uint16_t i;
+            for(i = 0; i < sizeof(sector); i += 32)
+            {
+                uint8_t* entry = sector + i;
+                if(!entry[0])
                 {
-                    /* We reached a cluster boundary and have to
-                    * switch to the next cluster.
-                    */
+                    /* the directory ends here */
+                    end_offset = offset + i;
+                    break;
+                }
     
-                    uint16_t cluster_next = fat16_get_next_cluster(fs, cluster_num);
-                    if(!cluster_next)
-                    {
-                        cluster_next = fat16_append_clusters(fs, cluster_num, 1);
-                        if(!cluster_next)
-                            return 0;
+                if(entry[0] == FAT16_DIRENTRY_DELETED)
+                {
+                    if(!free_dir_entries_found)
+                        free_offset = offset + i;
+                    if(++free_dir_entries_found >= free_dir_entries_needed && !dir_entry_offset)
+                        dir_entry_offset = free_offset;
+                }
+                else
+                {
+                    free_dir_entries_found = 0;
+                }
     
-                        /* we appended a new cluster and know it is free */
-                        dir_entry_offset = fs->header.cluster_zero_offset +
-                        (uint32_t) (cluster_next - 2) * fs->header.cluster_size;
+                if(!check_name)
+                    continue;
     
-                        /* TODO: This cluster has to be zeroed in an efficient way, or at least
-                        *       every 32th byte should be set to FAT16_DIRENTRY_DELETED.
-                        */
-                        break;
-                    }
-                    cluster_num = cluster_next;
+                /* check if the file already exists */
+                if(!fat16_dir_entry_read_callback(entry, offset + i, &arg))
+                {
+                    if(arg.result == 2 && strcmp(dir_entry->long_name, file) == 0)
+                        return 1;
+                    memset(dir_entry, 0, sizeof(*dir_entry));
                 }
-    
-                offset = fs->header.cluster_zero_offset +
-                (uint32_t) (cluster_num - 2) * fs->header.cluster_size;
-                offset_to = offset + fs->header.cluster_size;
-                dir_entry_offset = offset;
-                free_dir_entries_found = 0;
             }
     
-            /* read next lfn or 8.3 entry */
-            uint8_t first_char;
-            if(!fs->partition->device_read(offset, &first_char, sizeof(first_char)))
+            if(end_offset)
+                break;
+            offset += sizeof(sector);
+        }
+    
+        if(!dir_entry_offset && end_offset)
+        {
+            /* all entries up to the end of the cluster are free */
+            if(!free_dir_entries_found)
+                free_offset = end_offset;
+            if(free_dir_entries_found + (offset_to - end_offset) / 32 >= free_dir_entries_needed)
+                dir_entry_offset = free_offset;
+        }
+    
+        if(!dir_entry_offset)
+        {
+            /* We iterated through the whole root directory entry
+             * and could not find enough space for the directory entry.
+             */
+            if(cluster_num == 0)
                 return 0;
     
-            /* check if we found a free directory entry */
-            if(first_char == FAT16_DIRENTRY_DELETED || !first_char)
-            {
-                /* check if we have the needed number of available entries */
-                ++free_dir_entries_found;
-                if(free_dir_entries_found >= free_dir_entries_needed)
-                    break;
+            /* clusters following the end of the directory are unused */
+            cluster_t cluster_new = 0;
+            if(end_offset)
+                cluster_new = fat16_get_next_cluster(fs, cluster_num);
+            if(!cluster_new)
+                cluster_new = fat16_append_clusters(fs, cluster_num, 1);
+            if(!cluster_new)
+                return 0;
     
-                offset += 32;
+            /* let the directory continue with the new cluster */
+            for(; end_offset && end_offset < offset_to; end_offset += 32)
+            {
+                sector[0] = FAT16_DIRENTRY_DELETED;
+                if(!fs->partition->device_write(end_offset, sector, 1))
+                    return 0;
             }
-            else
+    
+            /* the new cluster has to be empty */
+            dir_entry_offset = fs->header.cluster_zero_offset +
+            (offset_t) (cluster_new - 2) * fs->header.cluster_size;
+            memset(sector, 0, sizeof(sector));
+            for(offset = 0; offset < fs->header.cluster_size; offset += sizeof(sector))
             {
-                offset += 32;
-                dir_entry_offset = offset;
-                free_dir_entries_found = 0;
+                if(!fs->partition->device_write(dir_entry_offset + offset, sector, sizeof(sector)))
+                    return 0;
             }
         }
-
+    
         /* write directory entry to disk */
+        memset(dir_entry, 0, sizeof(*dir_entry));
+        strncpy(dir_entry->long_name, file, sizeof(dir_entry->long_name) - 1);
         dir_entry->entry_offset = dir_entry_offset;
         if(!fat16_write_dir_entry(fs, dir_entry))
             return 0;
     
-        return 1;
+        fat16_index_add(parent, dir_entry);
+        fat16_index_outdate(parent);
+    
+        /* write the fat in case the directory has grown */
+        return fat16_sync(fs);
     
     #else
         return 0;
@@ -1798,46 +3475,172 @@ uint8_t fat16_create_file(struct fat16_dir_struct* parent, const char* file, str
  * \see fat16_create_file
  */
 uint8_t fat16_delete_file(struct fat16_fs_struct* fs, struct fat16_dir_entry_struct* dir_entry)
+{
+    return fat16_delete_files(fs, dir_entry, 1);
+}
+
+/**
+ * \ingroup fat16_file
+ * Deletes several files or directories at once.
+ *
+ * The directory entries are marked as deleted sector by sector, so
+ * entries sharing a sector cost a single write. The cluster chains
+ * are then freed together, always continuing with the lowest fat
+ * sector any of them is in. Chains allocated in ascending order are
+ * thereby freed in one pass over the fat, and each fat sector is
+ * written once when the filesystem is synchronized at the end.
+ *
+ * The same restrictions as for fat16_delete_file() apply.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in,out] dir_entries The directory entries of the files to delete. Their cluster is set to 0.
+ * \param[in] count The number of directory entries.
+ * \returns 0 on failure, 1 on success.
+ * \see fat16_delete_file
+ */
+uint8_t fat16_delete_files(struct fat16_fs_struct* fs, struct fat16_dir_entry_struct* dir_entries, uint16_t count)
 {
     #if FAT16_WRITE_SUPPORT
-        if(!fs || !dir_entry)
-            return 0;
-    
-        /* get offset of the file's directory entry */
-        uint32_t dir_entry_offset = dir_entry->entry_offset;
-        if(!dir_entry_offset)
+        if(!fs || !dir_entries)
             return 0;
     
-        uint8_t buffer[12];
-        while(1)
+        /* mark the directory entries as deleted */
+        uint8_t sector[512];
+        offset_t sector_offset = 0;
+        uint16_t i;
+        for(i = 0; i < count; ++i)
         {
-            /* read directory entry */
-            if(!fs->partition->device_read(dir_entry_offset, buffer, sizeof(buffer)))
+            offset_t dir_entry_offset = dir_entries[i].entry_offset;
+            if(!dir_entry_offset)
                 return 0;
     
-            /* mark the directory entry as deleted */
-            buffer[0] = FAT16_DIRENTRY_DELETED;
+            fat16_index_remove(fs, dir_entry_offset);
     
-            /* write back entry */
-            if(!fs->partition->device_write(dir_entry_offset, buffer, sizeof(buffer)))
-                return 0;
+            while(1)
+            {
+                /* load the sector of the entry, writing back the previous one */
+                if(!sector_offset || dir_entry_offset - sector_offset >= sizeof(sector))
+                {
+                    if(sector_offset && !fs->partition->device_write(sector_offset, sector, sizeof(sector)))
+                        return 0;
+                    sector_offset = dir_entry_offset - dir_entry_offset % sizeof(sector);
+                    if(!fs->partition->device_read(sector_offset, sector, sizeof(sector)))
+                        return 0;
+                }
+    
+                uint8_t* entry = sector + (dir_entry_offset - sector_offset);
+                entry[0] = FAT16_DIRENTRY_DELETED;
+    
+                /* check if we deleted the whole entry */
+                if(entry[11] != 0x0f)
+                    break;
+    
+                dir_entry_offset += 32;
+            }
+        }
+        if(sector_offset && !fs->partition->device_write(sector_offset, sector, sizeof(sector)))
+            return 0;
     
-            /* check if we deleted the whole entry */
-            if(buffer[11] != 0x0f)
+        /* free the clusters of all chains */
+        uint16_t fat_sector_entries = 512 / FAT16_FAT_ENTRY_SIZE(fs);
+        while(1)
+        {
+            /* find the lowest fat sector which still has clusters to free */
+            uint32_t fat_sector = 0;
+            uint8_t pending = 0;
+            for(i = 0; i < count; ++i)
+            {
+                cluster_t cluster_num = dir_entries[i].cluster;
+                if(cluster_num < 2)
+                    continue;
+                if(!pending || cluster_num / fat_sector_entries < fat_sector)
+                    fat_sector = cluster_num / fat_sector_entries;
+                pending = 1;
+            }
+            if(!pending)
                 break;
     
-            dir_entry_offset += 32;
+            /* free the clusters within this sector */
+            for(i = 0; i < count; ++i)
+            {
+                cluster_t cluster_num = dir_entries[i].cluster;
+                while(cluster_num >= 2 && cluster_num / fat_sector_entries == fat_sector)
+                {
+                    uint8_t* fat_entry = fat16_get_fat_entry(fs, cluster_num, 1);
+                    if(!fat_entry)
+                        return 0;
+    
+                    cluster_t cluster_num_next = fat16_read_fat_entry(fs, fat_entry);
+                    if(cluster_num_next == FAT16_CLUSTER_FREE)
+                    {
+                        /* already freed */
+                        cluster_num = 0;
+                        break;
+                    }
+                    if(cluster_num_next == FAT16_CLUSTER_BAD ||
+                       (cluster_num_next >= FAT16_CLUSTER_RESERVED_MIN &&
+                        cluster_num_next <= FAT16_CLUSTER_RESERVED_MAX
+                       )
+                      )
+                        return 0;
+                    if(cluster_num_next >= FAT16_CLUSTER_LAST_MIN &&
+                       cluster_num_next <= FAT16_CLUSTER_LAST_MAX
+                      )
+                        cluster_num_next = 0;
+    
+                    fat16_write_fat_entry(fs, fat_entry, FAT16_CLUSTER_FREE);
+                    ++fs->cluster_free_count;
+                    fat16_add_free_run(fs, cluster_num);
+    
+                    cluster_num = cluster_num_next;
+                }
+                dir_entries[i].cluster = cluster_num;
+            }
         }
     
-        /* We deleted the directory entry. The next thing to do is
-                             * marking all occupied clusters as free.
-                             */
-        return fat16_free_clusters(fs, dir_entry->cluster);
+        return fat16_sync(fs);
     #else
         return 0;
     #endif
 }
 
+/**
+ * \ingroup fat16_fs
+ * Returns where the allocation table and the root directory are located.
+ *
+ * These areas are accessed far more often than file data, so the storage
+ * layer may want to treat them specially, e.g. keep them cached.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[out] fat_offset The device offset of the (first) allocation table.
+ * \param[out] fat_size The number of bytes of the allocation table in use.
+ * \param[out] root_dir_offset The device offset of the root directory.
+ * \param[out] root_dir_size The size of the root directory in bytes. On a FAT32, where
+ *                           the root directory is a cluster chain, that of its first cluster.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t fat16_get_fs_layout(const struct fat16_fs_struct* fs, offset_t* fat_offset, uint32_t* fat_size, offset_t* root_dir_offset, uint32_t* root_dir_size)
+{
+    if(!fs || !fat_offset || !fat_size || !root_dir_offset || !root_dir_size)
+        return 0;
+
+    *fat_offset = fs->header.fat_offset;
+    *fat_size = fs->header.fat_size;
+    *root_dir_offset = fs->header.root_dir_offset;
+    *root_dir_size = fs->header.cluster_zero_offset - fs->header.root_dir_offset;
+
+#if FAT16_FAT32_SUPPORT
+    if(FAT16_IS_FAT32(fs))
+    {
+        *root_dir_offset = fs->header.cluster_zero_offset +
+                           (offset_t) (fs->header.root_dir_cluster - 2) * fs->header.cluster_size;
+        *root_dir_size = fs->header.cluster_size;
+    }
+#endif
+
+    return 1;
+}
+
 /**
  * \ingroup fat16_fs
  * Returns the amount of total storage capacity of the filesystem in bytes.
@@ -1845,12 +3648,12 @@ uint8_t fat16_delete_file(struct fat16_fs_struct* fs, struct fat16_dir_entry_str
  * \param[in] fs The filesystem on which to operate.
  * \returns 0 on failure, the filesystem size in bytes otherwise.
  */
-uint32_t fat16_get_fs_size(const struct fat16_fs_struct* fs)
+offset_t fat16_get_fs_size(const struct fat16_fs_struct* fs)
 {
     if(!fs)
         return 0;
 
-    return (fs->header.fat_size / 2 - 2) * fs->header.cluster_size;
+    return (offset_t) (fs->header.fat_size / FAT16_FAT_ENTRY_SIZE(fs) - 2) * fs->header.cluster_size;
 }
 
 /**
@@ -1863,63 +3666,27 @@ uint32_t fat16_get_fs_size(const struct fat16_fs_struct* fs)
  * \param[in] fs The filesystem on which to operate.
  * \returns 0 on failure, the free filesystem space in bytes otherwise.
  */
-uint32_t fat16_get_fs_free(const struct fat16_fs_struct* fs)
+offset_t fat16_get_fs_free(const struct fat16_fs_struct* fs)
 {
     if(!fs)
         return 0;
 
-    uint8_t fat[32];
-    struct fat16_usage_count_callback_arg count_arg;
-    count_arg.cluster_count = 0;
-    count_arg.buffer_size = sizeof(fat);
-
-    uint32_t fat_offset = fs->header.fat_offset;
-    uint32_t fat_size = fs->header.fat_size;
-    while(fat_size > 0)
-    {
-        uint16_t length = UINT16_MAX - 1;
-        if(fat_size < length)
-            length = fat_size;
-
-        if(!fs->partition->device_read_interval(fat_offset,
-            fat,
-           sizeof(fat),
-           length,
-           fat16_get_fs_free_callback,
-           &count_arg
-           )
-           )
-        return 0;
-
-        fat_offset += length;
-        fat_size -= length;
-    }
-
-    return (uint32_t) count_arg.cluster_count * fs->header.cluster_size;
+    return (offset_t) fs->cluster_free_count * fs->header.cluster_size;
 }
 
-/**
- * \ingroup fat16_fs
- * Callback function used for counting free clusters.
- */
-uint8_t fat16_get_fs_free_callback(uint8_t* buffer, uint32_t offset, void* p)
+uint8_t find_file_in_dir(struct fat16_fs_struct* fs, struct fat16_dir_struct* dd, const char* name, struct fat16_dir_entry_struct* dir_entry)
 {
-    struct fat16_usage_count_callback_arg* count_arg = (struct fat16_usage_count_callback_arg*) p;
-    uint8_t buffer_size = count_arg->buffer_size;
-    uint8_t i;
-    for(i = 0; i < buffer_size; i += 2)
+#if FAT16_DIR_INDEX_ENTRIES
+    if(fat16_index_find(dd, name, dir_entry))
     {
-        if((((uint16_t) buffer[1] << 8) | ((uint16_t) buffer[0] << 0)) == FAT16_CLUSTER_FREE)
-            ++(count_arg->cluster_count);
-
-        buffer += 2;
+        fat16_reset_dir(dd);
+        return 1;
     }
 
-    return 1;
-}
+    if(!dd->index_incomplete)
+        return 0;
+#endif
 
-uint8_t find_file_in_dir(struct fat16_fs_struct* fs, struct fat16_dir_struct* dd, const char* name, struct fat16_dir_entry_struct* dir_entry)
-{
     while(fat16_read_dir(dd, dir_entry))
     {
         if(strcmp(dir_entry->long_name, name) == 0)
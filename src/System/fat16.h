@@ -11,6 +11,8 @@
 #define FAT16_H
 
 #include <stdint.h>
+#include "partition.h"
+#include "fat16_config.h"
 
 /**
  * \addtogroup fat16
@@ -75,11 +77,11 @@ struct fat16_dir_entry_struct
     //uint16_t modified_date;
 
     /** The cluster in which the file's first byte resides. */
-    uint16_t cluster;
+    cluster_t cluster;
     /** The file's size. */
     uint32_t file_size;
     /** The total disk offset of this directory entry. */
-    uint32_t entry_offset;
+    offset_t entry_offset;
 };
 
 struct fat16_fs_struct* 
@@ -88,15 +90,27 @@ fat16_open(struct partition_struct* partition);
 void 
 fat16_close(struct fat16_fs_struct* fs);
 
+uint8_t 
+fat16_sync(struct fat16_fs_struct* fs);
+
+void 
+fat16_get_pool_peaks(uint8_t* fs_peak, uint8_t* file_peak, uint8_t* dir_peak);
+
 struct 
 fat16_file_struct* fat16_open_file(struct fat16_fs_struct* fs, const struct fat16_dir_entry_struct* dir_entry);
 
 void 
 fat16_close_file(struct fat16_file_struct* fd);
 
+uint8_t 
+fat16_sync_file(struct fat16_file_struct* fd);
+
 int16_t 
 fat16_read_file(struct fat16_file_struct* fd, uint8_t* buffer, uint16_t buffer_len);
 
+uint8_t 
+fat16_stream_file(struct fat16_file_struct* fd, uint8_t* buffer, device_read_callback_t callback, void* p);
+
 int16_t 
 fat16_write_file(struct fat16_file_struct* fd, const uint8_t* buffer, uint16_t buffer_len);
 
@@ -106,6 +120,9 @@ fat16_seek_file(struct fat16_file_struct* fd, int32_t* offset, uint8_t whence);
 uint8_t 
 fat16_resize_file(struct fat16_file_struct* fd, uint32_t size);
 
+uint8_t 
+fat16_preallocate_file(struct fat16_file_struct* fd, uint32_t size);
+
 struct fat16_dir_struct* 
 fat16_open_dir(struct fat16_fs_struct* fs, const struct fat16_dir_entry_struct* dir_entry);
 
@@ -127,13 +144,19 @@ fat16_create_file(struct fat16_dir_struct* parent, const char* file, struct fat1
 uint8_t 
 fat16_delete_file(struct fat16_fs_struct* fs, struct fat16_dir_entry_struct* dir_entry);
 
+uint8_t 
+fat16_delete_files(struct fat16_fs_struct* fs, struct fat16_dir_entry_struct* dir_entries, uint16_t count);
+
 uint8_t 
 fat16_get_dir_entry_of_path(struct fat16_fs_struct* fs, const char* path, struct fat16_dir_entry_struct* dir_entry);
 
-uint32_t 
+uint8_t 
+fat16_get_fs_layout(const struct fat16_fs_struct* fs, offset_t* fat_offset, uint32_t* fat_size, offset_t* root_dir_offset, uint32_t* root_dir_size);
+
+offset_t 
 fat16_get_fs_size(const struct fat16_fs_struct* fs);
 
-uint32_t 
+offset_t 
 fat16_get_fs_free(const struct fat16_fs_struct* fs);
 
 uint8_t 
@@ -5,7 +5,9 @@
  */
 
 #ifndef FAT16_CONFIG_H
-#define FAT16_CONFIG_G
+#define FAT16_CONFIG_H
+
+#include <stdint.h>
 
 /**
  * \addtogroup fat16
@@ -25,9 +27,140 @@
  */
 #define FAT16_WRITE_SUPPORT 1
 
+/**
+ * \ingroup fat16_config
+ * Controls FAT32 support.
+ *
+ * Set to 1 to also mount FAT32 filesystems, as found on cards
+ * larger than 2 GB. Cluster numbers then take 32 bits instead
+ * of 16. Set to 0 to disable it.
+ */
+#define FAT16_FAT32_SUPPORT 1
+
+/**
+ * \ingroup fat16_config
+ * Number of FAT sectors cached per filesystem.
+ *
+ * Cluster chains are followed and modified within these sectors,
+ * which saves a device access for each cluster. Each sector takes
+ * 512 bytes of the filesystem descriptor. With more than one, the
+ * searches for free clusters leave a modified sector in the cache,
+ * so it is written once instead of whenever a search passes by.
+ * A single sector writes each FAT copy several times as often while
+ * a file grows on a volume with scattered free clusters.
+ *
+ * \note May be overridden on the compiler's command line.
+ */
+#ifndef FAT16_FAT_CACHE_SECTORS
+#define FAT16_FAT_CACHE_SECTORS 2
+#endif
+
+/**
+ * \ingroup fat16_config
+ * Number of free cluster runs remembered per filesystem.
+ *
+ * The longest runs of free clusters are collected on the first
+ * allocation and kept up to date while clusters are allocated and
+ * freed. New clusters are taken from these runs instead of searching
+ * the FAT, which also keeps files contiguous. Set to 0 to disable.
+ */
+#define FAT16_FREE_RUNS 4
+
+/**
+ * \ingroup fat16_config
+ * Number of cluster runs mapped per open file.
+ *
+ * Each file handle remembers where the runs of consecutive clusters
+ * of its first FAT16_FILE_EXTENTS fragments lie. Seeking within them
+ * does not need to follow the cluster chain. Each run takes 4 bytes
+ * of the file handle, 8 with FAT32 support. Set to 0 to disable.
+ */
+#define FAT16_FILE_EXTENTS 8
+
+/**
+ * \ingroup fat16_config
+ * Controls the sector buffer of open files.
+ *
+ * Set to 1 to collect small writes to a file, e.g. appended records,
+ * in a sector buffer of the file handle. The sector is written as a
+ * whole once the writes move on, which spares reading it from the
+ * card first. Each buffer takes 512 bytes of the file handle. Set to
+ * 0 to disable.
+ */
+#define FAT16_FILE_BUFFER 1
+
+/**
+ * \ingroup fat16_config
+ * Number of bytes a file may grow before it is synchronized.
+ *
+ * The directory entry of a file being written is only updated when
+ * the file is closed or synchronized. If set, this also happens once
+ * the file has grown by this many bytes, which limits what is lost if
+ * the card is removed early. Set to 0 to disable.
+ *
+ * \note May be overridden on the compiler's command line.
+ */
+#ifndef FAT16_DIR_ENTRY_SYNC_BYTES
+#define FAT16_DIR_ENTRY_SYNC_BYTES 0
+#endif
+
+/**
+ * \ingroup fat16_config
+ * Number of file names indexed per directory handle.
+ *
+ * When a directory is opened, the hashes of its file names are
+ * collected together with the locations of their entries. Looking
+ * up a name then only reads the entries with a matching hash. If a
+ * directory holds more names, the rest is searched as before. Each
+ * name takes 6 bytes of the directory handle. Set to 0 to disable.
+ */
+#define FAT16_DIR_INDEX_ENTRIES 32
+
+/**
+ * \ingroup fat16_config
+ * Number of partition handles.
+ *
+ * Partition, filesystem, file and directory handles are taken from
+ * statically allocated pools instead of the heap. Opening fails once
+ * all handles of a pool are in use.
+ */
+#define FAT16_PARTITION_HANDLES 1
+
+/**
+ * \ingroup fat16_config
+ * Number of filesystem handles.
+ *
+ * Each handle includes the fat cache.
+ */
+#define FAT16_FS_HANDLES 1
+
+/**
+ * \ingroup fat16_config
+ * Number of file handles.
+ *
+ * Each handle includes the sector buffer of the file.
+ */
+#define FAT16_FILE_HANDLES 2
+
+/**
+ * \ingroup fat16_config
+ * Number of directory handles.
+ *
+ * Looking up a path takes a directory handle while other directories
+ * may be open, e.g. the root directory. Each handle includes the name
+ * index of the directory.
+ */
+#define FAT16_DIR_HANDLES 2
+
 /**
  * @}
  */
 
+#if FAT16_FAT32_SUPPORT
+    typedef uint32_t cluster_t;
+#else
+    typedef uint16_t cluster_t;
+#endif
+
 #endif
 
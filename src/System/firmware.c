@@ -72,89 +72,73 @@ char readbuf[READBUFSIZE];
 
 /* End FPC */
 
-int load_fw(char* filename)
+/* Called by fat16_stream_file() for every 512 byte sector of the
+ * firmware file, offset is the position of the sector in the file.
+ * Bytes beyond the end of the file are already zeroed, so we can
+ * always write out the entire buffer.
+ */
+static uint8_t load_fw_sector(uint8_t* buffer, offset_t offset, void* p)
 {
-    struct fat16_file_struct * fd;
-    int read;
-    int i;
-    char* addy;
-    addy = (char*)STARTADDR;
+    char* addy = (char*)STARTADDR + offset;
 
-    /* Erase all sectors we could use */
-    prep_command[1]=ERASE_SECT_START;
-    prep_command[2]=ERASE_SECT_STOP;
-    iap_fn(prep_command,result);
-    iap_fn(erase_command,result);
-
-    /* Open the file */
-    fd = root_open(filename);
-
-    /* Clear the buffer */
-    for(i=0;i<READBUFSIZE;i++)
+    /* And we should probably bounds-check... *SIGH*/
+    if((unsigned int)addy > (unsigned int) 0x0007CFFF)
     {
-        readbuf[i]=0;
+        return 0;
     }
 
-    /* Read the file contents, and print them out */
-    while( (read=fat16_read_file(fd,(unsigned char*)readbuf,READBUFSIZE)) > 0 )
+    // Print Data to UART (DEBUG)
+    /*for(i=0; i<READBUFSIZE; i++)
     {
+        rprintf("%c",buffer[i]);
+    }*/
 
-        // Print Data to UART (DEBUG)
-        /*for(i=0; i<read; i++)
-        {
-            rprintf("%c",readbuf[i]);
-        }*/
-
-        /* Write Data to Flash */
-
-        /* Prepare Current Sector */
-        /* This assumes that we are always only writing to one sector!
-                     * This is only true if our write size necessarily aligns
-                     * on proper boundaries. Be careful */
-        prep_command[1] = SECTOR_NUMBER(((int)addy));
-        prep_command[2] = prep_command[1];
-        iap_fn(prep_command,result);
+    /* Write Data to Flash */
 
+    /* Prepare Current Sector */
+    /* This assumes that we are always only writing to one sector!
+     * This is only true if our write size necessarily aligns
+     * on proper boundaries. Be careful */
+    prep_command[1] = SECTOR_NUMBER(((int)addy));
+    prep_command[2] = prep_command[1];
+    iap_fn(prep_command,result);
 
-        /* *** Should check result here... but I'm not */
-        /* If all went according to plan, the sector is primed for write
-                     * (or erase)
-                     */
 
+    /* *** Should check result here... but I'm not */
+    /* If all went according to plan, the sector is primed for write
+     * (or erase)
+     */
 
-        /* Now write data */
-        write_command[1]=(unsigned int)addy;
-        write_command[2]=(unsigned int)readbuf;
-        write_command[3]=READBUFSIZE;
-        iap_fn(write_command,result);
 
-        /* *** Should check result here... but I'm not */
-        /* If all went according to plan, data is in flash,
-                     * and the sector is locked again
-                     */
+    /* Now write data */
+    write_command[1]=(unsigned int)addy;
+    write_command[2]=(unsigned int)buffer;
+    write_command[3]=READBUFSIZE;
+    iap_fn(write_command,result);
 
+    /* *** Should check result here... but I'm not */
+    /* If all went according to plan, data is in flash,
+     * and the sector is locked again
+     */
 
-        /* Done with current data, so clear buffer
-                     *  this is because we ALWAYS write out the
-                     *  entire buffer, and we don't want to write
-                     *  garbage data on reads smaller than READBUFSIZE
-                     */
-        for(i=0;i<READBUFSIZE;i++)
-        {
-            readbuf[i]=0;
-        }
+    return 1;
+}
 
+int load_fw(char* filename)
+{
+    struct fat16_file_struct * fd;
 
-        /* Now update the address-- */
-        addy = addy + READBUFSIZE;
+    /* Erase all sectors we could use */
+    prep_command[1]=ERASE_SECT_START;
+    prep_command[2]=ERASE_SECT_STOP;
+    iap_fn(prep_command,result);
+    iap_fn(erase_command,result);
 
-        /* And we should probably bounds-check... *SIGH*/
-        if((unsigned int)addy > (unsigned int) 0x0007CFFF)
-        {
-            break;
-        }
+    /* Open the file */
+    fd = root_open(filename);
 
-    }
+    /* Stream the file contents into flash, one sector at a time */
+    fat16_stream_file(fd,(unsigned char*)readbuf,load_fw_sector,0);
 
     /* All data copied to FLASH */
     /* Debug: Report the flash contents */
@@ -170,9 +154,9 @@ int load_fw(char* filename)
 
 
     /* Close the file! */
-    sd_raw_sync();
     fat16_close_file(fd);
     root_delete(filename);
+    sd_raw_sync();
 
     return 0;
 }
@@ -5,8 +5,8 @@
  */
 
 #include "partition.h"
+#include "fat16_config.h"
 
-#include <stdlib.h>
 #include <string.h>
 #include "rprintf.h"
 
@@ -24,6 +24,12 @@
  * \author Roland Riegel
  */
 
+/* the partition descriptors, taken as in fat16_pool_take() */
+static struct partition_struct partition_handles[FAT16_PARTITION_HANDLES];
+static uint8_t partition_free_slots[FAT16_PARTITION_HANDLES];
+static uint8_t partition_free_count;
+static uint8_t partition_used;
+
 /**
  * Opens a partition.
  *
@@ -34,6 +40,7 @@
  *
  * \param[in] device_read A function pointer which is used to read from the disk.
  * \param[in] device_read_interval A function pointer which is used to read in constant intervals from the disk.
+ * \param[in] device_read_blocks A function pointer which is used to stream whole blocks from the disk, may be zero.
  * \param[in] device_write A function pointer which is used to write to the disk.
  * \param[in] index The index of the partition which should be opened, range 0 to 3.
  *                  A negative value is allowed as well. In this case, the partition opened is
@@ -42,7 +49,7 @@
  * \returns 0 on failure, a partition descriptor on success.
  * \see partition_close
  */
-struct partition_struct* partition_open(device_read_t device_read, device_read_interval_t device_read_interval, device_write_t device_write, int8_t index0)
+struct partition_struct* partition_open(device_read_t device_read, device_read_interval_t device_read_interval, device_read_blocks_t device_read_blocks, device_write_t device_write, int8_t index0)
 {
     struct partition_struct* new_partition = 0;
     uint8_t buffer[0x10];
@@ -63,8 +70,11 @@ struct partition_struct* partition_open(device_read_t device_read, device_read_i
     }
 
     /* allocate partition descriptor */
-    new_partition = malloc(sizeof(*new_partition));
-    if(!new_partition)
+    if(partition_free_count)
+        new_partition = &partition_handles[partition_free_slots[--partition_free_count]];
+    else if(partition_used < FAT16_PARTITION_HANDLES)
+        new_partition = &partition_handles[partition_used++];
+    else
         return 0;
     memset(new_partition, 0, sizeof(*new_partition));
 	
@@ -73,6 +83,7 @@ struct partition_struct* partition_open(device_read_t device_read, device_read_i
     /* fill partition descriptor */
     new_partition->device_read = device_read;
     new_partition->device_read_interval = device_read_interval;
+    new_partition->device_read_blocks = device_read_blocks;
     new_partition->device_write = device_write;
 
     if(index0 >= 0)
@@ -113,15 +124,37 @@ struct partition_struct* partition_open(device_read_t device_read, device_read_i
  */
 uint8_t partition_close(struct partition_struct* partition)
 {
-    if(!partition)
+    /* refuse descriptors which are not in use, e.g. closed before */
+    if(partition < partition_handles || partition >= partition_handles + FAT16_PARTITION_HANDLES)
         return 0;
+    uint8_t slot = partition - partition_handles;
+    if(slot >= partition_used)
+        return 0;
+
+    uint8_t i;
+    for(i = 0; i < partition_free_count; ++i)
+    {
+        if(partition_free_slots[i] == slot)
+            return 0;
+    }
 
     /* destroy partition descriptor */
-    free(partition);
+    partition_free_slots[partition_free_count++] = slot;
 
     return 1;
 }
 
+/**
+ * Returns the most partition descriptors which were in use at once.
+ *
+ * \returns The most partition descriptors in use at once.
+ * \see FAT16_PARTITION_HANDLES
+ */
+uint8_t partition_get_pool_peak(void)
+{
+    return partition_used;
+}
+
 /**
  * @}
  */
@@ -62,6 +62,24 @@
  */
 #define PARTITION_TYPE_UNKNOWN 0xff
 
+/**
+ * Controls the width of device offsets.
+ *
+ * Set to 1 to support devices of more than 4 gigabytes, like SDHC
+ * cards, whose byte offsets do not fit into 32 bits. Offsets then
+ * become 64 bits wide.
+ */
+#define PARTITION_LARGE_OFFSETS 1
+
+/**
+ * The byte offset of a location on the device.
+ */
+#if PARTITION_LARGE_OFFSETS
+    typedef uint64_t offset_t;
+#else
+    typedef uint32_t offset_t;
+#endif
+
 /**
  * A function pointer used to read from the partition.
  *
@@ -69,7 +87,7 @@
  * \param[out] buffer The buffer into which to place the data.
  * \param[in] length The count of bytes to read.
  */
-typedef uint8_t (*device_read_t)(uint32_t offset, uint8_t* buffer, uint16_t length);
+typedef uint8_t (*device_read_t)(offset_t offset, uint8_t* buffer, uint16_t length);
 /**
  * A function pointer passed to a \c device_read_interval_t.
  *
@@ -78,7 +96,7 @@ typedef uint8_t (*device_read_t)(uint32_t offset, uint8_t* buffer, uint16_t leng
  * \param[in] p An opaque pointer.
  * \see device_read_interval_t
  */
-typedef uint8_t (*device_read_callback_t)(uint8_t* buffer, uint32_t offset, void* p);
+typedef uint8_t (*device_read_callback_t)(uint8_t* buffer, offset_t offset, void* p);
 /**
  * A function pointer used to continuously read units of \c interval bytes
  * and call a callback function.
@@ -97,7 +115,23 @@ typedef uint8_t (*device_read_callback_t)(uint8_t* buffer, uint32_t offset, void
  * \returns 0 on failure, 1 on success
  * \see device_read_t
  */
-typedef uint8_t (*device_read_interval_t)(uint32_t offset, uint8_t* buffer, uint16_t interval, uint16_t length, device_read_callback_t callback, void* p);
+typedef uint8_t (*device_read_interval_t)(offset_t offset, uint8_t* buffer, uint16_t interval, uint16_t length, device_read_callback_t callback, void* p);
+/**
+ * A function pointer used to read consecutive 512 byte blocks in a single transfer.
+ *
+ * If \c callback is given, every block is read into \c buffer and handed to
+ * the callback, which may stop reading by returning zero. Otherwise the
+ * blocks are placed one after another into \c buffer.
+ *
+ * \param[in] offset The offset of the first block on the device.
+ * \param[out] buffer The buffer into which to place the data.
+ * \param[in] count The number of blocks to read.
+ * \param[in] callback The function to call for every block, or 0.
+ * \param[in] p An opaque pointer directly passed to the callback function.
+ * \returns 0 on failure, 1 on success
+ * \see device_read_t
+ */
+typedef uint8_t (*device_read_blocks_t)(offset_t offset, uint8_t* buffer, uint16_t count, device_read_callback_t callback, void* p);
 /**
  * A function pointer used to write from the partition.
  *
@@ -105,7 +139,7 @@ typedef uint8_t (*device_read_interval_t)(uint32_t offset, uint8_t* buffer, uint
  * \param[in] buffer The buffer which to write.
  * \param[in] length The count of bytes to write.
  */
-typedef uint8_t (*device_write_t)(uint32_t offset, const uint8_t* buffer, uint16_t length);
+typedef uint8_t (*device_write_t)(offset_t offset, const uint8_t* buffer, uint16_t length);
 
 /**
  * Describes a partition.
@@ -126,6 +160,15 @@ struct partition_struct
      *       not to the start of the partition.
      */
     device_read_interval_t device_read_interval;
+    /**
+     * The function which streams whole blocks from the partition.
+     *
+     * This one is optional and may be zero.
+     *
+     * \note The offset given to this function is relative to the whole disk,
+     *       not to the start of the partition.
+     */
+    device_read_blocks_t device_read_blocks;
     /**
      * The function which writes data to the partition.
      *
@@ -150,8 +193,9 @@ struct partition_struct
     uint32_t length;
 };
 
-struct partition_struct* partition_open(device_read_t device_read, device_read_interval_t device_read_interval, device_write_t device_write, int8_t index);
+struct partition_struct* partition_open(device_read_t device_read, device_read_interval_t device_read_interval, device_read_blocks_t device_read_blocks, device_write_t device_write, int8_t index);
 uint8_t partition_close(struct partition_struct* partition);
+uint8_t partition_get_pool_peak(void);
 
 /**
  * @}
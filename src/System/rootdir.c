@@ -12,11 +12,22 @@ struct partition_struct* partition;
 struct fat16_dir_struct* dd;
 struct fat16_file_struct * fd;
 
+/* number of files root_format() deletes at once */
+#define ROOT_FORMAT_BATCH 16
+
 int openroot(void)
 {
+    /* release the handles of a previous call */
+    fat16_close_dir(dd);
+    fat16_close(fs);
+    partition_close(partition);
+    dd = 0;
+    fs = 0;
+
     /* open first partition */
     partition = partition_open((device_read_t) sd_raw_read,
                                (device_read_interval_t) sd_raw_read_interval,
+                               (device_read_blocks_t) sd_raw_read_blocks,
                                (device_write_t) sd_raw_write,
                                0);
 
@@ -27,6 +38,7 @@ int openroot(void)
              *           */
         partition = partition_open((device_read_t) sd_raw_read,
                                    (device_read_interval_t) sd_raw_read_interval,
+                                   (device_read_blocks_t) sd_raw_read_blocks,
                                    (device_write_t) sd_raw_write,
                                    -1);
         if(!partition)
@@ -44,6 +56,16 @@ int openroot(void)
         return 1;
     }
 
+    /* keep the allocation table and the root directory cached */
+    offset_t fat_offset, root_dir_offset;
+    uint32_t fat_size, root_dir_size;
+    sd_raw_cache_unpin();
+    if(fat16_get_fs_layout(fs, &fat_offset, &fat_size, &root_dir_offset, &root_dir_size))
+    {
+        sd_raw_cache_pin(fat_offset, fat_size);
+        sd_raw_cache_pin(root_dir_offset, root_dir_size);
+    }
+
     /* open root directory */
     fat16_get_dir_entry_of_path(fs, "/", &dir_entry);
 
@@ -97,11 +119,19 @@ uint8_t print_disk_info(const struct fat16_fs_struct* disk_fs)
     rprintf("rev:    %02x\n\r", disk_info.revision);
     rprintf("serial: 0x%08lx\n\r", disk_info.serial);
     rprintf("date:   %02d/%02d\n\r", disk_info.manufacturing_month, disk_info.manufacturing_year);
-    rprintf("size:   %ld\n\r", disk_info.capacity);
+    rprintf("size:   %ldkB\n\r", (uint32_t) (disk_info.capacity / 1024));
     rprintf("copy:   %d\n\r", disk_info.flag_copy);
     rprintf("wr.pr.: %d/%d\n\r", disk_info.flag_write_protect_temp, disk_info.flag_write_protect);
     rprintf("format: %d\n\r", disk_info.format);
-    rprintf("free:   %ld/%ld\n\r", fat16_get_fs_free(disk_fs), fat16_get_fs_size(disk_fs));
+    rprintf("free:   %ld/%ldkB\n\r", (uint32_t) (fat16_get_fs_free(disk_fs) / 1024), (uint32_t) (fat16_get_fs_size(disk_fs) / 1024));
+
+    uint8_t fs_peak, file_peak, dir_peak;
+    fat16_get_pool_peaks(&fs_peak, &file_peak, &dir_peak);
+    rprintf("pools:  part %d/%d fs %d/%d file %d/%d dir %d/%d\n\r",
+            partition_get_pool_peak(), FAT16_PARTITION_HANDLES,
+            fs_peak, FAT16_FS_HANDLES,
+            file_peak, FAT16_FILE_HANDLES,
+            dir_peak, FAT16_DIR_HANDLES);
 //    set_output(temp);
     return 1;
 }
@@ -203,12 +233,20 @@ int rootDirectory_files(char* buf, int len)
 
 void root_format(void)
 {
+    /* delete the files in batches, reading on where the last batch ended */
+    struct fat16_dir_entry_struct dir_entries[ROOT_FORMAT_BATCH];
+    uint16_t count;
     fat16_reset_dir(dd);
-    while(fat16_read_dir(dd,&dir_entry))
+    do
     {
-        fat16_delete_file(fs,&dir_entry);
-        fat16_reset_dir(dd);
+        count = 0;
+        while(count < ROOT_FORMAT_BATCH && fat16_read_dir(dd,&dir_entries[count]))
+            count++;
+        if(!fat16_delete_files(fs,dir_entries,count))
+            break;
     }
+    while(count == ROOT_FORMAT_BATCH);
+    fat16_reset_dir(dd);
 }
 
 int root_delete(char* filename)
@@ -41,6 +41,8 @@
 #define CMD_GO_IDLE_STATE 0x00
 /* CMD1: response R1 */
 #define CMD_SEND_OP_COND 0x01
+/* CMD8: arg0[11:8]: supply voltage, arg0[7:0]: check pattern, response R7 */
+#define CMD_SEND_IF_COND 0x08
 /* CMD9: response R1 */
 #define CMD_SEND_CSD 0x09
 /* CMD10: response R1 */
@@ -83,10 +85,16 @@
 #define CMD_ERASE 0x26
 /* CMD42: arg0[31:0]: stuff bits, response R1b */
 #define CMD_LOCK_UNLOCK 0x2a
+/* CMD55: arg0[31:0]: stuff bits, response R1 */
+#define CMD_APP 0x37
 /* CMD58: response R3 */
 #define CMD_READ_OCR 0x3a
 /* CMD59: arg0[31:1]: stuff bits, arg0[0:0]: crc option, response R1 */
 #define CMD_CRC_ON_OFF 0x3b
+/* ACMD23: arg0[22:0]: number of blocks to pre-erase, response R1 */
+#define CMD_SET_WR_BLK_ERASE_COUNT 0x17
+/* ACMD41: arg0[30]: host supports high capacity cards, response R1 */
+#define CMD_SD_SEND_OP_COND 0x29
 
 /* command responses */
 /* R1: size 1 byte */
@@ -130,23 +138,141 @@
 #define DR_STATUS_CRC_ERR 0x0a
 #define DR_STATUS_WRITE_ERR 0x0c
 
-#if !SD_RAW_SAVE_RAM
-    
-    /* static data buffer for acceleration */
-    static unsigned char raw_block[512];
-    /* offset where the data within raw_block lies on the card */
-    static unsigned int raw_block_address;
-    #if SD_RAW_WRITE_BUFFERING
-    /* flag to remember if raw_block was written to the card */
-    static unsigned char raw_block_written;
+/* card type state */
+#define SD_RAW_SPEC_1 0
+#define SD_RAW_SPEC_2 1
+#define SD_RAW_SPEC_SDHC 2
+
+/* SPI controller access */
+#if SD_RAW_USE_SSP
+    /* SSPSR: transmit FIFO not full, receive FIFO not empty */
+    #define SSPSR_TNF 0x02
+    #define SSPSR_RNE 0x04
+    /* depth of the SSP FIFOs in frames */
+    #define SSP_FIFO_SIZE 8
+
+    #define SD_RAW_SPI_PRESCALER SSPCPSR
+#else
+    #define SD_RAW_SPI_PRESCALER S0SPCCR
 #endif
 
+/* data tokens */
+#define TOKEN_START_BLOCK 0xfe
+#define TOKEN_START_BLOCK_MULTIPLE 0xfc
+#define TOKEN_STOP_TRANSMISSION 0xfd
+
+/* Upper bounds for waiting on the card, counted in bytes clocked.
+ * They cover 100ms of read access time and 500ms of busy time
+ * even at the fastest SPI clock.
+ */
+#define SD_RAW_READ_TIMEOUT 400000UL
+#define SD_RAW_BUSY_TIMEOUT 2000000UL
+/* bytes sd_raw_read_poll() clocks per call while waiting for the data */
+#define SD_RAW_READ_POLL_BYTES 32
+
+/* states of the read started by sd_raw_read_start() */
+#define SD_RAW_READ_IDLE 0
+#define SD_RAW_READ_CARD 1
+#define SD_RAW_READ_CACHED 2
+#define SD_RAW_READ_STREAM 3
+
+/* the SD_RAW_SPEC_* bits describing the card found by sd_raw_init() */
+static unsigned char sd_raw_card_type;
+/* the SPI clock prescaler negotiated by sd_raw_init() */
+static unsigned char sd_raw_spi_prescaler;
+/* one of the SD_RAW_READ_* states above */
+static unsigned char sd_raw_read_state;
+/* the block the pending read fetches */
+static offset_t sd_raw_read_address;
+/* bytes clocked so far while waiting for the pending read's data */
+static unsigned long sd_raw_read_waited;
+/* set while the card may still be programming the last written block */
+static unsigned char sd_raw_programming;
+/* the block the open write stream continues with */
+static offset_t sd_raw_write_address;
+/* blocks still announced by the open multiple block write, 0 if none is open */
+static unsigned short sd_raw_write_left;
+/* set if the open write stream consists of a single block */
+static unsigned char sd_raw_write_single;
+/* set by a successful sd_raw_init() */
+static unsigned char sd_raw_init_done;
+/* set while a multiple block read is open, the card then stays selected */
+static unsigned char sd_raw_stream_open;
+/* the block the open multiple block read delivers next */
+static offset_t sd_raw_stream_address;
+/* the block following the last one read from the card */
+static offset_t sd_raw_seq_next;
+
+#if !SD_RAW_SAVE_RAM
+
+    /* cache line flags */
+    #define SD_RAW_CACHE_VALID 0x01
+    #define SD_RAW_CACHE_DIRTY 0x02
+    #define SD_RAW_CACHE_PINNED 0x04
+    #define SD_RAW_CACHE_PREFETCHED 0x08
+
+    /* a block of the card held in memory */
+    struct sd_raw_cache_line
+    {
+        /* the block's content */
+        unsigned char data[512];
+        /* offset where the block lies on the card */
+        offset_t address;
+        /* time of the last access, used to find the least recently used line */
+        unsigned int stamp;
+        /* combination of the SD_RAW_CACHE_* flags */
+        unsigned char flags;
+    };
+
+    /* an area of the card whose blocks are preferably kept in the cache */
+    struct sd_raw_cache_area
+    {
+        offset_t offset;
+        unsigned int length;
+    };
+
+    /* static data buffers for acceleration */
+    static struct sd_raw_cache_line raw_cache[SD_RAW_CACHE_LINES];
+    /* areas pinned with sd_raw_cache_pin() */
+    static struct sd_raw_cache_area raw_cache_pins[SD_RAW_CACHE_PIN_AREAS];
+    /* source of the line access stamps */
+    static unsigned int raw_cache_stamp;
+    /* cache efficiency counters */
+    static struct sd_raw_cache_stats raw_cache_stats;
+
 #endif
 
 /* private helper functions */
 static void sd_raw_send_byte(unsigned char b);
 static unsigned char sd_raw_rec_byte(void);
+static void sd_raw_send_block(const unsigned char* buffer, unsigned short length);
+static void sd_raw_rec_block(unsigned char* buffer, unsigned short length);
 static unsigned char sd_raw_send_command_r1(unsigned char command, unsigned int arg);
+static unsigned char sd_raw_poll_token(unsigned short max_bytes);
+static unsigned char sd_raw_wait_token(void);
+static unsigned char sd_raw_wait_ready(void);
+static unsigned char sd_raw_finish_write(void);
+static unsigned char sd_raw_finish_read(unsigned char* buffer);
+static void sd_raw_stop_transmission(void);
+static unsigned char sd_raw_stream_read(offset_t block_address, unsigned char* buffer);
+static void sd_raw_stream_close(void);
+static unsigned int sd_raw_block_arg(offset_t block_address);
+static unsigned short sd_raw_crc16(unsigned short crc, unsigned char b);
+static unsigned char sd_raw_read_tran_speed(unsigned char* tran_speed);
+static unsigned char sd_raw_check_clock(void);
+#if !SD_RAW_SAVE_RAM
+static unsigned char sd_raw_read_block(offset_t block_address, unsigned char* buffer);
+#if SD_RAW_WRITE_SUPPORT
+static unsigned char sd_raw_write_block(offset_t block_address, const unsigned char* buffer);
+#endif
+static struct sd_raw_cache_line* sd_raw_cache_find(offset_t block_address);
+static struct sd_raw_cache_line* sd_raw_cache_get(offset_t block_address, unsigned char load);
+static unsigned char sd_raw_cache_flush_line(struct sd_raw_cache_line* line);
+static unsigned char sd_raw_cache_is_pinned(offset_t block_address);
+#if SD_RAW_READ_AHEAD
+static void sd_raw_cache_prefetch(const struct sd_raw_cache_line* keep);
+#endif
+#endif
 //static unsigned short sd_raw_send_command_r2(unsigned char command, unsigned int arg);
 
 /**
@@ -169,9 +295,29 @@ unsigned char sd_raw_init()
 
     unselect_card();
 
+    /* forget about transfers of an earlier initialization */
+    sd_raw_init_done = 0;
+    sd_raw_read_state = SD_RAW_READ_IDLE;
+    sd_raw_stream_open = 0;
+    sd_raw_seq_next = 1; /* matches no block */
+    sd_raw_write_left = 0;
+    sd_raw_write_single = 0;
+
     /* initialize SPI with lowest frequency; max. 400kHz during identification mode of card */
-    S0SPCCR = 150;  /* Set frequency to 400kHz */
-    S0SPCR = 0x38;
+    sd_raw_spi_prescaler = 0;
+    #if SD_RAW_USE_SSP
+        SSPCR1 = 0x00;
+        SSPCR0 = 0xc7;  /* 8 bit frames, SPI format, CPOL = 1, CPHA = 1 */
+        SSPCPSR = 150;  /* Set frequency to 400kHz */
+        SSPCR1 = 0x02;  /* enable as master */
+
+        /* drop whatever is left in the receive FIFO */
+        while(SSPSR & SSPSR_RNE)
+            SSPDR;
+    #else
+        S0SPCCR = 150;  /* Set frequency to 400kHz */
+        S0SPCR = 0x38;
+    #endif
 
 
     /* initialization procedure */
@@ -211,10 +357,66 @@ unsigned char sd_raw_init()
         }
     }
 
+    /* check for version of SD card specification */
+    sd_raw_card_type = 0;
+    response = sd_raw_send_command_r1(CMD_SEND_IF_COND, 0x100 /* 2.7V - 3.6V */ | 0xaa /* test pattern */);
+    if(!(response & (1 << R1_ILL_COMMAND)))
+    {
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+        if(!(sd_raw_rec_byte() & 0x01))
+        {
+            /* card operation voltage range doesn't match */
+            unselect_card();
+            rprintf("SD VOLTAGE MISMATCH\n\r");
+            return 0;
+        }
+        if(sd_raw_rec_byte() != 0xaa)
+        {
+            /* wrong test pattern */
+            unselect_card();
+            rprintf("SD IF COND ERR\n\r");
+            return 0;
+        }
+
+        /* card conforms to SD 2 card specification */
+        sd_raw_card_type |= (1 << SD_RAW_SPEC_2);
+    }
+    else
+    {
+        /* determine SD/MMC card type */
+        sd_raw_send_command_r1(CMD_APP, 0);
+        response = sd_raw_send_command_r1(CMD_SD_SEND_OP_COND, 0);
+        if(!(response & (1 << R1_ILL_COMMAND)))
+        {
+            /* card conforms to SD 1 card specification */
+            sd_raw_card_type |= (1 << SD_RAW_SPEC_1);
+        }
+        else
+        {
+            /* MMC card */
+        }
+    }
+
     /* wait for card to get ready */
     for(i = 0; ; ++i)
     {
-        response = sd_raw_send_command_r1(CMD_SEND_OP_COND, 0);
+        if(sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2)))
+        {
+            unsigned int arg = 0;
+            #if SD_RAW_SDHC
+                /* tell SD 2 cards that we know about high capacity cards */
+                if(sd_raw_card_type & (1 << SD_RAW_SPEC_2))
+                    arg = 0x40000000;
+            #endif
+            sd_raw_send_command_r1(CMD_APP, 0);
+            response = sd_raw_send_command_r1(CMD_SD_SEND_OP_COND, arg);
+        }
+        else
+        {
+            response = sd_raw_send_command_r1(CMD_SEND_OP_COND, 0);
+        }
+
         if(!(response & (1 << R1_IDLE_STATE)))
             break;
 
@@ -226,6 +428,26 @@ unsigned char sd_raw_init()
         }
     }
 
+    #if SD_RAW_SDHC
+        /* SD 2 cards tell whether they are high capacity ones */
+        if(sd_raw_card_type & (1 << SD_RAW_SPEC_2))
+        {
+            if(sd_raw_send_command_r1(CMD_READ_OCR, 0))
+            {
+                unselect_card();
+                rprintf("READ OCR ERR\n\r");
+                return 0;
+            }
+
+            if(sd_raw_rec_byte() & 0x40)
+                sd_raw_card_type |= (1 << SD_RAW_SPEC_SDHC);
+
+            sd_raw_rec_byte();
+            sd_raw_rec_byte();
+            sd_raw_rec_byte();
+        }
+    #endif
+
     /* set block size to 512 bytes */
     if(sd_raw_send_command_r1(CMD_SET_BLOCKLEN, 512))
     {
@@ -234,28 +456,71 @@ unsigned char sd_raw_init()
         return 0;
     }
 
+    /* ask the card for its maximum transfer rate */
+    unsigned char tran_speed = 0;
+    if(!sd_raw_read_tran_speed(&tran_speed))
+    {
+        unselect_card();
+        rprintf("CSD READ ERR\n\r");
+        return 0;
+    }
+
     /* deaddress card */
     unselect_card();
 
-    /* switch to highest SPI frequency possible */
-    S0SPCCR = 60; /* ~1MHz-- potentially can be faster */
+    /* switch to the highest SPI frequency the card allows, and
+     * slow down until a block can be read without crc errors
+     */
+    sd_raw_spi_prescaler = sd_raw_get_spi_prescaler(tran_speed);
+    while(1)
+    {
+        SD_RAW_SPI_PRESCALER = sd_raw_spi_prescaler;
+        if(sd_raw_check_clock())
+            break;
+
+        if(sd_raw_spi_prescaler >= 254)
+        {
+            rprintf("SPI CLOCK ERR\n\r");
+            return 0;
+        }
+        sd_raw_spi_prescaler += 2;
+    }
 
     #if !SD_RAW_SAVE_RAM
+        /* start with an empty cache */
+        unsigned char l;
+        for(l = 0; l < SD_RAW_CACHE_LINES; ++l)
+            raw_cache[l].flags = 0;
+        raw_cache_stamp = 0;
+        memset(raw_cache_pins, 0, sizeof(raw_cache_pins));
+        memset(&raw_cache_stats, 0, sizeof(raw_cache_stats));
+
         /* the first block is likely to be accessed first, so precache it here */
-        raw_block_address = 0xffffffff;
-        #if SD_RAW_WRITE_BUFFERING
-        raw_block_written = 1;
-    #endif
-    if(!sd_raw_read(0, raw_block, sizeof(raw_block)))
-    {
-        rprintf("sd_raw_read borks\n\r");
-        return 0;
-    }
+        if(!sd_raw_cache_get(0, 1))
+        {
+            rprintf("sd_raw_read borks\n\r");
+            return 0;
+        }
     #endif
 
+    sd_raw_init_done = 1;
+
     return 1;
 }
 
+/**
+ * \ingroup sd_raw
+ * Checks whether the card has been initialized.
+ *
+ * Lets other users of the card skip a second initialization.
+ *
+ * \returns 1 if sd_raw_init() succeeded, 0 if it did not.
+ */
+unsigned char sd_raw_initialized()
+{
+    return sd_raw_init_done;
+}
+
 /**
  * \ingroup sd_raw
  * Checks wether a memory card is located in the slot.
@@ -283,6 +548,59 @@ unsigned char sd_raw_locked()
     return get_pin_locked() == 0x00;
 }
 
+/**
+ * \ingroup sd_raw
+ * Calculates the SPI clock prescaler for a card's maximum transfer rate.
+ *
+ * Decodes the TRAN_SPEED field of the card's CSD register and returns
+ * the smallest prescaler the SPI interface accepts which does not
+ * exceed the card's rate at SD_RAW_PCLK.
+ *
+ * \param[in] tran_speed The raw TRAN_SPEED value of the card's CSD.
+ * \returns The prescaler for the SPI clock register.
+ */
+unsigned char sd_raw_get_spi_prescaler(unsigned char tran_speed)
+{
+    /* time values of TRAN_SPEED, multiplied by ten */
+    static const unsigned char time_values[16] =
+    {
+        0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+    };
+
+    /* transfer rate unit in bit/s, divided by ten */
+    unsigned long rate = 10000;
+    unsigned char i;
+    for(i = 0; i < (tran_speed & 0x07) && i < 3; ++i)
+        rate *= 10;
+    rate *= time_values[(tran_speed >> 3) & 0x0f];
+
+    if(!rate)
+        return 254;
+
+    unsigned long prescaler = (SD_RAW_PCLK + rate - 1) / rate;
+    if(prescaler < SD_RAW_SPI_PRESCALE_MIN)
+        prescaler = SD_RAW_SPI_PRESCALE_MIN;
+    if(prescaler > 254)
+        prescaler = 254;
+
+    /* the prescaler has to be even */
+    return (prescaler + 1) & ~1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Returns the SPI clock negotiated with the card by sd_raw_init().
+ *
+ * \returns The SPI clock frequency in Hz, 0 if the card is not initialized.
+ */
+unsigned long sd_raw_get_spi_clock()
+{
+    if(!sd_raw_spi_prescaler)
+        return 0;
+
+    return SD_RAW_PCLK / sd_raw_spi_prescaler;
+}
+
 /**
  * \ingroup sd_raw
  * Sends a raw byte to the memory card.
@@ -292,9 +610,16 @@ unsigned char sd_raw_locked()
  */
 void sd_raw_send_byte(unsigned char b)
 {
-    S0SPDR = b;
-    /* wait for byte to be shifted out */
-    while(!(S0SPSR & 0x80));
+    #if SD_RAW_USE_SSP
+        SSPDR = b;
+        /* wait for byte to be shifted out, and drop the byte received meanwhile */
+        while(!(SSPSR & SSPSR_RNE));
+        SSPDR;
+    #else
+        S0SPDR = b;
+        /* wait for byte to be shifted out */
+        while(!(S0SPSR & 0x80));
+    #endif
 }
 
 /**
@@ -307,10 +632,93 @@ void sd_raw_send_byte(unsigned char b)
 unsigned char sd_raw_rec_byte(void)
 {
     /* send dummy data for receiving some */
-    S0SPDR = 0xff;
-    while(!(S0SPSR & 0x80));
+    #if SD_RAW_USE_SSP
+        SSPDR = 0xff;
+        while(!(SSPSR & SSPSR_RNE));
+
+        return SSPDR;
+    #else
+        S0SPDR = 0xff;
+        while(!(S0SPSR & 0x80));
+
+        return S0SPDR;
+    #endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Sends a block of raw bytes to the memory card.
+ *
+ * With the SSP controller, the transmit FIFO is kept filled while
+ * the bytes are shifted out, so no time is lost between bytes.
+ *
+ * \param[in] buffer The bytes to send.
+ * \param[in] length The number of bytes to send.
+ * \see sd_raw_rec_block
+ */
+void sd_raw_send_block(const unsigned char* buffer, unsigned short length)
+{
+    #if SD_RAW_USE_SSP
+        unsigned short sent = 0;
+        unsigned short received = 0;
+        while(received < length)
+        {
+            /* never have more frames in flight than the receive FIFO can hold */
+            while(sent < length && sent - received < SSP_FIFO_SIZE && (SSPSR & SSPSR_TNF))
+            {
+                SSPDR = buffer[sent];
+                ++sent;
+            }
+
+            /* drop the bytes received meanwhile */
+            while(SSPSR & SSPSR_RNE)
+            {
+                SSPDR;
+                ++received;
+            }
+        }
+    #else
+        while(length-- > 0)
+            sd_raw_send_byte(*buffer++);
+    #endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Receives a block of raw bytes from the memory card.
+ *
+ * With the SSP controller, the transmit FIFO is kept filled with
+ * dummy bytes while the received bytes are collected, so no time
+ * is lost between bytes.
+ *
+ * \param[out] buffer The buffer receiving the bytes.
+ * \param[in] length The number of bytes to receive.
+ * \see sd_raw_send_block
+ */
+void sd_raw_rec_block(unsigned char* buffer, unsigned short length)
+{
+    #if SD_RAW_USE_SSP
+        unsigned short sent = 0;
+        unsigned short received = 0;
+        while(received < length)
+        {
+            /* never have more frames in flight than the receive FIFO can hold */
+            while(sent < length && sent - received < SSP_FIFO_SIZE && (SSPSR & SSPSR_TNF))
+            {
+                SSPDR = 0xff;
+                ++sent;
+            }
 
-    return S0SPDR;
+            while(SSPSR & SSPSR_RNE)
+            {
+                buffer[received] = SSPDR;
+                ++received;
+            }
+        }
+    #else
+        while(length-- > 0)
+            *buffer++ = sd_raw_rec_byte();
+    #endif
 }
 
 /**
@@ -326,16 +734,39 @@ unsigned char sd_raw_send_command_r1(unsigned char command, unsigned int arg)
     unsigned char response;
     unsigned char i;
 
+    /* a new command ends open streams */
+    if(sd_raw_write_left > 0 || sd_raw_stream_open)
+    {
+        sd_raw_write_stop();
+        sd_raw_stream_close();
+        select_card();
+    }
+
     /* wait some clock cycles */
     sd_raw_rec_byte();
 
+    /* the card only accepts commands when done with the last write */
+    if(!sd_raw_finish_write())
+        return 0xff;
+
     /* send command via SPI */
     sd_raw_send_byte(0x40 | command);
     sd_raw_send_byte((arg >> 24) & 0xff);
     sd_raw_send_byte((arg >> 16) & 0xff);
     sd_raw_send_byte((arg >> 8) & 0xff);
     sd_raw_send_byte((arg >> 0) & 0xff);
-    sd_raw_send_byte((command == CMD_GO_IDLE_STATE) ? 0x95 : 0xff);
+    switch(command)
+    {
+        case CMD_GO_IDLE_STATE:
+            sd_raw_send_byte(0x95);
+            break;
+        case CMD_SEND_IF_COND:
+            sd_raw_send_byte(0x87);
+            break;
+        default:
+            sd_raw_send_byte(0xff);
+            break;
+    }
 
     /* receive response */
     for(i = 0; i < 10; ++i)
@@ -350,134 +781,752 @@ unsigned char sd_raw_send_command_r1(unsigned char command, unsigned int arg)
 
 /**
  * \ingroup sd_raw
- * Send a command to the memory card which responses with a R2 response.
+ * Converts the offset of a block into the address argument of a data command.
  *
- * \param[in] command The command to send.
- * \param[in] arg The argument for command.
- * \returns The command answer.
+ * SDHC cards are addressed in units of blocks, all other cards in bytes.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \returns The command argument addressing the block.
  */
-/*
-unsigned short sd_raw_send_command_r2(unsigned char command, unsigned int arg)
+unsigned int sd_raw_block_arg(offset_t block_address)
 {
-    unsigned short response;
-    unsigned char i;
+    #if SD_RAW_SDHC
+        if(sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC))
+            return block_address / 512;
+    #endif
 
-    // wait some clock cycles
-    sd_raw_rec_byte();
+    return block_address;
+}
 
-    // send command via SPI
-    sd_raw_send_byte(0x40 | command);
-    sd_raw_send_byte((arg >> 24) & 0xff);
-    sd_raw_send_byte((arg >> 16) & 0xff);
-    sd_raw_send_byte((arg >> 8) & 0xff);
-    sd_raw_send_byte((arg >> 0) & 0xff);
-    sd_raw_send_byte(command == CMD_GO_IDLE_STATE ? 0x95 : 0xff);
+/**
+ * \ingroup sd_raw
+ * Updates a CRC16 checksum with another byte.
+ *
+ * Uses the CCITT polynomial x^16 + x^12 + x^5 + 1, which protects
+ * the data blocks sent by the card.
+ *
+ * \param[in] crc The checksum of the preceding bytes, 0 for the first byte.
+ * \param[in] b The byte to add to the checksum.
+ * \returns The updated checksum.
+ */
+unsigned short sd_raw_crc16(unsigned short crc, unsigned char b)
+{
+    unsigned char i;
 
-    // receive response
-    for(i = 0; i < 10; ++i)
+    crc ^= (unsigned short) b << 8;
+    for(i = 0; i < 8; ++i)
     {
-        response = sd_raw_rec_byte();
-        if(response != 0xff)
-            break;
+        if(crc & 0x8000)
+            crc = (crc << 1) ^ 0x1021;
+        else
+            crc <<= 1;
     }
-    response <<= 8;
-    response |= sd_raw_rec_byte();
 
-    return response;
+    return crc;
 }
-*/
 
 /**
  * \ingroup sd_raw
- * Reads raw data from the card.
+ * Reads the TRAN_SPEED field of the card's CSD register.
  *
- * \param[in] offset The offset from which to read.
- * \param[out] buffer The buffer into which to write the data.
- * \param[in] length The number of bytes to read.
+ * \note The card has to be selected.
+ *
+ * \param[out] tran_speed The raw TRAN_SPEED value.
  * \returns 0 on failure, 1 on success.
- * \see sd_raw_read_interval, sd_raw_write
  */
-unsigned char sd_raw_read(unsigned int offset, unsigned char* buffer, unsigned short length)
+unsigned char sd_raw_read_tran_speed(unsigned char* tran_speed)
 {
-    unsigned int block_address;
-    unsigned short block_offset;
-    unsigned short read_length;
-    while(length > 0)
-    {
-        /* determine byte count to read at once */
-        block_address = offset & 0xfffffe00;
-        block_offset = offset & 0x01ff;
-        read_length = 512 - block_offset; /* read up to block border */
-        if(read_length > length)
-            read_length = length;
-
-        #if !SD_RAW_SAVE_RAM
-            /* check if the requested data is cached */
-            if(block_address != raw_block_address)
-            #endif
-        {
-            #if SD_RAW_WRITE_BUFFERING
-                if(!raw_block_written)
-                {
-                    if(!sd_raw_write(raw_block_address, raw_block, sizeof(raw_block)))
-                        return 0;
-                }
-            #endif
-
-            /* address card */
-            select_card();
-
-            /* send single block request */
-            if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, block_address))
-            {
-                unselect_card();
-                return 0;
-            }
-
-            /* wait for data block (start byte 0xfe) */
-            while(sd_raw_rec_byte() != 0xfe);
-
-            #if SD_RAW_SAVE_RAM
-                /* read byte block */
-                unsigned short read_to = block_offset + read_length;
-                for(unsigned short i = 0; i < 512; ++i)
-                {
-                    unsigned char b = sd_raw_rec_byte();
-                    if(i >= block_offset && i < read_to)
-                        *buffer++ = b;
-                }
-            #else
-                /* read byte block */
-                unsigned char* cache = raw_block;
-                unsigned short i;
-                for(i = 0; i < 512; ++i)
-                    *cache++ = sd_raw_rec_byte();
-                raw_block_address = block_address;
-    
-                memcpy(buffer, raw_block + block_offset, read_length);
-                buffer += read_length;
-            #endif
-
-            /* read crc16 */
-            sd_raw_rec_byte();
-            sd_raw_rec_byte();
+    unsigned short i;
 
-            /* deaddress card */
-            unselect_card();
+    if(sd_raw_send_command_r1(CMD_SEND_CSD, 0))
+        return 0;
 
-            /* let card some time to finish */
-            sd_raw_rec_byte();
-        }
-        #if !SD_RAW_SAVE_RAM
-            else
-            {
-                /* use cached data */
-                memcpy(buffer, raw_block + block_offset, read_length);
-            }
-        #endif
+    /* wait for data block (start byte 0xfe) */
+    if(!sd_raw_wait_token())
+        return 0;
 
-        length -= read_length;
-        offset += read_length;
+    /* read csd and crc16 */
+    for(i = 0; i < 18; ++i)
+    {
+        unsigned char b = sd_raw_rec_byte();
+        if(i == 3)
+            *tran_speed = b;
+    }
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Checks whether the current SPI clock is usable.
+ *
+ * Reads the first block of the card and compares its content
+ * to the crc16 checksum sent by the card.
+ *
+ * \returns 1 if the block was received correctly, 0 if not.
+ */
+unsigned char sd_raw_check_clock()
+{
+    unsigned short crc = 0;
+    unsigned short i;
+
+    /* address card */
+    select_card();
+
+    /* send single block request */
+    if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, 0))
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* wait for data block (start byte 0xfe) */
+    if(!sd_raw_wait_token())
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* read byte block */
+    for(i = 0; i < 512; ++i)
+        crc = sd_raw_crc16(crc, sd_raw_rec_byte());
+
+    /* read crc16 */
+    i = (unsigned short) sd_raw_rec_byte() << 8;
+    i |= sd_raw_rec_byte();
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+
+    return crc == i;
+}
+
+/**
+ * \ingroup sd_raw
+ * Waits a limited time for the start block token.
+ *
+ * Receives up to \c max_bytes bytes from the card until the start
+ * block token arrives. The card has to be selected.
+ *
+ * \param[in] max_bytes The maximum number of bytes to receive.
+ * \returns SD_RAW_READ_DONE if the data block follows, SD_RAW_READ_BUSY
+ *          if the card is still busy, SD_RAW_READ_FAILED if the card
+ *          sent an error token instead.
+ */
+unsigned char sd_raw_poll_token(unsigned short max_bytes)
+{
+    while(max_bytes-- > 0)
+    {
+        unsigned char b = sd_raw_rec_byte();
+        if(b == TOKEN_START_BLOCK)
+            return SD_RAW_READ_DONE;
+        if(b != 0xff)
+            return SD_RAW_READ_FAILED;
+    }
+
+    return SD_RAW_READ_BUSY;
+}
+
+/**
+ * \ingroup sd_raw
+ * Waits for the start block token.
+ *
+ * \returns 1 if the data block follows, 0 on an error token or timeout.
+ */
+unsigned char sd_raw_wait_token(void)
+{
+    unsigned long waited;
+    for(waited = 0; waited < SD_RAW_READ_TIMEOUT; waited += SD_RAW_READ_POLL_BYTES)
+    {
+        unsigned char result = sd_raw_poll_token(SD_RAW_READ_POLL_BYTES);
+        if(result != SD_RAW_READ_BUSY)
+            return result == SD_RAW_READ_DONE;
+    }
+
+    return 0;
+}
+
+/**
+ * \ingroup sd_raw
+ * Waits while the card signals busy.
+ *
+ * \returns 1 if the card is ready, 0 on timeout.
+ */
+unsigned char sd_raw_wait_ready(void)
+{
+    unsigned long i;
+    for(i = 0; i < SD_RAW_BUSY_TIMEOUT; ++i)
+    {
+        if(sd_raw_rec_byte() == 0xff)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * \ingroup sd_raw
+ * Waits until the card has programmed the last written block.
+ *
+ * Writes return as soon as the card has accepted the data, so the
+ * programming time is only waited for when the card is needed again.
+ * The card has to be selected.
+ *
+ * \returns 1 if the card is ready, 0 on timeout.
+ */
+unsigned char sd_raw_finish_write(void)
+{
+    if(!sd_raw_programming)
+        return 1;
+
+    sd_raw_programming = 0;
+    return sd_raw_wait_ready();
+}
+
+/**
+ * \ingroup sd_raw
+ * Terminates a multiple block read.
+ *
+ * Sends CMD_STOP_TRANSMISSION while the card is streaming data blocks,
+ * skips the stuff byte following the command and waits until the card
+ * releases its busy signal.
+ */
+void sd_raw_stop_transmission(void)
+{
+    unsigned char i;
+
+    sd_raw_send_byte(0x40 | CMD_STOP_TRANSMISSION);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0x00);
+    sd_raw_send_byte(0xff);
+
+    /* the byte following the command is a stuff byte */
+    sd_raw_rec_byte();
+
+    /* receive response */
+    for(i = 0; i < 10; ++i)
+    {
+        if(sd_raw_rec_byte() != 0xff)
+            break;
+    }
+
+    /* wait while card is busy */
+    sd_raw_wait_ready();
+}
+
+/**
+ * \ingroup sd_raw
+ * Receives a data block whose start token has just arrived.
+ *
+ * Reads the 512 bytes of the block and its crc16, then deselects the card.
+ *
+ * \param[out] buffer The buffer receiving the 512 bytes of the block.
+ * \returns 1.
+ */
+unsigned char sd_raw_finish_read(unsigned char* buffer)
+{
+    /* read byte block */
+    sd_raw_rec_block(buffer, 512);
+
+    /* read crc16 */
+    sd_raw_rec_byte();
+    sd_raw_rec_byte();
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Reads the next block of a multiple block read.
+ *
+ * Continues the open multiple block read if it delivers the requested
+ * block next, otherwise a new one is started there. The stream is left
+ * open afterwards, so the card already prepares the following block.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \param[out] buffer The buffer receiving the 512 bytes of the block.
+ * \returns 0 on failure, 1 on success.
+ */
+unsigned char sd_raw_stream_read(offset_t block_address, unsigned char* buffer)
+{
+    if(!sd_raw_stream_open || sd_raw_stream_address != block_address)
+    {
+        /* address card */
+        select_card();
+
+        /* send multiple block request, this also ends an open stream */
+        if(sd_raw_send_command_r1(CMD_READ_MULTIPLE_BLOCK, sd_raw_block_arg(block_address)))
+        {
+            unselect_card();
+            return 0;
+        }
+
+        sd_raw_stream_open = 1;
+        sd_raw_stream_address = block_address;
+    }
+
+    /* wait for data block (start byte 0xfe) */
+    if(!sd_raw_wait_token())
+    {
+        sd_raw_stream_close();
+        return 0;
+    }
+
+    /* read byte block */
+    sd_raw_rec_block(buffer, 512);
+
+    /* read crc16 */
+    sd_raw_rec_byte();
+    sd_raw_rec_byte();
+
+    sd_raw_stream_address += 512;
+    sd_raw_seq_next = sd_raw_stream_address;
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Ends an open multiple block read.
+ *
+ * Nothing is done if no multiple block read is open.
+ */
+void sd_raw_stream_close(void)
+{
+    if(!sd_raw_stream_open)
+        return;
+    sd_raw_stream_open = 0;
+
+    /* end the data stream */
+    sd_raw_stop_transmission();
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+}
+
+#if !SD_RAW_SAVE_RAM
+/**
+ * \ingroup sd_raw
+ * Reads a single block from the card.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \param[out] buffer The buffer receiving the 512 bytes of the block.
+ * \returns 0 on failure, 1 on success.
+ */
+unsigned char sd_raw_read_block(offset_t block_address, unsigned char* buffer)
+{
+    /* address card */
+    select_card();
+
+    /* send single block request */
+    if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, sd_raw_block_arg(block_address)))
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* wait for data block (start byte 0xfe) */
+    if(!sd_raw_wait_token())
+    {
+        unselect_card();
+        return 0;
+    }
+
+    sd_raw_seq_next = block_address + 512;
+
+    return sd_raw_finish_read(buffer);
+}
+
+#if SD_RAW_WRITE_SUPPORT
+/**
+ * \ingroup sd_raw
+ * Writes a single block to the card.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \param[in] buffer The buffer containing the 512 bytes of the block.
+ * \returns 0 on failure, 1 on success.
+ */
+unsigned char sd_raw_write_block(offset_t block_address, const unsigned char* buffer)
+{
+    /* address card */
+    select_card();
+
+    /* send single block request */
+    if(sd_raw_send_command_r1(CMD_WRITE_SINGLE_BLOCK, sd_raw_block_arg(block_address)))
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* send start byte */
+    sd_raw_send_byte(0xfe);
+
+    /* write byte block */
+    sd_raw_send_block(buffer, 512);
+
+    /* write dummy crc16 */
+    sd_raw_send_byte(0xff);
+    sd_raw_send_byte(0xff);
+
+    /* check the data response, the card then programs the block on its own */
+    unsigned char response = sd_raw_rec_byte() & 0x1f;
+    sd_raw_programming = 1;
+
+    /* deaddress card */
+    unselect_card();
+
+    return response == DR_STATUS_ACCEPTED;
+}
+#endif
+
+/**
+ * \ingroup sd_raw
+ * Looks up a block in the cache.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \returns The cache line holding the block, or 0 if it is not cached.
+ */
+struct sd_raw_cache_line* sd_raw_cache_find(offset_t block_address)
+{
+    unsigned char i;
+    for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+    {
+        struct sd_raw_cache_line* line = &raw_cache[i];
+        if((line->flags & SD_RAW_CACHE_VALID) && line->address == block_address)
+            return line;
+    }
+
+    return 0;
+}
+
+/**
+ * \ingroup sd_raw
+ * Returns the cache line for a block, loading it into the cache if needed.
+ *
+ * On a miss, an empty line is used if there is one. Otherwise the least
+ * recently used line is replaced, after writing back its content if it
+ * was modified. Lines holding blocks of pinned areas are only replaced
+ * by other pinned blocks, unless SD_RAW_CACHE_PINNED_LINES are in use.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \param[in] load Whether the block's content has to be read from the card on a miss.
+ *                 Pass 0 if the caller overwrites the whole block anyway.
+ * \returns The cache line holding the block, or 0 on failure.
+ */
+struct sd_raw_cache_line* sd_raw_cache_get(offset_t block_address, unsigned char load)
+{
+    struct sd_raw_cache_line* line = sd_raw_cache_find(block_address);
+    if(line)
+    {
+        ++raw_cache_stats.hits;
+        if(line->flags & SD_RAW_CACHE_PREFETCHED)
+        {
+            ++raw_cache_stats.prefetch_hits;
+            line->flags &= ~SD_RAW_CACHE_PREFETCHED;
+        }
+        line->stamp = ++raw_cache_stamp;
+        return line;
+    }
+
+    ++raw_cache_stats.misses;
+
+    /* choose the line to replace */
+    unsigned char pinned = sd_raw_cache_is_pinned(block_address);
+    unsigned char pinned_count = 0;
+    struct sd_raw_cache_line* lru = 0;
+    struct sd_raw_cache_line* lru_pinned = 0;
+    unsigned char i;
+    for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+    {
+        line = &raw_cache[i];
+        if(!(line->flags & SD_RAW_CACHE_VALID))
+            break;
+
+        if(line->flags & SD_RAW_CACHE_PINNED)
+        {
+            ++pinned_count;
+            if(!lru_pinned || line->stamp < lru_pinned->stamp)
+                lru_pinned = line;
+        }
+        else if(!lru || line->stamp < lru->stamp)
+        {
+            lru = line;
+        }
+    }
+    if(i == SD_RAW_CACHE_LINES)
+    {
+        if(!lru || (pinned && pinned_count >= SD_RAW_CACHE_PINNED_LINES))
+            line = lru_pinned;
+        else
+            line = lru;
+
+        if(!sd_raw_cache_flush_line(line))
+            return 0;
+
+        if(line->flags & SD_RAW_CACHE_PREFETCHED)
+            ++raw_cache_stats.prefetch_wasted;
+    }
+
+    line->flags = 0;
+    if(load)
+    {
+        /* sequential reads are continued with a multiple block read */
+        unsigned char sequential = (block_address == sd_raw_seq_next);
+        if(sequential)
+        {
+            if(!sd_raw_stream_read(block_address, line->data))
+                return 0;
+        }
+        else if(!sd_raw_read_block(block_address, line->data))
+        {
+            return 0;
+        }
+
+        line->address = block_address;
+        line->stamp = ++raw_cache_stamp;
+        line->flags = SD_RAW_CACHE_VALID | (pinned ? SD_RAW_CACHE_PINNED : 0);
+
+        #if SD_RAW_READ_AHEAD
+            if(sequential)
+                sd_raw_cache_prefetch(line);
+        #endif
+
+        return line;
+    }
+
+    line->address = block_address;
+    line->stamp = ++raw_cache_stamp;
+    line->flags = SD_RAW_CACHE_VALID | (pinned ? SD_RAW_CACHE_PINNED : 0);
+
+    return line;
+}
+
+#if SD_RAW_READ_AHEAD
+/**
+ * \ingroup sd_raw
+ * Reads ahead of a sequential access.
+ *
+ * Receives up to SD_RAW_READ_AHEAD blocks from the open multiple block
+ * read into cache lines holding neither pinned nor modified blocks.
+ * Stops at the first block which is cached already or belongs to a
+ * pinned area.
+ *
+ * \param[in] keep The line just loaded, which must not be replaced.
+ */
+void sd_raw_cache_prefetch(const struct sd_raw_cache_line* keep)
+{
+    /* lines newer than this were prefetched by this call */
+    unsigned int round = raw_cache_stamp;
+    unsigned char n;
+    for(n = 0; n < SD_RAW_READ_AHEAD && sd_raw_stream_open; ++n)
+    {
+        offset_t block_address = sd_raw_stream_address;
+        if(sd_raw_cache_find(block_address) || sd_raw_cache_is_pinned(block_address))
+            return;
+
+        /* choose a clean, unpinned line, preferring unused ones */
+        struct sd_raw_cache_line* victim = 0;
+        unsigned char i;
+        for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+        {
+            struct sd_raw_cache_line* line = &raw_cache[i];
+            if(!(line->flags & SD_RAW_CACHE_VALID))
+            {
+                victim = line;
+                break;
+            }
+            if(line == keep || line->stamp > round ||
+               (line->flags & (SD_RAW_CACHE_PINNED | SD_RAW_CACHE_DIRTY)))
+                continue;
+            if(!victim || line->stamp < victim->stamp)
+                victim = line;
+        }
+        if(!victim)
+            return;
+
+        if(victim->flags & SD_RAW_CACHE_PREFETCHED)
+            ++raw_cache_stats.prefetch_wasted;
+
+        victim->flags = 0;
+        if(!sd_raw_stream_read(block_address, victim->data))
+            return;
+
+        victim->address = block_address;
+        victim->stamp = ++raw_cache_stamp;
+        victim->flags = SD_RAW_CACHE_VALID | SD_RAW_CACHE_PREFETCHED;
+    }
+}
+#endif
+
+/**
+ * \ingroup sd_raw
+ * Writes a cache line back to the card if it was modified.
+ *
+ * \param[in] line The cache line to write back.
+ * \returns 0 on failure, 1 on success.
+ */
+unsigned char sd_raw_cache_flush_line(struct sd_raw_cache_line* line)
+{
+    #if SD_RAW_WRITE_SUPPORT
+        if(!(line->flags & SD_RAW_CACHE_DIRTY))
+            return 1;
+
+        if(!sd_raw_write_block(line->address, line->data))
+            return 0;
+
+        line->flags &= ~SD_RAW_CACHE_DIRTY;
+        ++raw_cache_stats.writebacks;
+    #endif
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Checks whether a block lies within one of the pinned areas.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \returns 1 if the block is pinned, 0 if it is not.
+ */
+unsigned char sd_raw_cache_is_pinned(offset_t block_address)
+{
+    unsigned char i;
+    for(i = 0; i < SD_RAW_CACHE_PIN_AREAS; ++i)
+    {
+        const struct sd_raw_cache_area* area = &raw_cache_pins[i];
+        if(block_address >= area->offset && block_address - area->offset < area->length)
+            return 1;
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * \ingroup sd_raw
+ * Send a command to the memory card which responses with a R2 response.
+ *
+ * \param[in] command The command to send.
+ * \param[in] arg The argument for command.
+ * \returns The command answer.
+ */
+/*
+unsigned short sd_raw_send_command_r2(unsigned char command, unsigned int arg)
+{
+    unsigned short response;
+    unsigned char i;
+
+    // wait some clock cycles
+    sd_raw_rec_byte();
+
+    // send command via SPI
+    sd_raw_send_byte(0x40 | command);
+    sd_raw_send_byte((arg >> 24) & 0xff);
+    sd_raw_send_byte((arg >> 16) & 0xff);
+    sd_raw_send_byte((arg >> 8) & 0xff);
+    sd_raw_send_byte((arg >> 0) & 0xff);
+    sd_raw_send_byte(command == CMD_GO_IDLE_STATE ? 0x95 : 0xff);
+
+    // receive response
+    for(i = 0; i < 10; ++i)
+    {
+        response = sd_raw_rec_byte();
+        if(response != 0xff)
+            break;
+    }
+    response <<= 8;
+    response |= sd_raw_rec_byte();
+
+    return response;
+}
+*/
+
+/**
+ * \ingroup sd_raw
+ * Reads raw data from the card.
+ *
+ * \param[in] offset The offset from which to read.
+ * \param[out] buffer The buffer into which to write the data.
+ * \param[in] length The number of bytes to read.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_read_interval, sd_raw_write
+ */
+unsigned char sd_raw_read(offset_t offset, unsigned char* buffer, unsigned short length)
+{
+    offset_t block_address;
+    unsigned short block_offset;
+    unsigned short read_length;
+    while(length > 0)
+    {
+        /* determine byte count to read at once */
+        block_address = offset & ~((offset_t) 0x1ff);
+        block_offset = offset & 0x01ff;
+        read_length = 512 - block_offset; /* read up to block border */
+        if(read_length > length)
+            read_length = length;
+
+        #if SD_RAW_SAVE_RAM
+            /* address card */
+            select_card();
+
+            /* send single block request */
+            if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, sd_raw_block_arg(block_address)))
+            {
+                unselect_card();
+                return 0;
+            }
+
+            /* wait for data block (start byte 0xfe) */
+            if(!sd_raw_wait_token())
+            {
+                unselect_card();
+                return 0;
+            }
+
+            /* read byte block */
+            unsigned short read_to = block_offset + read_length;
+            for(unsigned short i = 0; i < 512; ++i)
+            {
+                unsigned char b = sd_raw_rec_byte();
+                if(i >= block_offset && i < read_to)
+                    *buffer++ = b;
+            }
+
+            /* read crc16 */
+            sd_raw_rec_byte();
+            sd_raw_rec_byte();
+
+            /* deaddress card */
+            unselect_card();
+
+            /* let card some time to finish */
+            sd_raw_rec_byte();
+        #else
+            /* get the block from the cache, loading it if needed */
+            struct sd_raw_cache_line* line = sd_raw_cache_get(block_address, 1);
+            if(!line)
+                return 0;
+
+            memcpy(buffer, line->data + block_offset, read_length);
+            buffer += read_length;
+        #endif
+
+        length -= read_length;
+        offset += read_length;
     }
 
     return 1;
@@ -507,7 +1556,7 @@ unsigned char sd_raw_read(unsigned int offset, unsigned char* buffer, unsigned s
  * \returns 0 on failure, 1 on success
  * \see sd_raw_read, sd_raw_write
  */
-unsigned char sd_raw_read_interval(unsigned int offset, unsigned char* buffer, unsigned short interval, unsigned short length, sd_raw_interval_handler callback, void* p)
+unsigned char sd_raw_read_interval(offset_t offset, unsigned char* buffer, unsigned short interval, unsigned short length, sd_raw_interval_handler callback, void* p)
 {
     if(!buffer || interval == 0 || length < interval || !callback)
         return 0;
@@ -542,65 +1591,317 @@ unsigned char sd_raw_read_interval(unsigned int offset, unsigned char* buffer, u
             read_length = 512 - block_offset;
     
             /* send single block request */
-            if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, offset & 0xfffffe00))
+            if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, sd_raw_block_arg(offset & ~((offset_t) 0x1ff))))
             {
                 unselect_card();
                 return 0;
             }
     
             /* wait for data block (start byte 0xfe) */
-            while(sd_raw_rec_byte() != 0xfe);
+            if(!sd_raw_wait_token())
+            {
+                unselect_card();
+                return 0;
+            }
+            unsigned short i;
+            /* read up to the data of interest */
+            for(i = 0; i < block_offset; ++i)
+                sd_raw_rec_byte();
+    
+            /* read interval bytes of data and execute the callback */
+            do
+            {
+                if(read_length < interval || length < interval)
+                    break;
+    
+                buffer_cur = buffer;
+                for(i = 0; i < interval; ++i)
+                    *buffer_cur++ = sd_raw_rec_byte();
+    
+                if(!callback(buffer, offset + (512 - read_length), p))
+                {
+                    finished = 1;
+                    break;
+                }
+    
+                read_length -= interval;
+                length -= interval;
+    
+            }
+            while(read_length > 0 && length > 0);
+    
+            /* read rest of data block */
+            while(read_length-- > 0)
+                sd_raw_rec_byte();
+    
+            /* read crc16 */
+            sd_raw_rec_byte();
+            sd_raw_rec_byte();
+    
+            if(length < interval)
+                break;
+    
+            offset = (offset & ~((offset_t) 0x1ff)) + 512;
+    
+        }
+        while(!finished);
+    
+        /* deaddress card */
+        unselect_card();
+    
+        /* let card some time to finish */
+        sd_raw_rec_byte();
+    
+        return 1;
+    #endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Streams consecutive blocks from the card.
+ *
+ * Reads \c count blocks of 512 bytes, starting at the block which
+ * contains \c offset, with a single multiple block read command.
+ * This avoids the command and token overhead sd_raw_read() pays
+ * for each block. The read is left open afterwards, so a following
+ * call for the next blocks continues it. The cache is bypassed,
+ * except that modified blocks are taken from it.
+ *
+ * If \c callback is given, every block is received into \c buffer,
+ * which has to be at least 512 bytes in size, and handed to the
+ * callback together with its offset on the card. By returning zero,
+ * the callback may stop reading. Without a callback, the blocks are
+ * placed one after another into \c buffer, which then has to hold
+ * \c count * 512 bytes.
+ *
+ * \note Within the callback function, you can not start another read or
+ *       write operation.
+ *
+ * \param[in] offset The offset of the first block to read, rounded down to a block border.
+ * \param[out] buffer The buffer into which to write the data.
+ * \param[in] count The number of blocks to read.
+ * \param[in] callback The function to call for every block, or 0.
+ * \param[in] p An opaque pointer directly passed to the callback function.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_read, sd_raw_read_interval
+ */
+unsigned char sd_raw_read_blocks(offset_t offset, unsigned char* buffer, unsigned short count, sd_raw_interval_handler callback, void* p)
+{
+    if(!buffer || count == 0)
+        return 0;
+
+    offset_t block_address = offset & ~((offset_t) 0x1ff);
+
+    unsigned char* cache = buffer;
+    while(count > 0)
+    {
+        if(!sd_raw_stream_read(block_address, cache))
+            return 0;
+
+        #if !SD_RAW_SAVE_RAM
+            /* a modified block in the cache is newer than the card's copy */
+            struct sd_raw_cache_line* line = sd_raw_cache_find(block_address);
+            if(line && (line->flags & SD_RAW_CACHE_DIRTY))
+                memcpy(cache, line->data, 512);
+        #endif
+
+        --count;
+
+        if(callback)
+        {
+            if(!callback(cache, block_address, p))
+                break;
+        }
+        else
+        {
+            cache += 512;
+        }
+
+        block_address += 512;
+    }
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Starts reading a block without waiting for the card.
+ *
+ * Sends the read command for the block containing \c offset and
+ * returns immediately. The block is then fetched by calling
+ * sd_raw_read_poll() until it no longer returns SD_RAW_READ_BUSY,
+ * which leaves the CPU free for other work during the card's
+ * access time.
+ *
+ * \note Until the read is completed or aborted with sd_raw_read_abort(),
+ *       no other card access may take place.
+ *
+ * \param[in] offset The offset of the block to read, rounded down to a block border.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_read_poll, sd_raw_read_abort
+ */
+unsigned char sd_raw_read_start(offset_t offset)
+{
+    sd_raw_read_abort();
+
+    sd_raw_read_address = offset & ~((offset_t) 0x1ff);
+    sd_raw_read_waited = 0;
+
+    #if !SD_RAW_SAVE_RAM
+        /* a cached block does not need the card at all */
+        if(sd_raw_cache_find(sd_raw_read_address))
+        {
+            sd_raw_read_state = SD_RAW_READ_CACHED;
+            return 1;
+        }
+    #endif
+
+    /* sequential reads are continued with a multiple block read */
+    if(sd_raw_read_address == sd_raw_seq_next)
+    {
+        if(!sd_raw_stream_open || sd_raw_stream_address != sd_raw_read_address)
+        {
+            /* address card */
+            select_card();
+
+            /* send multiple block request */
+            if(sd_raw_send_command_r1(CMD_READ_MULTIPLE_BLOCK, sd_raw_block_arg(sd_raw_read_address)))
+            {
+                unselect_card();
+                return 0;
+            }
+
+            sd_raw_stream_open = 1;
+            sd_raw_stream_address = sd_raw_read_address;
+        }
+
+        sd_raw_read_state = SD_RAW_READ_STREAM;
+        return 1;
+    }
+
+    /* address card */
+    select_card();
+
+    /* send single block request */
+    if(sd_raw_send_command_r1(CMD_READ_SINGLE_BLOCK, sd_raw_block_arg(sd_raw_read_address)))
+    {
+        unselect_card();
+        return 0;
+    }
+
+    sd_raw_read_state = SD_RAW_READ_CARD;
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Continues the read started by sd_raw_read_start().
+ *
+ * Each call checks the card for a limited number of bytes only. Once
+ * the data block arrives, it is received into \c buffer.
+ *
+ * \param[out] buffer The buffer receiving the 512 bytes of the block.
+ * \returns SD_RAW_READ_DONE when the block has been read, SD_RAW_READ_BUSY
+ *          while the card is still busy, SD_RAW_READ_FAILED on errors,
+ *          timeouts or if no read was started.
+ * \see sd_raw_read_start, sd_raw_read_abort
+ */
+unsigned char sd_raw_read_poll(unsigned char* buffer)
+{
+    if(!buffer)
+        return SD_RAW_READ_FAILED;
+
+    #if !SD_RAW_SAVE_RAM
+        if(sd_raw_read_state == SD_RAW_READ_CACHED)
+        {
+            sd_raw_read_state = SD_RAW_READ_IDLE;
+
+            struct sd_raw_cache_line* line = sd_raw_cache_get(sd_raw_read_address, 1);
+            if(!line)
+                return SD_RAW_READ_FAILED;
+
+            memcpy(buffer, line->data, 512);
+            return SD_RAW_READ_DONE;
+        }
+    #endif
+
+    if(sd_raw_read_state != SD_RAW_READ_CARD && sd_raw_read_state != SD_RAW_READ_STREAM)
+        return SD_RAW_READ_FAILED;
+
+    unsigned char result = sd_raw_poll_token(SD_RAW_READ_POLL_BYTES);
+    sd_raw_read_waited += SD_RAW_READ_POLL_BYTES;
+    if(result == SD_RAW_READ_BUSY && sd_raw_read_waited < SD_RAW_READ_TIMEOUT)
+        return SD_RAW_READ_BUSY;
+
+    unsigned char stream = (sd_raw_read_state == SD_RAW_READ_STREAM);
+    sd_raw_read_state = SD_RAW_READ_IDLE;
+
+    if(result != SD_RAW_READ_DONE)
+    {
+        if(stream)
+            sd_raw_stream_close();
+        else
+            unselect_card();
+        return SD_RAW_READ_FAILED;
+    }
+
+    if(stream)
+    {
+        /* read byte block, the stream stays open for the next one */
+        sd_raw_rec_block(buffer, 512);
+
+        /* read crc16 */
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+
+        sd_raw_stream_address += 512;
+    }
+    else
+    {
+        sd_raw_finish_read(buffer);
+    }
+    sd_raw_seq_next = sd_raw_read_address + 512;
+
+    #if !SD_RAW_SAVE_RAM
+        /* a modified block in the cache is newer than the card's copy */
+        struct sd_raw_cache_line* line = sd_raw_cache_find(sd_raw_read_address);
+        if(line && (line->flags & SD_RAW_CACHE_DIRTY))
+            memcpy(buffer, line->data, 512);
+    #endif
+
+    return SD_RAW_READ_DONE;
+}
+
+/**
+ * \ingroup sd_raw
+ * Abandons the read started by sd_raw_read_start().
+ *
+ * If the card is still working on the read, the data block is
+ * awaited and dropped, so the card is ready for the next command.
+ *
+ * \see sd_raw_read_start, sd_raw_read_poll
+ */
+void sd_raw_read_abort()
+{
+    if(sd_raw_read_state == SD_RAW_READ_CARD)
+    {
+        if(sd_raw_wait_token())
+        {
             unsigned short i;
-            /* read up to the data of interest */
-            for(i = 0; i < block_offset; ++i)
-                sd_raw_rec_byte();
-    
-            /* read interval bytes of data and execute the callback */
-            do
-            {
-                if(read_length < interval || length < interval)
-                    break;
-    
-                buffer_cur = buffer;
-                for(i = 0; i < interval; ++i)
-                    *buffer_cur++ = sd_raw_rec_byte();
-    
-                if(!callback(buffer, offset + (512 - read_length), p))
-                {
-                    finished = 1;
-                    break;
-                }
-    
-                read_length -= interval;
-                length -= interval;
-    
-            }
-            while(read_length > 0 && length > 0);
-    
-            /* read rest of data block */
-            while(read_length-- > 0)
+            for(i = 0; i < 512 + 2; ++i)
                 sd_raw_rec_byte();
-    
-            /* read crc16 */
-            sd_raw_rec_byte();
-            sd_raw_rec_byte();
-    
-            if(length < interval)
-                break;
-    
-            offset = (offset & 0xfffffe00) + 512;
-    
         }
-        while(!finished);
-    
-        /* deaddress card */
+
         unselect_card();
-    
-        /* let card some time to finish */
         sd_raw_rec_byte();
-    
-        return 1;
-    #endif
+    }
+    else if(sd_raw_read_state == SD_RAW_READ_STREAM)
+    {
+        sd_raw_stream_close();
+    }
+
+    sd_raw_read_state = SD_RAW_READ_IDLE;
 }
 
 /**
@@ -617,104 +1918,283 @@ unsigned char sd_raw_read_interval(unsigned int offset, unsigned char* buffer, u
  * \returns 0 on failure, 1 on success.
  * \see sd_raw_read
  */
-unsigned char sd_raw_write(unsigned int offset, const unsigned char* buffer, unsigned short length)
+unsigned char sd_raw_write(offset_t offset, const unsigned char* buffer, unsigned short length)
 {
     #if SD_RAW_WRITE_SUPPORT
     
         if(get_pin_locked())
             return 0;
     
-        unsigned int block_address;
+        offset_t block_address;
         unsigned short block_offset;
         unsigned short write_length;
         while(length > 0)
         {
             /* determine byte count to write at once */
-            block_address = offset & 0xfffffe00;
+            block_address = offset & ~((offset_t) 0x1ff);
             block_offset = offset & 0x01ff;
             write_length = 512 - block_offset; /* write up to block border */
             if(write_length > length)
                 write_length = length;
-    
-            /* Merge the data to write with the content of the block.
-                     * Use the cached block if available.
-                     */
-            if(block_address != raw_block_address)
-            {
-                #if SD_RAW_WRITE_BUFFERING
-                if(!raw_block_written)
-                {
-                    if(!sd_raw_write(raw_block_address, raw_block, sizeof(raw_block)))
-                        return 0;
-                }
-            #endif
 
-            if(block_offset || write_length < 512)
+            /* Runs of whole blocks go to the card with a single
+             * multiple block write instead of one command per block.
+             */
+            if(block_offset == 0 && length >= 1024)
             {
-                if(!sd_raw_read(block_address, raw_block, sizeof(raw_block)))
+                unsigned short count = length / 512;
+                if(!sd_raw_write_blocks(offset, buffer, count))
                     return 0;
+
+                buffer += (unsigned int) count * 512;
+                offset += (unsigned int) count * 512;
+                length -= count * 512;
+                continue;
             }
-            raw_block_address = block_address;
-        }
+    
+            /* Merge the data to write with the content of the block.
+             * The block only has to be read from the card if it is
+             * written partially and not cached yet.
+             */
+            struct sd_raw_cache_line* line = sd_raw_cache_get(block_address, block_offset || write_length < 512);
+            if(!line)
+                return 0;
 
-        if(buffer != raw_block)
-        {
-            memcpy(raw_block + block_offset, buffer, write_length);
+            memcpy(line->data + block_offset, buffer, write_length);
+            line->flags |= SD_RAW_CACHE_DIRTY;
 
-            #if SD_RAW_WRITE_BUFFERING
-                raw_block_written = 0;
-    
-                if(length == write_length)
-                    return 1;
+            #if !SD_RAW_WRITE_BUFFERING
+                if(!sd_raw_cache_flush_line(line))
+                    return 0;
             #endif
+
+            buffer += write_length;
+            length -= write_length;
+            offset += write_length;
         }
 
-        buffer += write_length;
+        return 1;
+    #else
+        return 0;
+    #endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Writes consecutive blocks to the card.
+ *
+ * Writes \c count blocks of 512 bytes, starting at the block which
+ * contains \c offset, with a single multiple block write command.
+ * The card is told the number of blocks in advance, so it can
+ * pre-erase them, and it only has to be waited for between blocks
+ * instead of after a complete single block write cycle.
+ *
+ * The blocks bypass the write buffer. If the buffered block is
+ * among them, it is replaced by the new data.
+ *
+ * \param[in] offset The offset of the first block to write, rounded down to a block border.
+ * \param[in] buffer The buffer containing \c count * 512 bytes of data.
+ * \param[in] count The number of blocks to write.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_write, sd_raw_write_start, sd_raw_read_blocks
+ */
+unsigned char sd_raw_write_blocks(offset_t offset, const unsigned char* buffer, unsigned short count)
+{
+    if(!buffer)
+        return 0;
+
+    if(!sd_raw_write_start(offset, count))
+        return 0;
+
+    while(count-- > 0)
+    {
+        if(!sd_raw_write_next(offset, buffer))
+            return 0;
+        offset += 512;
+        buffer += 512;
+    }
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Opens a stream of consecutive block writes.
+ *
+ * Announces \c count blocks starting at the block which contains
+ * \c offset. The blocks are then handed over one at a time with
+ * sd_raw_write_next(), the stream is closed after the last one.
+ * In between, the caller is free to do other work, for example
+ * to receive the next block.
+ *
+ * A single block is written with a single block write command
+ * when it arrives, larger counts use a multiple block write command.
+ *
+ * \note Any other card access closes an open stream.
+ *
+ * \param[in] offset The offset of the first block to write, rounded down to a block border.
+ * \param[in] count The number of blocks to write.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_write_next, sd_raw_write_stop, sd_raw_write_blocks
+ */
+unsigned char sd_raw_write_start(offset_t offset, unsigned short count)
+{
+    #if SD_RAW_WRITE_SUPPORT
+
+        if(get_pin_locked() || count == 0)
+            return 0;
+
+        sd_raw_read_abort();
+        sd_raw_write_stop();
+
+        sd_raw_write_address = offset & ~((offset_t) 0x1ff);
+
+        if(count == 1)
+        {
+            sd_raw_write_single = 1;
+            return 1;
+        }
 
         /* address card */
         select_card();
 
-        /* send single block request */
-        if(sd_raw_send_command_r1(CMD_WRITE_SINGLE_BLOCK, block_address))
+        /* announce the number of blocks, cards not knowing ACMD23 just ignore it */
+        if(!sd_raw_send_command_r1(CMD_APP, 0))
+            sd_raw_send_command_r1(CMD_SET_WR_BLK_ERASE_COUNT, count);
+
+        /* send multiple block request */
+        if(sd_raw_send_command_r1(CMD_WRITE_MULTIPLE_BLOCK, sd_raw_block_arg(sd_raw_write_address)))
         {
             unselect_card();
             return 0;
         }
 
-        /* send start byte */
-        sd_raw_send_byte(0xfe);
+        /* the card stays selected until the stream is closed */
+        sd_raw_write_left = count;
 
-        /* write byte block */
-        unsigned char* cache = raw_block;
-        unsigned short i;
-        for(i = 0; i < 512; ++i)
-            sd_raw_send_byte(*cache++);
+        return 1;
+    #else
+        return 0;
+    #endif
+}
 
-        /* write dummy crc16 */
-        sd_raw_send_byte(0xff);
-        sd_raw_send_byte(0xff);
+/**
+ * \ingroup sd_raw
+ * Writes the next block of the stream opened with sd_raw_write_start().
+ *
+ * Returns as soon as the card has accepted the block. A cached copy
+ * of the block is replaced by the new data.
+ *
+ * If \c offset is not within the block the stream continues with,
+ * nothing is written and the stream is left open.
+ *
+ * \param[in] offset The offset of the block to write, rounded down to a block border.
+ * \param[in] buffer The buffer containing the 512 bytes of the block.
+ * \returns 0 on failure, if no stream is open or if the stream continues elsewhere, 1 on success.
+ * \see sd_raw_write_start, sd_raw_write_stop
+ */
+unsigned char sd_raw_write_next(offset_t offset, const unsigned char* buffer)
+{
+    #if SD_RAW_WRITE_SUPPORT
 
-        /* wait while card is busy */
-        while(sd_raw_rec_byte() != 0xff);
-        sd_raw_rec_byte();
+        if(!buffer)
+            return 0;
 
-        /* deaddress card */
-        unselect_card();
+        if((offset & ~((offset_t) 0x1ff)) != sd_raw_write_address)
+            return 0;
 
-        length -= write_length;
-        offset += write_length;
+        unsigned char response;
+        if(sd_raw_write_single)
+        {
+            sd_raw_write_single = 0;
+            response = sd_raw_write_block(sd_raw_write_address, buffer) ? DR_STATUS_ACCEPTED : 0;
+        }
+        else if(sd_raw_write_left > 0)
+        {
+            /* the card has to be done with the previous block */
+            if(!sd_raw_finish_write())
+            {
+                sd_raw_write_stop();
+                return 0;
+            }
 
-        #if SD_RAW_WRITE_BUFFERING
-            raw_block_written = 1;
-        #endif
-    }
+            /* send start byte */
+            sd_raw_send_byte(TOKEN_START_BLOCK_MULTIPLE);
 
-    return 1;
+            /* write byte block */
+            sd_raw_send_block(buffer, 512);
+
+            /* write dummy crc16 */
+            sd_raw_send_byte(0xff);
+            sd_raw_send_byte(0xff);
+
+            /* check the data response, the card then programs the block on its own */
+            response = sd_raw_rec_byte() & 0x1f;
+            sd_raw_programming = 1;
+
+            /* end the stream after its last block, sd_raw_write_stop() clears the count */
+            if(sd_raw_write_left == 1 || response != DR_STATUS_ACCEPTED)
+                sd_raw_write_stop();
+            else
+                --sd_raw_write_left;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if(response != DR_STATUS_ACCEPTED)
+            return 0;
+
+        /* keep a cached copy of the block in sync with the card */
+        struct sd_raw_cache_line* line = sd_raw_cache_find(sd_raw_write_address);
+        if(line)
+        {
+            memcpy(line->data, buffer, 512);
+            line->flags &= ~SD_RAW_CACHE_DIRTY;
+        }
+
+        sd_raw_write_address += 512;
+
+        return 1;
     #else
         return 0;
     #endif
 }
 
+/**
+ * \ingroup sd_raw
+ * Closes the stream opened with sd_raw_write_start().
+ *
+ * The card may have pre-erased all blocks announced with ACMD23, so
+ * blocks announced but not written have undefined contents afterwards.
+ * Nothing is done if no stream is open.
+ *
+ * \see sd_raw_write_start, sd_raw_write_next
+ */
+void sd_raw_write_stop()
+{
+    #if SD_RAW_WRITE_SUPPORT
+        sd_raw_write_single = 0;
+
+        if(sd_raw_write_left == 0)
+            return;
+        sd_raw_write_left = 0;
+
+        /* end the data stream, the card then programs the last block on its own */
+        sd_raw_finish_write();
+        sd_raw_send_byte(TOKEN_STOP_TRANSMISSION);
+        sd_raw_rec_byte();
+        sd_raw_programming = 1;
+
+        /* deaddress card */
+        unselect_card();
+
+        /* let card some time to finish */
+        sd_raw_rec_byte();
+    #endif
+}
+
 /**
  * \ingroup sd_raw
  * Writes the write buffer's content to the card.
@@ -731,14 +2211,100 @@ unsigned char sd_raw_sync()
 {
     #if SD_RAW_WRITE_SUPPORT
         #if SD_RAW_WRITE_BUFFERING
-        if(raw_block_written)
+            unsigned char i;
+            for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+            {
+                if(!sd_raw_cache_flush_line(&raw_cache[i]))
+                    return 0;
+            }
+        #endif
+
+        /* wait for the data to be programmed */
+        sd_raw_write_stop();
+        sd_raw_stream_close();
+        select_card();
+        unsigned char ready = sd_raw_finish_write();
+        unselect_card();
+
+        return ready;
+    #else
+        return 0;
+    #endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Pins an area of the card in the block cache.
+ *
+ * Blocks of pinned areas, like the allocation table or the root
+ * directory of a filesystem, are not replaced by other blocks
+ * as long as at most SD_RAW_CACHE_PINNED_LINES of them are
+ * cached. This keeps them available while large amounts of
+ * file data pass through the cache.
+ *
+ * \note Only blocks loaded into the cache afterwards are affected.
+ *
+ * \param[in] offset The offset where the area starts.
+ * \param[in] length The size of the area in bytes.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_cache_unpin
+ */
+unsigned char sd_raw_cache_pin(offset_t offset, unsigned int length)
+{
+    #if !SD_RAW_SAVE_RAM
+        unsigned char i;
+        for(i = 0; i < SD_RAW_CACHE_PIN_AREAS; ++i)
+        {
+            struct sd_raw_cache_area* area = &raw_cache_pins[i];
+            if(area->length)
+                continue;
+
+            area->offset = offset & ~((offset_t) 0x1ff);
+            area->length = length + (offset & 0x01ff);
             return 1;
-        if(!sd_raw_write(raw_block_address, raw_block, sizeof(raw_block)))
-            return 0;
+        }
     #endif
-    return 1;
-    #else
+
     return 0;
+}
+
+/**
+ * \ingroup sd_raw
+ * Releases all areas pinned with sd_raw_cache_pin().
+ *
+ * \see sd_raw_cache_pin
+ */
+void sd_raw_cache_unpin()
+{
+    #if !SD_RAW_SAVE_RAM
+        memset(raw_cache_pins, 0, sizeof(raw_cache_pins));
+
+        unsigned char i;
+        for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+            raw_cache[i].flags &= ~SD_RAW_CACHE_PINNED;
+    #endif
+}
+
+/**
+ * \ingroup sd_raw
+ * Reads the efficiency counters of the block cache.
+ *
+ * The counters start at zero when the card is initialized.
+ *
+ * \param[out] stats A pointer to the structure into which to save the counters.
+ * \returns 0 on failure, 1 on success.
+ */
+unsigned char sd_raw_get_cache_stats(struct sd_raw_cache_stats* stats)
+{
+    if(!stats)
+        return 0;
+
+    #if !SD_RAW_SAVE_RAM
+        *stats = raw_cache_stats;
+        return 1;
+    #else
+        memset(stats, 0, sizeof(*stats));
+        return 0;
     #endif
 }
 
@@ -772,7 +2338,11 @@ unsigned char sd_raw_get_info(struct sd_raw_info* info)
         unselect_card();
         return 0;
     }
-    while(sd_raw_rec_byte() != 0xfe);
+    if(!sd_raw_wait_token())
+    {
+        unselect_card();
+        return 0;
+    }
     unsigned char i;
     for(i = 0; i < 18; ++i)
     {
@@ -814,43 +2384,78 @@ unsigned char sd_raw_get_info(struct sd_raw_info* info)
     }
 
     /* read csd register */
+    unsigned char csd_structure = 0;
     unsigned char csd_read_bl_len = 0;
     unsigned char csd_c_size_mult = 0;
-    unsigned short csd_c_size = 0;
+    unsigned int csd_c_size = 0;
     if(sd_raw_send_command_r1(CMD_SEND_CSD, 0))
     {
         unselect_card();
         return 0;
     }
-    while(sd_raw_rec_byte() != 0xfe);
+    if(!sd_raw_wait_token())
+    {
+        unselect_card();
+        return 0;
+    }
     for(i = 0; i < 18; ++i)
     {
         unsigned char b = sd_raw_rec_byte();
 
         switch(i)
         {
+            case 0:
+                csd_structure = b >> 6;
+                break;
             case 5:
                 csd_read_bl_len = b & 0x0f;
                 break;
             case 6:
-                csd_c_size = (unsigned short) (b & 0x03) << 8;
+                if(csd_structure == 0)
+                    csd_c_size = (unsigned int) (b & 0x03) << 8;
                 break;
             case 7:
-                csd_c_size |= b;
-                csd_c_size <<= 2;
+                if(csd_structure == 0)
+                {
+                    csd_c_size |= b;
+                    csd_c_size <<= 2;
+                }
+                else
+                {
+                    csd_c_size = (unsigned int) (b & 0x3f) << 16;
+                }
                 break;
             case 8:
-                csd_c_size |= b >> 6;
-                ++csd_c_size;
+                if(csd_structure == 0)
+                {
+                    csd_c_size |= b >> 6;
+                    ++csd_c_size;
+                }
+                else
+                {
+                    csd_c_size |= (unsigned int) b << 8;
+                }
                 break;
             case 9:
-                csd_c_size_mult = (b & 0x03) << 1;
+                if(csd_structure == 0)
+                {
+                    csd_c_size_mult = (b & 0x03) << 1;
+                }
+                else
+                {
+                    /* CSD version 2.0: capacity in units of 512kB */
+                    csd_c_size |= b;
+                    ++csd_c_size;
+                    info->capacity = (offset_t) csd_c_size * 512 * 1024;
+                }
                 break;
             case 10:
-                csd_c_size_mult |= b >> 7;
-
-                info->capacity = (unsigned int) csd_c_size << (csd_c_size_mult + csd_read_bl_len + 2);
+                if(csd_structure == 0)
+                {
+                    csd_c_size_mult |= b >> 7;
 
+                    info->capacity = (offset_t) csd_c_size << (csd_c_size_mult + csd_read_bl_len + 2);
+                }
                 break;
             case 14:
                 if(b & 0x40)
@@ -871,8 +2476,17 @@ unsigned char sd_raw_get_info(struct sd_raw_info* info)
 
 void SDoff(void)
 {
+    sd_raw_init_done = 0;
+
+    /* don't cut off the card while it is programming */
+    sd_raw_write_stop();
+    sd_raw_stream_close();
+    select_card();
+    sd_raw_finish_write();
+    unselect_card();
+
     SPI_SS_IODIR &= ~(1<<SPI_SS_PIN);
-    PINSEL0 &= ~(0x1500);
+    unconfigure_pins();
 }
 
 //NES : 10-28-7 
@@ -39,6 +39,19 @@
  */
 #define SD_RAW_FORMAT_UNKNOWN 3
 
+/**
+ * sd_raw_read_poll() failed to read the block.
+ */
+#define SD_RAW_READ_FAILED 0
+/**
+ * sd_raw_read_poll() has read the block.
+ */
+#define SD_RAW_READ_DONE 1
+/**
+ * sd_raw_read_poll() is still waiting for the card.
+ */
+#define SD_RAW_READ_BUSY 2
+
 /**
  * This struct is used by sd_raw_get_info() to return
  * manufacturing and status information of the card.
@@ -80,7 +93,7 @@ struct sd_raw_info
     /**
      * The card's total capacity in bytes.
      */
-    unsigned int capacity;
+    offset_t capacity;
     /**
      * Defines wether the card's content is original or copied.
      *
@@ -111,17 +124,60 @@ struct sd_raw_info
     unsigned char format;
 };
 
-typedef unsigned char (*sd_raw_interval_handler)(unsigned char* buffer, unsigned int offset, void* p);
+/**
+ * This struct is used by sd_raw_get_cache_stats() to return
+ * the efficiency counters of the block cache.
+ */
+struct sd_raw_cache_stats
+{
+    /**
+     * The number of block accesses served from the cache.
+     */
+    unsigned int hits;
+    /**
+     * The number of block accesses which had to load a cache line.
+     */
+    unsigned int misses;
+    /**
+     * The number of modified blocks written back to the card.
+     */
+    unsigned int writebacks;
+    /**
+     * The number of blocks read ahead which were accessed afterwards.
+     */
+    unsigned int prefetch_hits;
+    /**
+     * The number of blocks read ahead which were replaced unused.
+     */
+    unsigned int prefetch_wasted;
+};
+
+typedef unsigned char (*sd_raw_interval_handler)(unsigned char* buffer, offset_t offset, void* p);
 
 unsigned char sd_raw_init(void);
+unsigned char sd_raw_initialized(void);
 unsigned char sd_raw_available(void);
 unsigned char sd_raw_locked(void);
+unsigned char sd_raw_get_spi_prescaler(unsigned char tran_speed);
+unsigned long sd_raw_get_spi_clock(void);
 
-unsigned char sd_raw_read(unsigned int offset, unsigned char* buffer, unsigned short length);
-unsigned char sd_raw_read_interval(unsigned int offset, unsigned char* buffer, unsigned short interval, unsigned short length, sd_raw_interval_handler callback, void* p);
-unsigned char sd_raw_write(unsigned int offset, const unsigned char* buffer, unsigned short length);
+unsigned char sd_raw_read(offset_t offset, unsigned char* buffer, unsigned short length);
+unsigned char sd_raw_read_interval(offset_t offset, unsigned char* buffer, unsigned short interval, unsigned short length, sd_raw_interval_handler callback, void* p);
+unsigned char sd_raw_read_blocks(offset_t offset, unsigned char* buffer, unsigned short count, sd_raw_interval_handler callback, void* p);
+unsigned char sd_raw_read_start(offset_t offset);
+unsigned char sd_raw_read_poll(unsigned char* buffer);
+void sd_raw_read_abort(void);
+unsigned char sd_raw_write(offset_t offset, const unsigned char* buffer, unsigned short length);
+unsigned char sd_raw_write_blocks(offset_t offset, const unsigned char* buffer, unsigned short count);
+unsigned char sd_raw_write_start(offset_t offset, unsigned short count);
+unsigned char sd_raw_write_next(offset_t offset, const unsigned char* buffer);
+void sd_raw_write_stop(void);
 unsigned char sd_raw_sync(void);
 
+unsigned char sd_raw_cache_pin(offset_t offset, unsigned int length);
+void sd_raw_cache_unpin(void);
+unsigned char sd_raw_get_cache_stats(struct sd_raw_cache_stats* stats);
+
 unsigned char sd_raw_get_info(struct sd_raw_info* info);
 void SDoff(void);
 
@@ -4,8 +4,11 @@
  * published by the Free Software Foundation.
  */
 
-//#ifndef SD_RAW_CONFIG_H
-//#define SD_RAW_CONFIG_H
+#ifndef SD_RAW_CONFIG_H
+#define SD_RAW_CONFIG_H
+
+#include <stdint.h>
+#include "partition.h"
 
 #define SS_PORT_0
 #define SPI_SS_PIN	7
@@ -24,10 +27,34 @@
 	#define	SPI_SS_IOPIN	IOPIN0
 #endif  
 
+/**
+ * \ingroup sd_raw_config
+ * Selects the SPI controller the card is connected to.
+ *
+ * Set to 1 to use the SSP controller (SCK1, MISO1, MOSI1 on P0.17 to P0.19),
+ * which buffers up to 8 frames in its FIFOs and runs at up to half of
+ * the peripheral clock. Set to 0 to use SPI0 (SCK0, MISO0, MOSI0 on P0.4
+ * to P0.6), which needs to be waited for after every byte.
+ *
+ * \note The chip select line stays on SPI_SS_PIN either way.
+ * \note May be overridden on the compiler's command line.
+ */
+#ifndef SD_RAW_USE_SSP
+#define SD_RAW_USE_SSP 0
+#endif
+
 /* defines for customisation of sd/mmc port access */
+#if SD_RAW_USE_SSP
+#define configure_pin_mosi() 	PINSEL1 |= (2 << 6)
+#define configure_pin_sck() 	PINSEL1 |= (2 << 2)
+#define configure_pin_miso() 	PINSEL1 |= (2 << 4)
+#define unconfigure_pins() 		PINSEL1 &= ~(0xfc)
+#else
 #define configure_pin_mosi() 	PINSEL0 |= (1 << 12)
 #define configure_pin_sck() 	PINSEL0 |= (1 << 8)
 #define configure_pin_miso() 	PINSEL0 |= (1 << 10)
+#define unconfigure_pins() 		PINSEL0 &= ~(0x1500)
+#endif
 #define configure_pin_ss() 		SPI_SS_IODIR |= (1<<SPI_SS_PIN)
 
 #define select_card() 				SPI_SS_IOCLR |= (1<<SPI_SS_PIN)
@@ -48,6 +75,25 @@
  * MMC/SD support configuration.
  */
 
+/**
+ * \ingroup sd_raw_config
+ * The peripheral clock feeding the SPI interface, in Hz.
+ *
+ * Has to match the clock setup of system_init(): a 12MHz crystal,
+ * the PLL multiplying by 5 and VPBDIV passing the core clock through.
+ */
+#define SD_RAW_PCLK 60000000UL
+
+/**
+ * \ingroup sd_raw_config
+ * The smallest SPI clock prescaler the SPI controller supports.
+ */
+#if SD_RAW_USE_SSP
+#define SD_RAW_SPI_PRESCALE_MIN 2
+#else
+#define SD_RAW_SPI_PRESCALE_MIN 8
+#endif
+
 /**
  * \ingroup sd_raw_config
  * Controls MMC/SD write support.
@@ -78,6 +124,65 @@
  */
 #define SD_RAW_SAVE_RAM 1
 
+/**
+ * \ingroup sd_raw_config
+ * Controls support for SDHC cards.
+ *
+ * Set to 1 to support SDHC cards, i.e. SD cards with more than
+ * 2 gigabytes of memory, which are addressed in blocks instead
+ * of bytes. As byte offsets on these cards do not fit into 32
+ * bits, this requires PARTITION_LARGE_OFFSETS.
+ */
+#define SD_RAW_SDHC 1
+
+/**
+ * \ingroup sd_raw_config
+ * Number of blocks kept in the MMC/SD block cache.
+ *
+ * Each cache line takes 512 bytes of static RAM.
+ *
+ * \note This option has no effect when SD_RAW_SAVE_RAM is 1.
+ */
+#define SD_RAW_CACHE_LINES 4
+
+/**
+ * \ingroup sd_raw_config
+ * Maximum number of cache lines used for blocks of pinned areas.
+ *
+ * Has to be less than SD_RAW_CACHE_LINES, so that other blocks
+ * always find a line.
+ *
+ * \see sd_raw_cache_pin
+ */
+#define SD_RAW_CACHE_PINNED_LINES 2
+
+/**
+ * \ingroup sd_raw_config
+ * Number of areas which can be pinned in the MMC/SD block cache.
+ *
+ * \see sd_raw_cache_pin
+ */
+#define SD_RAW_CACHE_PIN_AREAS 2
+
+/**
+ * \ingroup sd_raw_config
+ * Number of blocks read ahead once sequential reading is detected.
+ *
+ * Sequential reads are served by a multiple block read which is kept
+ * open, and this many of the following blocks are prefetched into
+ * cache lines neither pinned nor modified. With 0, only the multiple
+ * block read is kept open.
+ *
+ * Prefetching pays off for files stored contiguously, but wastes a
+ * block at every cluster boundary of fragmented files. Check the
+ * prefetch counters of sd_raw_get_cache_stats() before enabling it.
+ *
+ * \note May be overridden on the compiler's command line.
+ */
+#ifndef SD_RAW_READ_AHEAD
+#define SD_RAW_READ_AHEAD 0
+#endif
+
 /**
  * @}
  */
@@ -91,5 +196,12 @@
 #define SD_RAW_WRITE_BUFFERING 0
 #endif
 
-//#endif
+#if SD_RAW_SDHC && !PARTITION_LARGE_OFFSETS
+#error SD_RAW_SDHC requires PARTITION_LARGE_OFFSETS
+#endif
+
+#if SD_RAW_CACHE_PINNED_LINES >= SD_RAW_CACHE_LINES
+#error SD_RAW_CACHE_PINNED_LINES has to be less than SD_RAW_CACHE_LINES
+#endif
 
+#endif
@@ -69,5 +69,4 @@ SECTIONS
 }
 	_end = .;							/* define a global symbol marking the end of application RAM */
 	end = .;
-	_heap = .;
-        . += 0x1000;
+								/* no heap is reserved, all handles come from static pools */
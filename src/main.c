@@ -31,9 +31,25 @@ struct fat16_file_struct* handle;
 
 void load_data(void);
 
+/* Called by fat16_stream_file() for every 512 byte sector of the
+ * splash screen, copies the sector to the display RAM
+ */
+static uint8_t load_splash_sector(uint8_t* buffer, offset_t offset, void* p)
+{
+  unsigned int size = *(unsigned int*)p;
+  unsigned int i;
+
+  for(i=0;i<512 && offset+i<size;i++)
+    {
+      //disp_buff[row][col] = buffer[i];
+      write_d(buffer[i]);
+    }
+  return 1;
+}
+
 void load_data(void)
 {
-#define READBUFSIZE 1024
+#define READBUFSIZE 512
 
   sd_raw_init();
   openroot();
@@ -42,19 +58,13 @@ void load_data(void)
   unsigned char readbuf[READBUFSIZE];
   char filename[12] = "splash.bin";
 
-  unsigned int read;
-  unsigned int i;
+  unsigned int size;
 
   /* Open the file */
   if(root_file_exists(filename))
     {
       handle = root_open(filename);
-		
-      /* Clear the buffer */
-      for(i=0;i<READBUFSIZE;i++)
-	{
-	  readbuf[i]=0;
-	}
+      size = fat16_file_size(handle);
 		
       write_c(0x15);	// set column start and end addresses
       write_d(0);
@@ -64,23 +74,16 @@ void load_data(void)
       write_d(127);
       write_c(0x5C);	// write to RAM command
 		
-      /* Read the file contents, and copy them to the display buffer */
-      while( (read=fat16_read_file(handle,(unsigned char*)readbuf,READBUFSIZE)) > 0 )
-	{
-	  for(i=0;i<read;i++)
-	    {
-	      //disp_buff[row][col] = readbuf[i];
-	      write_d(readbuf[i]);
-	    }
-	}
+      /* Stream the file contents to the display buffer */
+      fat16_stream_file(handle,readbuf,load_splash_sector,&size);
     }
   else 
     {
       handle = root_open_new(filename);
     }
   /* Close the file! */
-  sd_raw_sync();
   fat16_close_file(handle);
+  sd_raw_sync();
 }
 
 int main (void)
@@ -110,6 +113,7 @@ int main (void)
 	  load_fw(FW_FILE);			//If we found the firmware file, then program it's contents into memory.
 	  rprintf("New firmware loaded\n");
 	}
+      sd_raw_sync();					//Close open card transfers and release the card
     }
   else{
     //Didn't find a card to initialize
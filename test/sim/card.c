@@ -0,0 +1,524 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "card.h"
+#include "sim.h"
+
+/* R1 response bits */
+#define R1_IDLE 0x01
+#define R1_ILLEGAL 0x04
+#define R1_ADDRESS 0x20
+/* data tokens */
+#define TOKEN_START_BLOCK 0xfe
+#define TOKEN_START_BLOCK_MULTIPLE 0xfc
+#define TOKEN_STOP_TRANSMISSION 0xfd
+#define TOKEN_OUT_OF_RANGE 0x08
+/* data response of an accepted block */
+#define DATA_ACCEPTED 0x05
+
+/* number of ACMD41 the card needs to power up */
+#define CARD_POWER_UP_POLLS 3
+/* blocks beyond card_mem which can be written */
+#define CARD_SPARSE_BLOCKS 64
+
+struct card_config card_config;
+struct card_stats card_stats;
+uint8_t* card_mem;
+uint32_t card_mem_size;
+
+/* blocks beyond card_mem */
+static struct
+{
+    uint64_t offset;
+    uint8_t data[512];
+} card_sparse[CARD_SPARSE_BLOCKS];
+static unsigned int card_sparse_count;
+
+static int card_selected;
+static int card_idle;
+static int card_app;
+static int card_power_up_polls;
+static uint32_t card_announced;
+
+/* the command being received */
+static uint8_t card_cmd[6];
+static int card_cmd_len;
+
+/* bytes to send, before anything else */
+static uint8_t card_out[600];
+static int card_out_head;
+static int card_out_len;
+
+/* a data block to send once its access time has passed */
+static int card_read_pending;
+static unsigned long long card_read_ready;
+static uint64_t card_read_offset;
+/* set while a multiple block read is open */
+static int card_streaming;
+/* set while the block of a multiple block read is sent, the next one follows after a gap */
+static int card_gap_pending;
+
+/* write data reception */
+static enum
+{
+    CARD_WRITE_NONE,
+    CARD_WRITE_SINGLE,
+    CARD_WRITE_MULTIPLE
+} card_write;
+static int card_write_len;
+static uint8_t card_write_buf[512 + 2];
+static uint64_t card_write_offset;
+
+/* the card is busy until then */
+static unsigned long long card_busy_until;
+/* time of the byte exchanged last */
+static unsigned long long card_now;
+
+static uint16_t card_crc16(const uint8_t* data, unsigned int length)
+{
+    uint16_t crc = 0;
+    while(length--)
+    {
+        crc ^= (uint16_t) *data++ << 8;
+        int i;
+        for(i = 0; i < 8; ++i)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/* returns the block at offset, a multiple of 512 within the capacity */
+uint8_t* card_block(uint64_t offset)
+{
+    if(offset + 512 <= card_mem_size)
+        return card_mem + offset;
+
+    unsigned int i;
+    for(i = 0; i < card_sparse_count; ++i)
+    {
+        if(card_sparse[i].offset == offset)
+            return card_sparse[i].data;
+    }
+    if(card_sparse_count == CARD_SPARSE_BLOCKS)
+        abort();
+
+    card_sparse[card_sparse_count].offset = offset;
+    memset(card_sparse[card_sparse_count].data, 0, 512);
+    return card_sparse[card_sparse_count++].data;
+}
+
+static void card_push(uint8_t b)
+{
+    card_out[card_out_head + card_out_len++] = b;
+}
+
+static void card_push_data(const uint8_t* data, unsigned int length)
+{
+    uint16_t crc = card_crc16(data, length);
+
+    card_push(TOKEN_START_BLOCK);
+    while(length--)
+        card_push(*data++);
+    card_push(crc >> 8);
+    card_push(crc);
+}
+
+static void card_csd(void)
+{
+    uint8_t csd[16];
+    memset(csd, 0, sizeof(csd));
+
+    csd[3] = card_config.tran_speed;
+    csd[5] = 0x09; /* READ_BL_LEN 512 */
+    if(card_config.type == CARD_SDHC)
+    {
+        /* CSD version 2.0, capacity in units of 512kB */
+        uint32_t c_size = card_config.capacity / (512 * 1024) - 1;
+        csd[0] = 0x40;
+        csd[7] = (c_size >> 16) & 0x3f;
+        csd[8] = c_size >> 8;
+        csd[9] = c_size;
+    }
+    else
+    {
+        /* CSD version 1.0, capacity (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) * 512 */
+        uint32_t c_size = card_config.capacity / (512 * 512) - 1;
+        csd[6] = (c_size >> 10) & 0x03;
+        csd[7] = c_size >> 2;
+        csd[8] = (c_size & 0x03) << 6;
+        csd[9] = 0x03; /* C_SIZE_MULT 7 */
+        csd[10] = 0x80;
+    }
+
+    card_push(0xff);
+    card_push_data(csd, sizeof(csd));
+}
+
+static void card_cid(void)
+{
+    static const uint8_t cid[16] =
+    {
+        0x03, 'S', 'D', 'S', 'I', 'M', 'C', 'D', 0x10, 0x12, 0x34, 0x56, 0x78, 0x01, 0x9a, 0x01
+    };
+
+    card_push(0xff);
+    card_push_data(cid, sizeof(cid));
+}
+
+static int card_address(uint32_t arg, uint64_t* offset)
+{
+    *offset = card_config.type == CARD_SDHC ? (uint64_t) arg * 512 : arg;
+    return (*offset & 0x1ff) == 0 && *offset + 512 <= card_config.capacity;
+}
+
+static void card_command(void)
+{
+    uint8_t index = card_cmd[0] & 0x3f;
+    uint32_t arg = ((uint32_t) card_cmd[1] << 24) | ((uint32_t) card_cmd[2] << 16) | ((uint32_t) card_cmd[3] << 8) | card_cmd[4];
+    int app = card_app;
+    card_app = 0;
+
+    if(app)
+        ++card_stats.app_commands[index];
+    else
+        ++card_stats.commands[index];
+
+    if(index == 12)
+    {
+        /* stop transmission: a stuff byte, the response, then busy */
+        card_streaming = 0;
+        card_read_pending = 0;
+        card_gap_pending = 0;
+        card_out_head = card_out_len = 0;
+        card_push(0xff);
+        card_push(0x00);
+        card_busy_until = card_now + card_config.stop_busy;
+        return;
+    }
+
+    if(card_now < card_busy_until || card_streaming || card_write != CARD_WRITE_NONE)
+    {
+        /* the host has to wait for the card, or to end the transfer first */
+        ++card_stats.errors;
+        return;
+    }
+
+    uint8_t r1 = card_idle ? R1_IDLE : 0;
+    uint64_t offset;
+
+    card_out_head = card_out_len = 0;
+    card_read_pending = 0;
+    card_push(0xff);
+
+    switch(app ? 0x40 | index : index)
+    {
+        case 0:
+            card_idle = 1;
+            card_power_up_polls = 0;
+            card_push(R1_IDLE);
+            break;
+        case 8:
+            if(card_config.type == CARD_SDSC_V1)
+            {
+                card_push(r1 | R1_ILLEGAL);
+                break;
+            }
+            card_push(r1);
+            card_push(0x00);
+            card_push(0x00);
+            card_push((arg >> 8) & 0x0f);
+            card_push(arg);
+            break;
+        case 1:
+            /* the MMC way to power up, which only standard capacity cards take */
+            if(card_config.type == CARD_SDHC)
+            {
+                card_push(r1 | R1_ILLEGAL);
+                break;
+            }
+            if(++card_power_up_polls >= CARD_POWER_UP_POLLS)
+                card_idle = 0;
+            card_push(card_idle ? R1_IDLE : 0);
+            break;
+        case 55:
+            card_app = 1;
+            card_push(r1);
+            break;
+        case 0x40 | 41:
+            /* high capacity cards do not power up for hosts not supporting them */
+            if(card_config.type != CARD_SDHC || (arg & 0x40000000))
+            {
+                if(++card_power_up_polls >= CARD_POWER_UP_POLLS)
+                    card_idle = 0;
+            }
+            card_push(card_idle ? R1_IDLE : 0);
+            break;
+        case 0x40 | 23:
+            card_announced = arg & 0x7fffff;
+            card_push(r1);
+            break;
+        case 58:
+            card_push(r1);
+            card_push((card_idle ? 0x00 : 0x80) | (!card_idle && card_config.type == CARD_SDHC ? 0x40 : 0x00));
+            card_push(0xff);
+            card_push(0x80);
+            card_push(0x00);
+            break;
+        case 9:
+            card_push(r1);
+            card_csd();
+            break;
+        case 10:
+            card_push(r1);
+            card_cid();
+            break;
+        case 13:
+            card_push(r1);
+            card_push(0x00);
+            break;
+        case 16:
+        case 59:
+            card_push(r1);
+            break;
+        case 17:
+        case 18:
+            if(card_idle || !card_address(arg, &offset))
+            {
+                card_push(r1 | R1_ADDRESS);
+                break;
+            }
+            card_push(r1);
+            card_read_pending = 1;
+            card_read_ready = card_now + card_config.read_latency;
+            card_read_offset = offset;
+            card_streaming = (index == 18);
+            break;
+        case 24:
+        case 25:
+            if(card_idle || !card_address(arg, &offset))
+            {
+                card_push(r1 | R1_ADDRESS);
+                break;
+            }
+            card_push(r1);
+            card_write = index == 24 ? CARD_WRITE_SINGLE : CARD_WRITE_MULTIPLE;
+            card_write_len = -1;
+            card_write_offset = offset;
+            if(index == 25 && card_config.pre_erase)
+            {
+                /* the announced blocks lose their content */
+                uint32_t i;
+                for(i = 0; i < card_announced && offset + (uint64_t) i * 512 < card_config.capacity; ++i)
+                    memset(card_block(offset + (uint64_t) i * 512), 0xff, 512);
+            }
+            card_announced = 0;
+            break;
+        default:
+            card_push(r1 | R1_ILLEGAL);
+            break;
+    }
+}
+
+/* receives a byte of a block written by the host */
+static void card_receive(uint8_t mosi)
+{
+    if(card_write_len < 0)
+    {
+        /* waiting for a token, the host has to wait while the card is busy */
+        if(mosi == 0xff)
+            return;
+        if(card_now < card_busy_until)
+        {
+            ++card_stats.errors;
+            return;
+        }
+
+        if(card_write == CARD_WRITE_MULTIPLE && mosi == TOKEN_STOP_TRANSMISSION)
+        {
+            card_write = CARD_WRITE_NONE;
+            card_push(0xff);
+            card_busy_until = card_now + card_config.stop_busy;
+        }
+        else if(mosi == (card_write == CARD_WRITE_SINGLE ? TOKEN_START_BLOCK : TOKEN_START_BLOCK_MULTIPLE))
+        {
+            card_write_len = 0;
+        }
+        else
+        {
+            ++card_stats.errors;
+        }
+        return;
+    }
+
+    card_write_buf[card_write_len++] = mosi;
+    if(card_write_len < (int) sizeof(card_write_buf))
+        return;
+
+    /* the block is complete, the card programs it */
+    memcpy(card_block(card_write_offset), card_write_buf, 512);
+    ++card_stats.blocks_written;
+    card_write_offset += 512;
+    card_write_len = -1;
+
+    card_push(DATA_ACCEPTED);
+    if(card_write == CARD_WRITE_SINGLE)
+    {
+        card_write = CARD_WRITE_NONE;
+        card_busy_until = card_now + card_config.write_busy;
+    }
+    else
+    {
+        card_busy_until = card_now + card_config.stream_write_busy;
+    }
+}
+
+/* the byte the card sends next */
+static uint8_t card_send(unsigned long clock)
+{
+    if(card_out_len > 0)
+    {
+        if(--card_out_len == 0 && card_gap_pending)
+        {
+            card_gap_pending = 0;
+            card_read_ready = card_now + card_config.block_gap;
+        }
+        return card_out[card_out_head++];
+    }
+    card_out_head = 0;
+
+    if(card_read_pending)
+    {
+        if(card_now < card_read_ready)
+        {
+            ++card_stats.wait_bytes;
+            return 0xff;
+        }
+
+        card_read_pending = 0;
+        if(card_read_offset + 512 > card_config.capacity)
+        {
+            card_streaming = 0;
+            return TOKEN_OUT_OF_RANGE;
+        }
+
+        card_push_data(card_block(card_read_offset), 512);
+        if(card_config.max_clock && clock > card_config.max_clock)
+        {
+            /* too fast, a bit of the data is received wrongly */
+            card_out[1 + (card_read_offset / 512) % 512] ^= 0x10;
+        }
+        ++card_stats.blocks_read;
+
+        if(card_streaming)
+        {
+            card_read_pending = 1;
+            card_gap_pending = 1;
+            card_read_offset += 512;
+        }
+
+        --card_out_len;
+        return card_out[card_out_head++];
+    }
+
+    if(card_now < card_busy_until)
+    {
+        ++card_stats.busy_bytes;
+        return 0x00;
+    }
+
+    return 0xff;
+}
+
+uint8_t card_exchange(uint8_t mosi, unsigned long long time, unsigned long clock)
+{
+    card_now = time;
+    ++card_stats.bytes;
+
+    if(!card_selected)
+        return 0xff;
+
+    uint8_t miso = card_send(clock);
+
+    if(card_cmd_len > 0)
+    {
+        card_cmd[card_cmd_len++] = mosi;
+        if(card_cmd_len == 6)
+        {
+            card_cmd_len = 0;
+            card_command();
+        }
+    }
+    else if(card_write != CARD_WRITE_NONE)
+    {
+        card_receive(mosi);
+    }
+    else if((mosi & 0xc0) == 0x40)
+    {
+        card_cmd[card_cmd_len++] = mosi;
+    }
+
+    return miso;
+}
+
+void card_select(int selected)
+{
+    card_selected = selected;
+    if(!selected)
+        card_cmd_len = 0;
+}
+
+int card_is_selected(void)
+{
+    sim_sync();
+    return card_selected;
+}
+
+int card_is_busy(void)
+{
+    sim_sync();
+    return sim_cycles < card_busy_until;
+}
+
+void card_reset_stats(void)
+{
+    memset(&card_stats, 0, sizeof(card_stats));
+}
+
+/* inserts an empty card, of which the first mem_size bytes are kept in card_mem */
+void card_insert(enum card_type type, uint64_t capacity, uint32_t mem_size)
+{
+    free(card_mem);
+    card_mem = calloc(1, mem_size);
+    card_mem_size = mem_size;
+    card_sparse_count = 0;
+
+    memset(&card_config, 0, sizeof(card_config));
+    card_config.type = type;
+    card_config.capacity = capacity;
+    card_config.tran_speed = 0x32; /* 25MHz */
+    card_config.read_latency = SIM_US(100);
+    card_config.block_gap = SIM_US(10);
+    card_config.write_busy = SIM_US(500);
+    card_config.stream_write_busy = SIM_US(150);
+    card_config.stop_busy = SIM_US(100);
+
+    card_selected = 0;
+    card_idle = 1;
+    card_app = 0;
+    card_power_up_polls = 0;
+    card_announced = 0;
+    card_cmd_len = 0;
+    card_out_head = card_out_len = 0;
+    card_read_pending = 0;
+    card_streaming = 0;
+    card_gap_pending = 0;
+    card_write = CARD_WRITE_NONE;
+    card_busy_until = 0;
+
+    card_reset_stats();
+    sim_reset();
+}
@@ -0,0 +1,95 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef CARD_H
+#define CARD_H
+
+#include <stdint.h>
+
+/*
+ * Model of an SD card in SPI mode.
+ *
+ * The card answers the commands sd_raw uses, keeps its content in
+ * host memory and charges the time a real card needs: an access
+ * latency before data blocks, and busy periods while written blocks
+ * are programmed. Times are counted in PCLK cycles of the simulated
+ * LPC2148, see sim.h. Every command and byte is counted, and protocol
+ * violations of the host, like commands sent while the card is busy,
+ * are counted as errors.
+ */
+
+/* the kinds of cards modelled */
+enum card_type
+{
+    /* SD version 1 card, does not know CMD8 */
+    CARD_SDSC_V1,
+    /* SD version 2 card of standard capacity, byte addressed */
+    CARD_SDSC,
+    /* SD version 2 card of high capacity, block addressed */
+    CARD_SDHC
+};
+
+/* behaviour of the card, set up by card_insert() and adjustable afterwards */
+struct card_config
+{
+    enum card_type type;
+    /* capacity in bytes reported by the CSD */
+    uint64_t capacity;
+    /* TRAN_SPEED field of the CSD */
+    uint8_t tran_speed;
+    /* fastest SPI clock in Hz at which data is received without errors, 0 for no limit */
+    unsigned long max_clock;
+    /* cycles from a read command to its data block */
+    unsigned long read_latency;
+    /* cycles between the blocks of a multiple block read */
+    unsigned long block_gap;
+    /* cycles the card is busy after a single block write */
+    unsigned long write_busy;
+    /* cycles the card is busy after each block of a multiple block write */
+    unsigned long stream_write_busy;
+    /* cycles the card is busy after the end of a multiple block transfer */
+    unsigned long stop_busy;
+    /* set to erase the blocks announced with ACMD23 when the write starts */
+    uint8_t pre_erase;
+};
+
+/* counters of the card's activity */
+struct card_stats
+{
+    /* bytes clocked over the bus */
+    unsigned long bytes;
+    /* commands received, indexed by command number */
+    unsigned long commands[64];
+    /* application specific commands received, indexed by command number */
+    unsigned long app_commands[64];
+    /* data blocks sent and received */
+    unsigned long blocks_read;
+    unsigned long blocks_written;
+    /* bytes clocked while the card was busy */
+    unsigned long busy_bytes;
+    /* bytes clocked while a data block was awaited */
+    unsigned long wait_bytes;
+    /* protocol violations of the host */
+    unsigned long errors;
+};
+
+extern struct card_config card_config;
+extern struct card_stats card_stats;
+
+/* the card's content, blocks beyond it are stored sparsely */
+extern uint8_t* card_mem;
+extern uint32_t card_mem_size;
+
+void card_insert(enum card_type type, uint64_t capacity, uint32_t mem_size);
+void card_reset_stats(void);
+uint8_t* card_block(uint64_t offset);
+int card_is_selected(void);
+int card_is_busy(void);
+
+/* called by the SPI model */
+void card_select(int selected);
+uint8_t card_exchange(uint8_t mosi, unsigned long long time, unsigned long clock);
+
+#endif
@@ -0,0 +1,755 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fatimg.h"
+
+/* the partition starts at 1MB, like on cards formatted by the SD association's tool */
+#define FATIMG_PARTITION_SECTOR 2048
+#define FATIMG_ATTRIB_DIR 0x10
+#define FATIMG_ATTRIB_VOLUME 0x08
+#define FATIMG_ATTRIB_LFN 0x0f
+/* longest cluster chain followed before a loop is assumed */
+#define FATIMG_MAX_CHAIN 0x1000000
+
+/* positions of the 13 characters within a long file name entry */
+static const uint8_t fatimg_lfn_chars[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static uint16_t get16(const uint8_t* p)
+{
+    return p[0] | (uint16_t) p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static uint32_t fatimg_eoc(const struct fatimg* img)
+{
+    return img->fat32 ? 0x0fffffff : 0xffff;
+}
+
+static int fatimg_is_cluster(const struct fatimg* img, uint32_t value)
+{
+    return value >= 2 && value < img->clusters + 2;
+}
+
+/* creates an empty filesystem on a partition covering the image */
+void fatimg_format(struct fatimg* img, uint8_t* mem, uint32_t size, uint8_t fat32, uint8_t sectors_per_cluster)
+{
+    uint32_t sectors = size / 512 - FATIMG_PARTITION_SECTOR;
+    uint16_t reserved = fat32 ? 32 : 4;
+    uint16_t root_entries = fat32 ? 0 : 512;
+    uint32_t entry_size = fat32 ? 4 : 2;
+
+    /* the fat has to cover the clusters left besides itself */
+    uint32_t fat_sectors = 1;
+    while(1)
+    {
+        uint32_t clusters = (sectors - reserved - 2 * fat_sectors - root_entries * 32 / 512) / sectors_per_cluster;
+        uint32_t needed = ((clusters + 2) * entry_size + 511) / 512;
+        if(needed <= fat_sectors)
+            break;
+        fat_sectors = needed;
+    }
+
+    memset(mem, 0, size);
+
+    uint8_t* mbr = mem;
+    mbr[0x1be + 4] = fat32 ? 0x0c : 0x06;
+    put32(mbr + 0x1be + 8, FATIMG_PARTITION_SECTOR);
+    put32(mbr + 0x1be + 12, sectors);
+    mbr[510] = 0x55;
+    mbr[511] = 0xaa;
+
+    uint8_t* boot = mem + FATIMG_PARTITION_SECTOR * 512;
+    memcpy(boot, "\xeb\x3c\x90" "FATIMG  ", 11);
+    put16(boot + 11, 512);
+    boot[13] = sectors_per_cluster;
+    put16(boot + 14, reserved);
+    boot[16] = 2;
+    put16(boot + 17, root_entries);
+    if(sectors < 65536 && !fat32)
+        put16(boot + 19, sectors);
+    else
+        put32(boot + 32, sectors);
+    boot[21] = 0xf8;
+    put16(boot + 24, 63);
+    put16(boot + 26, 255);
+    put32(boot + 28, FATIMG_PARTITION_SECTOR);
+    if(fat32)
+    {
+        put32(boot + 36, fat_sectors);
+        put32(boot + 44, 2);
+        put16(boot + 48, 1);
+        put16(boot + 50, 6);
+        boot[66] = 0x29;
+        memcpy(boot + 82, "FAT32   ", 8);
+    }
+    else
+    {
+        put16(boot + 22, fat_sectors);
+        boot[38] = 0x29;
+        memcpy(boot + 54, "FAT16   ", 8);
+    }
+    boot[510] = 0x55;
+    boot[511] = 0xaa;
+
+    if(fat32)
+    {
+        uint8_t* fsinfo = boot + 512;
+        memcpy(fsinfo, "RRaA", 4);
+        memcpy(fsinfo + 484, "rrAa", 4);
+        fsinfo[510] = 0x55;
+        fsinfo[511] = 0xaa;
+    }
+
+    fatimg_open(img, mem, size);
+
+    fatimg_set_fat(img, 0, fat32 ? 0x0ffffff8 : 0xfff8);
+    fatimg_set_fat(img, 1, fatimg_eoc(img));
+    if(fat32)
+    {
+        put32(mem + img->fsinfo_offset + 488, img->clusters);
+        put32(mem + img->fsinfo_offset + 492, 3);
+        fatimg_set_fat(img, 2, fatimg_eoc(img));
+    }
+}
+
+/* reads the layout of the filesystem within an image */
+int fatimg_open(struct fatimg* img, uint8_t* mem, uint32_t size)
+{
+    memset(img, 0, sizeof(*img));
+    img->mem = mem;
+    img->size = size;
+
+    const uint8_t* boot = mem + get32(mem + 0x1be + 8) * 512;
+    uint32_t sectors = get16(boot + 19) ? get16(boot + 19) : get32(boot + 32);
+    uint32_t fat_sectors = get16(boot + 22);
+    if(get16(boot + 11) != 512 || !boot[13])
+        return 0;
+
+    img->fat32 = fat_sectors == 0;
+    if(img->fat32)
+        fat_sectors = get32(boot + 36);
+    img->fat_copies = boot[16];
+    img->cluster_size = boot[13] * 512;
+    img->fat_offset = (boot - mem) + get16(boot + 14) * 512;
+    img->fat_size = fat_sectors * 512;
+    img->root_offset = img->fat_offset + img->fat_copies * img->fat_size;
+    img->root_entries = get16(boot + 17);
+    img->data_offset = img->root_offset + img->root_entries * 32;
+    img->clusters = (sectors - get16(boot + 14) - img->fat_copies * fat_sectors - img->root_entries * 32 / 512) / boot[13];
+    if(img->fat32)
+    {
+        img->root_cluster = get32(boot + 44);
+        img->fsinfo_offset = (boot - mem) + get16(boot + 48) * 512;
+    }
+
+    return 1;
+}
+
+uint32_t fatimg_get_fat(const struct fatimg* img, uint32_t cluster, uint8_t copy)
+{
+    const uint8_t* fat = img->mem + img->fat_offset + copy * img->fat_size;
+    if(img->fat32)
+        return get32(fat + cluster * 4) & 0x0fffffff;
+    return get16(fat + cluster * 2);
+}
+
+/* sets an entry in all fat copies, keeping the fsinfo free count */
+void fatimg_set_fat(struct fatimg* img, uint32_t cluster, uint32_t value)
+{
+    uint32_t old = fatimg_get_fat(img, cluster, 0);
+    uint8_t copy;
+    for(copy = 0; copy < img->fat_copies; ++copy)
+    {
+        uint8_t* fat = img->mem + img->fat_offset + copy * img->fat_size;
+        if(img->fat32)
+            put32(fat + cluster * 4, value);
+        else
+            put16(fat + cluster * 2, value);
+    }
+
+    if(img->fat32 && cluster >= 2 && (old == 0) != (value == 0))
+    {
+        uint8_t* free_count = img->mem + img->fsinfo_offset + 488;
+        put32(free_count, get32(free_count) + (value == 0 ? 1 : -1));
+    }
+}
+
+uint8_t* fatimg_cluster(const struct fatimg* img, uint32_t cluster)
+{
+    return img->mem + img->data_offset + (cluster - 2) * img->cluster_size;
+}
+
+uint32_t fatimg_free_clusters(const struct fatimg* img)
+{
+    uint32_t count = 0;
+    uint32_t cluster;
+    for(cluster = 2; cluster < img->clusters + 2; ++cluster)
+    {
+        if(fatimg_get_fat(img, cluster, 0) == 0)
+            ++count;
+    }
+    return count;
+}
+
+/* counts the runs of consecutive clusters a chain consists of */
+uint32_t fatimg_fragments(const struct fatimg* img, uint32_t cluster)
+{
+    uint32_t fragments = 0;
+    uint32_t previous = 0;
+    while(fatimg_is_cluster(img, cluster))
+    {
+        if(cluster != previous + 1)
+            ++fragments;
+        previous = cluster;
+        cluster = fatimg_get_fat(img, cluster, 0);
+    }
+    return fragments;
+}
+
+/* allocates a chain of free clusters, leaving stride - 1 clusters between them */
+static uint32_t fatimg_alloc(struct fatimg* img, uint32_t count, uint32_t stride)
+{
+    uint32_t first = 0;
+    uint32_t last = 0;
+    uint32_t cluster = 2;
+    while(count > 0)
+    {
+        if(cluster >= img->clusters + 2)
+        {
+            fprintf(stderr, "fatimg: filesystem full\n");
+            exit(1);
+        }
+        if(fatimg_get_fat(img, cluster, 0) != 0)
+        {
+            ++cluster;
+            continue;
+        }
+
+        fatimg_set_fat(img, cluster, fatimg_eoc(img));
+        if(last)
+            fatimg_set_fat(img, last, cluster);
+        else
+            first = cluster;
+        last = cluster;
+        cluster += stride ? stride : 1;
+        --count;
+    }
+    return first;
+}
+
+/* calls back for each 32 byte slot of a directory, until the callback returns nonzero */
+static int fatimg_walk_dir(const struct fatimg* img, uint32_t dir, int (*callback)(uint8_t* slot, void* p), void* p)
+{
+    if(dir == 0 && !img->fat32)
+    {
+        uint32_t i;
+        for(i = 0; i < img->root_entries; ++i)
+        {
+            int result = callback(img->mem + img->root_offset + i * 32, p);
+            if(result)
+                return result;
+        }
+        return 0;
+    }
+
+    uint32_t cluster = dir ? dir : img->root_cluster;
+    while(fatimg_is_cluster(img, cluster))
+    {
+        uint32_t i;
+        for(i = 0; i < img->cluster_size / 32; ++i)
+        {
+            int result = callback(fatimg_cluster(img, cluster) + i * 32, p);
+            if(result)
+                return result;
+        }
+        cluster = fatimg_get_fat(img, cluster, 0);
+    }
+    return 0;
+}
+
+struct fatimg_free_run
+{
+    uint8_t* slots[21];
+    unsigned int needed;
+    unsigned int found;
+};
+
+static int fatimg_free_run_callback(uint8_t* slot, void* p)
+{
+    struct fatimg_free_run* run = p;
+    if(slot[0] == 0x00 || slot[0] == 0xe5)
+        run->slots[run->found++] = slot;
+    else
+        run->found = 0;
+    return run->found == run->needed;
+}
+
+static void fatimg_short_name(const char* name, uint8_t* short_name)
+{
+    const char* dot = strrchr(name, '.');
+    unsigned int base_length = dot ? (unsigned int) (dot - name) : strlen(name);
+    unsigned int i;
+    unsigned int j = 0;
+
+    memset(short_name, ' ', 11);
+    for(i = 0; i < base_length && j < 8; ++i)
+    {
+        if(name[i] != ' ')
+            short_name[j++] = toupper((unsigned char) name[i]);
+    }
+    if(base_length > 8)
+    {
+        short_name[6] = '~';
+        short_name[7] = '1';
+    }
+    for(i = 0; dot && dot[1 + i] && i < 3; ++i)
+        short_name[8 + i] = toupper((unsigned char) dot[1 + i]);
+}
+
+static void fatimg_display_name(const uint8_t* short_name, char* name)
+{
+    int i;
+    int length = 0;
+    for(i = 0; i < 8 && short_name[i] != ' '; ++i)
+        name[length++] = short_name[i];
+    if(short_name[8] != ' ')
+    {
+        name[length++] = '.';
+        for(i = 8; i < 11 && short_name[i] != ' '; ++i)
+            name[length++] = short_name[i];
+    }
+    name[length] = 0;
+}
+
+/* adds an entry to a directory, with long file name entries if the name needs them */
+static uint32_t fatimg_add_entry(struct fatimg* img, uint32_t dir, const char* name, uint8_t attributes, uint32_t cluster, uint32_t size)
+{
+    uint8_t short_name[11];
+    char display[13];
+    fatimg_short_name(name, short_name);
+    fatimg_display_name(short_name, display);
+
+    unsigned int lfn_entries = strcmp(name, display) ? (strlen(name) + 12) / 13 : 0;
+    struct fatimg_free_run run;
+    memset(&run, 0, sizeof(run));
+    run.needed = lfn_entries + 1;
+    while(!fatimg_walk_dir(img, dir, fatimg_free_run_callback, &run))
+    {
+        if(dir == 0 && !img->fat32)
+        {
+            fprintf(stderr, "fatimg: root directory full\n");
+            exit(1);
+        }
+
+        /* grow the directory by a cluster */
+        uint32_t last = dir ? dir : img->root_cluster;
+        while(fatimg_is_cluster(img, fatimg_get_fat(img, last, 0)))
+            last = fatimg_get_fat(img, last, 0);
+        uint32_t added = fatimg_alloc(img, 1, 1);
+        memset(fatimg_cluster(img, added), 0, img->cluster_size);
+        fatimg_set_fat(img, last, added);
+        run.found = 0;
+    }
+
+    uint8_t checksum = 0;
+    unsigned int i;
+    for(i = 0; i < 11; ++i)
+        checksum = ((checksum & 1) << 7) + (checksum >> 1) + short_name[i];
+
+    for(i = 0; i < lfn_entries; ++i)
+    {
+        uint8_t* slot = run.slots[i];
+        unsigned int ordinal = lfn_entries - i;
+        memset(slot, 0, 32);
+        slot[0] = ordinal | (i == 0 ? 0x40 : 0x00);
+        slot[11] = FATIMG_ATTRIB_LFN;
+        slot[13] = checksum;
+
+        unsigned int c;
+        for(c = 0; c < 13; ++c)
+        {
+            unsigned int position = (ordinal - 1) * 13 + c;
+            uint16_t ch;
+            if(position < strlen(name))
+                ch = (uint8_t) name[position];
+            else
+                ch = position == strlen(name) ? 0x0000 : 0xffff;
+            put16(slot + fatimg_lfn_chars[c], ch);
+        }
+    }
+
+    uint8_t* entry = run.slots[lfn_entries];
+    memset(entry, 0, 32);
+    memcpy(entry, short_name, 11);
+    entry[11] = attributes;
+    put16(entry + 20, cluster >> 16);
+    put16(entry + 26, cluster);
+    put32(entry + 28, size);
+
+    return entry - img->mem;
+}
+
+/* adds a file, whose clusters are stride clusters apart */
+uint32_t fatimg_add_file(struct fatimg* img, uint32_t dir, const char* name, const uint8_t* data, uint32_t size, uint32_t stride)
+{
+    uint32_t count = (size + img->cluster_size - 1) / img->cluster_size;
+    uint32_t first = count ? fatimg_alloc(img, count, stride) : 0;
+
+    uint32_t cluster = first;
+    uint32_t done = 0;
+    while(done < size)
+    {
+        uint32_t length = size - done < img->cluster_size ? size - done : img->cluster_size;
+        if(data)
+            memcpy(fatimg_cluster(img, cluster), data + done, length);
+        done += length;
+        cluster = fatimg_get_fat(img, cluster, 0);
+    }
+
+    fatimg_add_entry(img, dir, name, 0x20, first, size);
+    return first;
+}
+
+uint32_t fatimg_add_dir(struct fatimg* img, uint32_t dir, const char* name)
+{
+    uint32_t cluster = fatimg_alloc(img, 1, 1);
+    uint8_t* slots = fatimg_cluster(img, cluster);
+    memset(slots, 0, img->cluster_size);
+
+    memcpy(slots, ".          ", 11);
+    slots[11] = FATIMG_ATTRIB_DIR;
+    put16(slots + 20, cluster >> 16);
+    put16(slots + 26, cluster);
+    memcpy(slots + 32, "..         ", 11);
+    slots[32 + 11] = FATIMG_ATTRIB_DIR;
+    put16(slots + 32 + 20, dir >> 16);
+    put16(slots + 32 + 26, dir);
+
+    fatimg_add_entry(img, dir, name, FATIMG_ATTRIB_DIR, cluster, 0);
+    return cluster;
+}
+
+/* occupies percent of the clusters with files in directory FILL, spread evenly over the volume */
+void fatimg_fill(struct fatimg* img, uint32_t percent)
+{
+    uint32_t dir = fatimg_add_dir(img, 0, "FILL");
+    uint32_t used = 0;
+    uint32_t files = 0;
+    uint32_t cluster;
+    for(cluster = 2; cluster < img->clusters + 2; ++cluster)
+    {
+        /* spread the used clusters by error diffusion */
+        used += percent;
+        if(used < 100 || fatimg_get_fat(img, cluster, 0) != 0)
+            continue;
+        used -= 100;
+
+        /* extend the file of the previous cluster, or start a new one */
+        if(cluster > 2 && fatimg_get_fat(img, cluster - 1, 0) == fatimg_eoc(img) && cluster - 1 != dir)
+        {
+            fatimg_set_fat(img, cluster - 1, cluster);
+            fatimg_set_fat(img, cluster, fatimg_eoc(img));
+            continue;
+        }
+
+        char name[13];
+        sprintf(name, "F%07u.BIN", (unsigned int) files++);
+        fatimg_set_fat(img, cluster, fatimg_eoc(img));
+        fatimg_add_entry(img, dir, name, 0x20, cluster, 0);
+    }
+
+    /* set the sizes of the files to their chains */
+    uint32_t slot_cluster = dir;
+    while(fatimg_is_cluster(img, slot_cluster))
+    {
+        uint8_t* slots = fatimg_cluster(img, slot_cluster);
+        uint32_t i;
+        for(i = 0; i < img->cluster_size / 32; ++i)
+        {
+            uint8_t* entry = slots + i * 32;
+            if(entry[0] == 'F' && entry[11] == 0x20)
+            {
+                uint32_t length = 0;
+                uint32_t c = get16(entry + 26) | (uint32_t) get16(entry + 20) << 16;
+                for(; fatimg_is_cluster(img, c); c = fatimg_get_fat(img, c, 0))
+                    ++length;
+                put32(entry + 28, length * img->cluster_size);
+            }
+        }
+        slot_cluster = fatimg_get_fat(img, slot_cluster, 0);
+    }
+}
+
+struct fatimg_list
+{
+    const struct fatimg* img;
+    char long_name[256];
+    uint8_t long_valid;
+    /* called for each entry, stops the listing by returning nonzero */
+    int (*callback)(const struct fatimg_entry* entry, void* p);
+    void* p;
+};
+
+static int fatimg_list_callback(uint8_t* slot, void* p)
+{
+    struct fatimg_list* list = p;
+
+    /* the directory ends at the first unused entry */
+    if(slot[0] == 0x00)
+        return -1;
+    if(slot[0] == 0xe5)
+    {
+        list->long_valid = 0;
+        return 0;
+    }
+
+    if(slot[11] == FATIMG_ATTRIB_LFN)
+    {
+        unsigned int ordinal = slot[0] & 0x1f;
+        if(slot[0] & 0x40)
+            memset(list->long_name, 0, sizeof(list->long_name));
+        unsigned int c;
+        for(c = 0; c < 13 && ordinal > 0; ++c)
+        {
+            uint16_t ch = get16(slot + fatimg_lfn_chars[c]);
+            if(ch != 0 && ch != 0xffff)
+                list->long_name[(ordinal - 1) * 13 + c] = ch;
+        }
+        list->long_valid = 1;
+        return 0;
+    }
+
+    struct fatimg_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    if(list->long_valid)
+        snprintf(entry.name, sizeof(entry.name), "%s", list->long_name);
+    else
+        fatimg_display_name(slot, entry.name);
+    list->long_valid = 0;
+
+    if(slot[11] & FATIMG_ATTRIB_VOLUME)
+        return 0;
+
+    entry.attributes = slot[11];
+    entry.cluster = get16(slot + 26) | (list->img->fat32 ? (uint32_t) get16(slot + 20) << 16 : 0);
+    entry.size = get32(slot + 28);
+    entry.offset = slot - list->img->mem;
+    return list->callback(&entry, list->p);
+}
+
+static int fatimg_list(const struct fatimg* img, uint32_t dir, int (*callback)(const struct fatimg_entry* entry, void* p), void* p)
+{
+    struct fatimg_list list;
+    memset(&list, 0, sizeof(list));
+    list.img = img;
+    list.callback = callback;
+    list.p = p;
+    return fatimg_walk_dir(img, dir, fatimg_list_callback, &list) > 0;
+}
+
+struct fatimg_search
+{
+    const char* name;
+    struct fatimg_entry* entry;
+    unsigned int count;
+};
+
+static int fatimg_search_callback(const struct fatimg_entry* entry, void* p)
+{
+    struct fatimg_search* search = p;
+    if(search->name && strcmp(entry->name, search->name))
+        return 0;
+
+    ++search->count;
+    if(search->entry && search->count == 1)
+        *search->entry = *entry;
+    return 0;
+}
+
+/* looks up a name in a directory, as far as it is listed */
+int fatimg_find(const struct fatimg* img, uint32_t dir, const char* name, struct fatimg_entry* entry)
+{
+    return fatimg_count(img, dir, name) > 0 && (fatimg_list(img, dir, fatimg_search_callback, &(struct fatimg_search) { name, entry, 0 }), 1);
+}
+
+/* counts the listed entries of a directory with a name */
+int fatimg_count(const struct fatimg* img, uint32_t dir, const char* name)
+{
+    struct fatimg_search search = { name, 0, 0 };
+    fatimg_list(img, dir, fatimg_search_callback, &search);
+    return search.count;
+}
+
+/* counts all listed entries of a directory, including . and .. */
+uint32_t fatimg_entries(const struct fatimg* img, uint32_t dir)
+{
+    return fatimg_count(img, dir, 0);
+}
+
+uint32_t fatimg_read(const struct fatimg* img, const struct fatimg_entry* entry, uint8_t* buffer, uint32_t length)
+{
+    uint32_t cluster = entry->cluster;
+    uint32_t done = 0;
+    if(length > entry->size)
+        length = entry->size;
+    while(done < length && fatimg_is_cluster(img, cluster))
+    {
+        uint32_t part = length - done < img->cluster_size ? length - done : img->cluster_size;
+        memcpy(buffer + done, fatimg_cluster(img, cluster), part);
+        done += part;
+        cluster = fatimg_get_fat(img, cluster, 0);
+    }
+    return done;
+}
+
+struct fatimg_checker
+{
+    const struct fatimg* img;
+    uint8_t* owned;
+    char* problem;
+    unsigned int problem_size;
+    unsigned int depth;
+};
+
+static int fatimg_check_dir(struct fatimg_checker* checker, uint32_t dir);
+
+/* marks the clusters of a chain as owned, returns their number or -1 on errors */
+static long fatimg_check_chain(struct fatimg_checker* checker, uint32_t cluster, const char* name)
+{
+    const struct fatimg* img = checker->img;
+    long length = 0;
+    while(cluster)
+    {
+        if(!fatimg_is_cluster(img, cluster))
+        {
+            snprintf(checker->problem, checker->problem_size, "%s: chain leads to invalid cluster %u", name, (unsigned int) cluster);
+            return -1;
+        }
+        if(checker->owned[cluster])
+        {
+            snprintf(checker->problem, checker->problem_size, "%s: cluster %u is cross-linked", name, (unsigned int) cluster);
+            return -1;
+        }
+        checker->owned[cluster] = 1;
+        ++length;
+
+        uint32_t next = fatimg_get_fat(img, cluster, 0);
+        if(next == 0)
+        {
+            snprintf(checker->problem, checker->problem_size, "%s: chain leads to free cluster %u", name, (unsigned int) cluster);
+            return -1;
+        }
+        if(next >= (img->fat32 ? 0x0ffffff8 : 0xfff8))
+            break;
+        cluster = next;
+    }
+    return length;
+}
+
+static int fatimg_check_callback(const struct fatimg_entry* entry, void* p)
+{
+    struct fatimg_checker* checker = p;
+    if(!strcmp(entry->name, ".") || !strcmp(entry->name, ".."))
+        return 0;
+
+    long length = fatimg_check_chain(checker, entry->cluster, entry->name);
+    if(length < 0)
+        return 1;
+
+    if(entry->attributes & FATIMG_ATTRIB_DIR)
+        return fatimg_check_dir(checker, entry->cluster);
+
+    uint32_t needed = (entry->size + checker->img->cluster_size - 1) / checker->img->cluster_size;
+    if((uint32_t) length != needed)
+    {
+        snprintf(checker->problem, checker->problem_size, "%s: %u bytes stored in %ld clusters", entry->name, (unsigned int) entry->size, length);
+        return 1;
+    }
+    return 0;
+}
+
+static int fatimg_check_dir(struct fatimg_checker* checker, uint32_t dir)
+{
+    if(++checker->depth > 16)
+    {
+        snprintf(checker->problem, checker->problem_size, "directories nested too deeply");
+        return 1;
+    }
+    int result = fatimg_list(checker->img, dir, fatimg_check_callback, checker);
+    --checker->depth;
+    return result;
+}
+
+/* checks the consistency of the filesystem, returns 1 if it is fine */
+int fatimg_check(const struct fatimg* img, char* problem, unsigned int problem_size)
+{
+    problem[0] = 0;
+
+    uint8_t copy;
+    for(copy = 1; copy < img->fat_copies; ++copy)
+    {
+        if(memcmp(img->mem + img->fat_offset, img->mem + img->fat_offset + copy * img->fat_size, img->fat_size))
+        {
+            snprintf(problem, problem_size, "fat copy %u differs from the first", copy);
+            return 0;
+        }
+    }
+
+    struct fatimg_checker checker;
+    checker.img = img;
+    checker.owned = calloc(1, img->clusters + 2);
+    checker.problem = problem;
+    checker.problem_size = problem_size;
+    checker.depth = 0;
+
+    int ok = 1;
+    if(img->fat32 && fatimg_check_chain(&checker, img->root_cluster, "root directory") < 0)
+        ok = 0;
+    if(ok && fatimg_check_dir(&checker, 0))
+        ok = 0;
+
+    uint32_t cluster;
+    for(cluster = 2; ok && cluster < img->clusters + 2; ++cluster)
+    {
+        if(fatimg_get_fat(img, cluster, 0) != 0 && !checker.owned[cluster])
+        {
+            snprintf(problem, problem_size, "cluster %u is lost", (unsigned int) cluster);
+            ok = 0;
+        }
+    }
+    free(checker.owned);
+
+    if(ok && img->fat32)
+    {
+        uint32_t free_count = get32(img->mem + img->fsinfo_offset + 488);
+        if(free_count != 0xffffffff && free_count != fatimg_free_clusters(img))
+        {
+            snprintf(problem, problem_size, "fsinfo free count %u, %u clusters free", (unsigned int) free_count, (unsigned int) fatimg_free_clusters(img));
+            ok = 0;
+        }
+    }
+
+    return ok;
+}
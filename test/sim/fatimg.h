@@ -0,0 +1,66 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef FATIMG_H
+#define FATIMG_H
+
+#include <stdint.h>
+
+/*
+ * Builds and checks FAT16 and FAT32 images in memory, independently
+ * of fat16.c. The images have a partition table with a single primary
+ * partition, two FAT copies and, for FAT16, a root directory of 512
+ * entries. Directories are identified by their first cluster, 0 being
+ * the root directory.
+ */
+
+struct fatimg
+{
+    uint8_t* mem;
+    uint32_t size;
+    uint8_t fat32;
+    uint8_t fat_copies;
+    uint32_t cluster_size;
+    uint32_t fat_offset;
+    uint32_t fat_size;
+    uint32_t root_offset;
+    uint32_t root_entries;
+    uint32_t root_cluster;
+    uint32_t data_offset;
+    uint32_t fsinfo_offset;
+    uint32_t clusters;
+};
+
+/* a directory entry found by fatimg_find() */
+struct fatimg_entry
+{
+    char name[256];
+    uint8_t attributes;
+    uint32_t cluster;
+    uint32_t size;
+    /* image offset of the 8.3 entry */
+    uint32_t offset;
+};
+
+void fatimg_format(struct fatimg* img, uint8_t* mem, uint32_t size, uint8_t fat32, uint8_t sectors_per_cluster);
+int fatimg_open(struct fatimg* img, uint8_t* mem, uint32_t size);
+
+uint32_t fatimg_get_fat(const struct fatimg* img, uint32_t cluster, uint8_t copy);
+void fatimg_set_fat(struct fatimg* img, uint32_t cluster, uint32_t value);
+uint8_t* fatimg_cluster(const struct fatimg* img, uint32_t cluster);
+uint32_t fatimg_free_clusters(const struct fatimg* img);
+uint32_t fatimg_fragments(const struct fatimg* img, uint32_t cluster);
+
+uint32_t fatimg_add_file(struct fatimg* img, uint32_t dir, const char* name, const uint8_t* data, uint32_t size, uint32_t stride);
+uint32_t fatimg_add_dir(struct fatimg* img, uint32_t dir, const char* name);
+void fatimg_fill(struct fatimg* img, uint32_t percent);
+
+int fatimg_find(const struct fatimg* img, uint32_t dir, const char* name, struct fatimg_entry* entry);
+int fatimg_count(const struct fatimg* img, uint32_t dir, const char* name);
+uint32_t fatimg_entries(const struct fatimg* img, uint32_t dir);
+uint32_t fatimg_read(const struct fatimg* img, const struct fatimg_entry* entry, uint8_t* buffer, uint32_t length);
+int fatimg_check(const struct fatimg* img, char* problem, unsigned int problem_size);
+
+#endif
@@ -0,0 +1,94 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "io.h"
+#include "sd_raw.h"
+#include "test.h"
+
+struct io_stats io_stats;
+
+unsigned char __real_sd_raw_read(offset_t offset, unsigned char* buffer, unsigned short length);
+unsigned char __real_sd_raw_read_interval(offset_t offset, unsigned char* buffer, unsigned short interval, unsigned short length, sd_raw_interval_handler callback, void* p);
+unsigned char __real_sd_raw_read_blocks(offset_t offset, unsigned char* buffer, unsigned short count, sd_raw_interval_handler callback, void* p);
+unsigned char __real_sd_raw_write(offset_t offset, const unsigned char* buffer, unsigned short length);
+
+static enum io_area io_area(offset_t offset)
+{
+    if(!test_img.mem || offset < test_img.fat_offset)
+        return IO_AREA_OTHER;
+    if(offset < test_img.root_offset)
+        return IO_AREA_FAT;
+    if(offset < test_img.data_offset)
+        return IO_AREA_ROOT;
+    return IO_AREA_DATA;
+}
+
+void io_reset(void)
+{
+    memset(&io_stats, 0, sizeof(io_stats));
+}
+
+unsigned long io_reads(void)
+{
+    unsigned long reads = 0;
+    int area;
+    for(area = 0; area < IO_AREAS; ++area)
+        reads += io_stats.reads[area];
+    return reads;
+}
+
+unsigned long io_writes(void)
+{
+    unsigned long writes = 0;
+    int area;
+    for(area = 0; area < IO_AREAS; ++area)
+        writes += io_stats.writes[area];
+    return writes;
+}
+
+unsigned char __wrap_sd_raw_read(offset_t offset, unsigned char* buffer, unsigned short length)
+{
+    ++io_stats.reads[io_area(offset)];
+    io_stats.read_bytes += length;
+    return __real_sd_raw_read(offset, buffer, length);
+}
+
+/* the callback of an interval read, which counts the intervals it is handed */
+struct io_interval
+{
+    sd_raw_interval_handler callback;
+    void* p;
+    unsigned short interval;
+};
+
+static unsigned char io_interval_callback(unsigned char* buffer, offset_t offset, void* p)
+{
+    struct io_interval* arg = p;
+    io_stats.read_bytes += arg->interval;
+    return arg->callback(buffer, offset, arg->p);
+}
+
+unsigned char __wrap_sd_raw_read_interval(offset_t offset, unsigned char* buffer, unsigned short interval, unsigned short length, sd_raw_interval_handler callback, void* p)
+{
+    /* the callback may stop the read early, only what it got is counted */
+    struct io_interval arg = { callback, p, interval };
+    ++io_stats.reads[io_area(offset)];
+    return __real_sd_raw_read_interval(offset, buffer, interval, length, io_interval_callback, &arg);
+}
+
+unsigned char __wrap_sd_raw_read_blocks(offset_t offset, unsigned char* buffer, unsigned short count, sd_raw_interval_handler callback, void* p)
+{
+    ++io_stats.reads[io_area(offset)];
+    io_stats.read_bytes += count * 512UL;
+    return __real_sd_raw_read_blocks(offset, buffer, count, callback, p);
+}
+
+unsigned char __wrap_sd_raw_write(offset_t offset, const unsigned char* buffer, unsigned short length)
+{
+    ++io_stats.writes[io_area(offset)];
+    io_stats.write_bytes += length;
+    return __real_sd_raw_write(offset, buffer, length);
+}
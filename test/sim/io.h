@@ -0,0 +1,44 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef IO_H
+#define IO_H
+
+/*
+ * Counts the block device accesses of the FAT code.
+ *
+ * The tests are linked with sd_raw_read(), sd_raw_read_interval(),
+ * sd_raw_read_blocks() and sd_raw_write() wrapped, so the calls made
+ * through the partition's device functions are counted here before
+ * they reach sd_raw. Accesses are sorted by the area of test_img they
+ * start in.
+ */
+
+enum io_area
+{
+    IO_AREA_OTHER,
+    IO_AREA_FAT,
+    IO_AREA_ROOT,
+    IO_AREA_DATA,
+    IO_AREAS
+};
+
+struct io_stats
+{
+    /* calls per area */
+    unsigned long reads[IO_AREAS];
+    unsigned long writes[IO_AREAS];
+    /* bytes transferred in all areas, for interval reads the intervals handed to the callback */
+    unsigned long read_bytes;
+    unsigned long write_bytes;
+};
+
+extern struct io_stats io_stats;
+
+void io_reset(void);
+unsigned long io_reads(void);
+unsigned long io_writes(void);
+
+#endif
@@ -0,0 +1,57 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Host stand-ins for the LPC214x registers used by the SD card driver.
+ *
+ * This header is included ahead of every source file of a host test
+ * build and keeps the real LPC214x.h out. Plain registers become
+ * variables. The SPI0 and SSP data and status registers, and the
+ * GPIO set and clear registers driving the card's chip select, are
+ * routed through accessor functions of spi.c, which forward the bytes
+ * to the card model and account for the time they take.
+ */
+
+#ifndef LPC214X_SIM_H
+#define LPC214X_SIM_H
+
+/* keep the target's register definitions out */
+#define __LPC214x_H
+
+/* plain registers without side effects */
+extern volatile unsigned long sim_reg[32];
+
+#define PINSEL0 sim_reg[0]
+#define PINSEL1 sim_reg[1]
+#define PINSEL2 sim_reg[2]
+#define IODIR0 sim_reg[3]
+#define IOPIN0 sim_reg[4]
+#define IODIR1 sim_reg[5]
+#define IOPIN1 sim_reg[6]
+#define S0SPCR sim_reg[7]
+#define S0SPCCR sim_reg[8]
+#define SSPCR0 sim_reg[9]
+#define SSPCR1 sim_reg[10]
+#define SSPCPSR sim_reg[11]
+#define VPBDIV sim_reg[12]
+
+/* registers whose accesses are seen by the SPI and card models */
+volatile unsigned long* sim_gpio_set(int port);
+volatile unsigned long* sim_gpio_clr(int port);
+volatile unsigned long* sim_spi0_dr(void);
+unsigned long sim_spi0_sr(void);
+volatile unsigned long* sim_ssp_dr(void);
+unsigned long sim_ssp_sr(void);
+
+#define IOSET0 (*sim_gpio_set(0))
+#define IOCLR0 (*sim_gpio_clr(0))
+#define IOSET1 (*sim_gpio_set(1))
+#define IOCLR1 (*sim_gpio_clr(1))
+#define S0SPDR (*sim_spi0_dr())
+#define S0SPSR (sim_spi0_sr())
+#define SSPDR (*sim_ssp_dr())
+#define SSPSR (sim_ssp_sr())
+
+#endif
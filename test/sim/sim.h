@@ -0,0 +1,37 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+/*
+ * Timing of the simulated LPC2148.
+ *
+ * Time advances in PCLK cycles. Every access of a modelled peripheral
+ * register costs SIM_ACCESS_CYCLES, and the SPI0 and SSP shift
+ * registers take 8 SPI clocks per byte. Instructions executed between
+ * register accesses are not charged.
+ */
+
+#define SIM_PCLK 60000000ULL
+/* PCLK cycles of one access to a peripheral register */
+#define SIM_ACCESS_CYCLES 4
+
+#define SIM_US(us) ((unsigned long long) (us) * (SIM_PCLK / 1000000))
+
+/* PCLK cycles elapsed so far */
+extern unsigned long long sim_cycles;
+/* frames lost because the SSP receive FIFO was full */
+extern unsigned long sim_ssp_overruns;
+
+/* the port and pin of the card's chip select, as in sd_raw_config.h */
+#define SIM_CS_PORT 0
+#define SIM_CS_PIN 7
+
+void sim_reset(void);
+void sim_sync(void);
+double sim_ms(unsigned long long cycles);
+
+#endif
@@ -0,0 +1,274 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include "lpc214x_sim.h"
+#include "sim.h"
+#include "card.h"
+
+/*
+ * SPI0, SSP and GPIO register models.
+ *
+ * The accessors of the data and GPIO set/clear registers return a
+ * pointer to a variable the driver then reads or writes. Whether it
+ * wrote is only known afterwards, so each accessor stores a value with
+ * SIM_UNTOUCHED set, and the next access of a modelled register checks
+ * whether that value has been changed, by an assignment or by |=. Only
+ * then the write takes effect, which keeps all accesses in program
+ * order.
+ */
+
+#define SIM_UNTOUCHED 0x80000000UL
+
+/* SPI0 status register: transfer complete */
+#define S0SPSR_SPIF 0x80
+/* SSP status register: transmit FIFO not full, receive FIFO not empty */
+#define SSPSR_TNF 0x02
+#define SSPSR_RNE 0x04
+#define SSP_FIFO_SIZE 8
+
+volatile unsigned long sim_reg[32];
+unsigned long long sim_cycles;
+unsigned long sim_ssp_overruns;
+
+/* the register value handed out by the last accessor, and where it belongs */
+static volatile unsigned long sim_access_value;
+static unsigned long sim_access_initial;
+static enum
+{
+    SIM_ACCESS_NONE,
+    SIM_ACCESS_SET0,
+    SIM_ACCESS_CLR0,
+    SIM_ACCESS_SET1,
+    SIM_ACCESS_CLR1,
+    SIM_ACCESS_SPI0,
+    SIM_ACCESS_SSP
+} sim_access;
+
+/* SPI0: end of the transfer in progress, received byte, status flag */
+static unsigned long long spi0_end;
+static uint8_t spi0_active;
+static uint8_t spi0_rx;
+static uint8_t spi0_spif;
+
+/* SSP: transmit FIFO with the times the frames were written */
+static uint8_t ssp_tx[SSP_FIFO_SIZE];
+static unsigned long long ssp_tx_time[SSP_FIFO_SIZE];
+static uint8_t ssp_tx_count;
+static uint8_t ssp_rx[SSP_FIFO_SIZE];
+static uint8_t ssp_rx_count;
+/* the frame in the shift register and when it is done */
+static uint8_t ssp_shifting;
+static uint8_t ssp_shift_byte;
+static unsigned long long ssp_shift_end;
+/* when the shift register became free */
+static unsigned long long ssp_free_at;
+
+static unsigned long spi_clock(unsigned long prescaler)
+{
+    if(prescaler < 2)
+        prescaler = 2;
+    return SIM_PCLK / prescaler;
+}
+
+static void spi0_start(uint8_t b)
+{
+    unsigned long prescaler = S0SPCCR < 8 ? 8 : S0SPCCR;
+    spi0_end = sim_cycles + 8 * prescaler;
+    spi0_rx = card_exchange(b, spi0_end, spi_clock(prescaler));
+    spi0_active = 1;
+    spi0_spif = 0;
+}
+
+/* moves the SSP frames on until sim_cycles */
+static void ssp_advance(void)
+{
+    while(1)
+    {
+        if(ssp_shifting)
+        {
+            if(ssp_shift_end > sim_cycles)
+                return;
+
+            uint8_t b = card_exchange(ssp_shift_byte, ssp_shift_end, spi_clock(SSPCPSR));
+            if(ssp_rx_count < SSP_FIFO_SIZE)
+                ssp_rx[ssp_rx_count++] = b;
+            else
+                ++sim_ssp_overruns;
+            ssp_shifting = 0;
+            ssp_free_at = ssp_shift_end;
+        }
+
+        if(!ssp_tx_count)
+            return;
+
+        unsigned long long start = ssp_tx_time[0] > ssp_free_at ? ssp_tx_time[0] : ssp_free_at;
+        if(start > sim_cycles)
+            return;
+
+        ssp_shifting = 1;
+        ssp_shift_byte = ssp_tx[0];
+        ssp_shift_end = start + 8 * (SSPCPSR < 2 ? 2 : SSPCPSR);
+        uint8_t i;
+        for(i = 1; i < ssp_tx_count; ++i)
+        {
+            ssp_tx[i - 1] = ssp_tx[i];
+            ssp_tx_time[i - 1] = ssp_tx_time[i];
+        }
+        --ssp_tx_count;
+    }
+}
+
+/* applies the access handed out last */
+static void sim_commit(void)
+{
+    unsigned long value = sim_access_value;
+    int written = value != sim_access_initial;
+
+    switch(sim_access)
+    {
+        case SIM_ACCESS_SET0:
+            if(written && (value & (1UL << SIM_CS_PIN)) && SIM_CS_PORT == 0)
+                card_select(0);
+            break;
+        case SIM_ACCESS_CLR0:
+            if(written && (value & (1UL << SIM_CS_PIN)) && SIM_CS_PORT == 0)
+                card_select(1);
+            break;
+        case SIM_ACCESS_SET1:
+            if(written && (value & (1UL << SIM_CS_PIN)) && SIM_CS_PORT == 1)
+                card_select(0);
+            break;
+        case SIM_ACCESS_CLR1:
+            if(written && (value & (1UL << SIM_CS_PIN)) && SIM_CS_PORT == 1)
+                card_select(1);
+            break;
+        case SIM_ACCESS_SPI0:
+            if(written)
+                spi0_start(value & 0xff);
+            break;
+        case SIM_ACCESS_SSP:
+            if(written)
+            {
+                if(ssp_tx_count < SSP_FIFO_SIZE)
+                {
+                    ssp_tx[ssp_tx_count] = value & 0xff;
+                    ssp_tx_time[ssp_tx_count] = sim_cycles;
+                    ++ssp_tx_count;
+                }
+                else
+                {
+                    ++sim_ssp_overruns;
+                }
+            }
+            else if(ssp_rx_count)
+            {
+                uint8_t i;
+                for(i = 1; i < ssp_rx_count; ++i)
+                    ssp_rx[i - 1] = ssp_rx[i];
+                --ssp_rx_count;
+            }
+            break;
+        case SIM_ACCESS_NONE:
+            break;
+    }
+
+    sim_access = SIM_ACCESS_NONE;
+}
+
+/* starts an access of a modelled register */
+static volatile unsigned long* sim_begin(int access, unsigned long value)
+{
+    sim_commit();
+    sim_cycles += SIM_ACCESS_CYCLES;
+
+    sim_access = access;
+    sim_access_initial = value | SIM_UNTOUCHED;
+    sim_access_value = sim_access_initial;
+    return &sim_access_value;
+}
+
+volatile unsigned long* sim_gpio_set(int port)
+{
+    return sim_begin(port ? SIM_ACCESS_SET1 : SIM_ACCESS_SET0, 0);
+}
+
+volatile unsigned long* sim_gpio_clr(int port)
+{
+    return sim_begin(port ? SIM_ACCESS_CLR1 : SIM_ACCESS_CLR0, 0);
+}
+
+volatile unsigned long* sim_spi0_dr(void)
+{
+    /* reading the data register clears the status flag */
+    volatile unsigned long* reg = sim_begin(SIM_ACCESS_SPI0, spi0_rx);
+    spi0_spif = 0;
+    return reg;
+}
+
+unsigned long sim_spi0_sr(void)
+{
+    sim_commit();
+    sim_cycles += SIM_ACCESS_CYCLES;
+
+    if(spi0_active && sim_cycles >= spi0_end)
+    {
+        spi0_active = 0;
+        spi0_spif = 1;
+    }
+
+    return spi0_spif ? S0SPSR_SPIF : 0;
+}
+
+volatile unsigned long* sim_ssp_dr(void)
+{
+    sim_commit();
+    ssp_advance();
+    return sim_begin(SIM_ACCESS_SSP, ssp_rx_count ? ssp_rx[0] : 0);
+}
+
+unsigned long sim_ssp_sr(void)
+{
+    sim_commit();
+    sim_cycles += SIM_ACCESS_CYCLES;
+    ssp_advance();
+
+    unsigned long status = 0;
+    if(ssp_tx_count < SSP_FIFO_SIZE)
+        status |= SSPSR_TNF;
+    if(ssp_rx_count)
+        status |= SSPSR_RNE;
+    return status;
+}
+
+/* applies the last register access, to be called before looking at the card */
+void sim_sync(void)
+{
+    sim_commit();
+}
+
+/* resets the time and the peripherals, the card is reported present */
+void sim_reset(void)
+{
+    unsigned int i;
+    for(i = 0; i < sizeof(sim_reg) / sizeof(sim_reg[0]); ++i)
+        sim_reg[i] = 0;
+    IOPIN0 = 0xffffffff;
+    IOPIN1 = 0xffffffff;
+
+    sim_access = SIM_ACCESS_NONE;
+    sim_cycles = 0;
+    sim_ssp_overruns = 0;
+    spi0_active = 0;
+    spi0_spif = 0;
+    ssp_tx_count = 0;
+    ssp_rx_count = 0;
+    ssp_shifting = 0;
+    ssp_free_at = 0;
+}
+
+double sim_ms(unsigned long long cycles)
+{
+    return cycles * 1000.0 / SIM_PCLK;
+}
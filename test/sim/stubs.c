@@ -0,0 +1,24 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rprintf.h"
+
+/* the driver's messages are printed only if SIMVERBOSE is set */
+void rprintf(char const* format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    if(getenv("SIMVERBOSE"))
+        vprintf(format, ap);
+    va_end(ap);
+}
+
+void rprintf_devopen(int (*put)(int))
+{
+    (void) put;
+}
@@ -0,0 +1,97 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include "test.h"
+#include "io.h"
+#include "rootdir.h"
+#include "sd_raw.h"
+
+int test_failures;
+struct fatimg test_img;
+
+/* the counters of the block cache when the stats were last reset */
+static struct sd_raw_cache_stats test_cache_before;
+
+/* inserts a card of size bytes holding an empty filesystem */
+void test_card(enum card_type type, uint32_t size, uint8_t fat32, uint8_t sectors_per_cluster)
+{
+    /* keep the driver's messages in order with a crash */
+    setvbuf(stdout, 0, _IONBF, 0);
+    card_insert(type, size, size);
+    fatimg_format(&test_img, card_mem, size, fat32, sectors_per_cluster);
+}
+
+/* fills a buffer with pseudo-random bytes, the same for the same seed */
+void test_random(uint8_t* buffer, uint32_t size, unsigned int seed)
+{
+    uint32_t i;
+
+    srand(seed);
+    for(i = 0; i < size; ++i)
+        buffer[i] = rand();
+}
+
+/* adds count empty files to a directory of test_img, named by a format taking their number */
+void test_add_files(uint32_t dir, const char* format, unsigned int count)
+{
+    char name[16];
+    unsigned int i;
+
+    for(i = 0; i < count; ++i)
+    {
+        snprintf(name, sizeof(name), format, i);
+        fatimg_add_file(&test_img, dir, name, 0, 0, 1);
+    }
+}
+
+/* initializes the card and opens the root directory, ends the test on failure */
+int test_mount(void)
+{
+    if(sd_raw_init() && openroot() == 0)
+        return 1;
+
+    printf("mounting the card failed\n");
+    exit(1);
+}
+
+/* starts counting card commands, device accesses and cache accesses from zero */
+void test_reset_stats(void)
+{
+    card_reset_stats();
+    io_reset();
+    sd_raw_get_cache_stats(&test_cache_before);
+}
+
+/* returns the counters of the block cache since test_reset_stats() */
+void test_cache_stats(struct sd_raw_cache_stats* stats)
+{
+    sd_raw_get_cache_stats(stats);
+    stats->hits -= test_cache_before.hits;
+    stats->misses -= test_cache_before.misses;
+    stats->writebacks -= test_cache_before.writebacks;
+    stats->prefetch_hits -= test_cache_before.prefetch_hits;
+    stats->prefetch_wasted -= test_cache_before.prefetch_wasted;
+}
+
+/* writes back the driver's cache and checks the filesystem, returns 1 if it is consistent */
+int test_fs_ok(void)
+{
+    char problem[128];
+
+    sd_raw_sync();
+    sim_sync();
+    if(fatimg_check(&test_img, problem, sizeof(problem)))
+        return 1;
+
+    printf("filesystem check: %s\n", problem);
+    return 0;
+}
+
+int test_done(const char* name)
+{
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include "card.h"
+#include "fatimg.h"
+#include "sim.h"
+
+/*
+ * Helpers shared by the host tests.
+ *
+ * A test inserts a card holding a freshly formatted image, brings the
+ * driver up like main.c does, and checks the results with CHECK().
+ * test_done() prints the verdict and returns the exit code.
+ */
+
+#define CHECK(cond) \
+    do \
+    { \
+        if(!(cond)) \
+        { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++test_failures; \
+        } \
+    } while(0)
+
+struct sd_raw_cache_stats;
+
+extern int test_failures;
+
+/* the filesystem on the inserted card */
+extern struct fatimg test_img;
+
+/* the handles test_mount() opens, which rootdir.c keeps */
+extern struct partition_struct* partition;
+extern struct fat16_fs_struct* fs;
+extern struct fat16_dir_struct* dd;
+
+void test_card(enum card_type type, uint32_t size, uint8_t fat32, uint8_t sectors_per_cluster);
+void test_random(uint8_t* buffer, uint32_t size, unsigned int seed);
+void test_add_files(uint32_t dir, const char* format, unsigned int count);
+int test_mount(void);
+void test_reset_stats(void);
+void test_cache_stats(struct sd_raw_cache_stats* stats);
+int test_fs_ok(void);
+int test_done(const char* name);
+
+#endif
@@ -0,0 +1,67 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Writes a file onto volumes filled to 10%, 50% and 90% with clusters
+ * spread evenly. The allocator has to find free clusters without
+ * searching the FAT from its start for every cluster, and the file's
+ * chain is not followed from its start whenever it grows.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define FILE_SIZE (400 * 1024UL)
+
+static void write_on_filled(unsigned int percent)
+{
+    uint8_t buffer[512];
+    uint32_t written;
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    fatimg_fill(&test_img, percent);
+    unsigned int fat_sectors = (test_img.clusters + 2) * 2 / 512 + 1;
+    test_mount();
+
+    io_reset();
+    struct fat16_file_struct* fd = root_open_new("new.bin");
+    CHECK(fd);
+    for(written = 0; written < FILE_SIZE; written += sizeof(buffer))
+    {
+        memset(buffer, written / 512, sizeof(buffer));
+        CHECK(fat16_write_file(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    }
+    fat16_close_file(fd);
+    CHECK(test_fs_ok());
+
+    struct fatimg_entry entry;
+    CHECK(fatimg_find(&test_img, 0, "new.bin", &entry) && entry.size == FILE_SIZE);
+    uint8_t* copy = malloc(FILE_SIZE);
+    CHECK(fatimg_read(&test_img, &entry, copy, FILE_SIZE) == FILE_SIZE);
+    CHECK(copy[0] == 0 && copy[FILE_SIZE - 1] == (uint8_t) (FILE_SIZE / 512 - 1));
+    free(copy);
+
+    printf("%u%% filled: %lu fat reads for %lu clusters in %u fragments, the fat has %u sectors\n",
+           percent, io_stats.reads[IO_AREA_FAT], FILE_SIZE / test_img.cluster_size,
+           (unsigned int) fatimg_fragments(&test_img, entry.cluster), fat_sectors);
+    /* one pass to find free runs, another one while the chain is linked */
+    CHECK(io_stats.reads[IO_AREA_FAT] <= 2 * fat_sectors);
+    CHECK(fat16_get_fs_free(fs) == (offset_t) fatimg_free_clusters(&test_img) * test_img.cluster_size);
+    CHECK(card_stats.errors == 0);
+}
+
+int main(void)
+{
+    write_on_filled(10);
+    write_on_filled(50);
+    write_on_filled(90);
+
+    return test_done("alloc");
+}
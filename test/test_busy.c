@@ -0,0 +1,76 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "sd_raw.h"
+
+/*
+ * Checks that block writes return while the card is still programming,
+ * so that the host can work meanwhile, and that the busy time is waited
+ * out before the card is used again.
+ */
+
+#define CARD_SIZE (8 * 1024 * 1024UL)
+
+/* writes a single block, returns the cycles the call took */
+static unsigned long long write_block(offset_t offset, const uint8_t* data)
+{
+    unsigned long long start = sim_cycles;
+    CHECK(sd_raw_write_start(offset, 1));
+    CHECK(sd_raw_write_next(offset, data));
+    sim_sync();
+    return sim_cycles - start;
+}
+
+int main(void)
+{
+    uint8_t data[512];
+    uint8_t block[512];
+    memset(data, 0x5a, sizeof(data));
+
+    card_insert(CARD_SDSC, CARD_SIZE, CARD_SIZE);
+    card_config.write_busy = SIM_US(2000);
+    CHECK(sd_raw_init());
+
+    /* the write returns before the card is done */
+    unsigned long long cycles = write_block(0x100000, data);
+    printf("block write returned after %.2fms, the card programs for %.2fms\n", sim_ms(cycles), sim_ms(card_config.write_busy));
+    CHECK(cycles < card_config.write_busy);
+    CHECK(card_is_busy());
+    CHECK(memcmp(card_mem + 0x100000, data, sizeof(data)) == 0);
+
+    /* the next command waits for the card */
+    card_reset_stats();
+    CHECK(sd_raw_read(0x200000, block, sizeof(block)));
+    CHECK(card_stats.busy_bytes > 0);
+    CHECK(card_stats.errors == 0);
+
+    /* host work during the busy time saves the wait */
+    write_block(0x100000 + 512, data);
+    sim_cycles += card_config.write_busy;
+    card_reset_stats();
+    CHECK(sd_raw_read(0x300000, block, sizeof(block)));
+    CHECK(card_stats.busy_bytes == 0);
+
+    /* the same for blocks of a stream */
+    card_config.stream_write_busy = SIM_US(1000);
+    CHECK(sd_raw_write_start(0x400000, 2));
+    CHECK(sd_raw_write_next(0x400000, data));
+    CHECK(card_is_busy());
+    card_reset_stats();
+    CHECK(sd_raw_write_next(0x400200, data));
+    CHECK(card_stats.busy_bytes > 0);
+    sd_raw_write_stop();
+    CHECK(card_is_busy());
+
+    /* sd_raw_sync() leaves the card ready */
+    CHECK(sd_raw_sync());
+    CHECK(!card_is_busy());
+    CHECK(memcmp(card_mem + 0x400000 + 512, data, sizeof(data)) == 0);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("busy");
+}
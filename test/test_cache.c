@@ -0,0 +1,108 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "sd_raw.h"
+#include "sd_raw_config.h"
+
+/*
+ * Checks the replacement, write-back and pinning of the block cache,
+ * by watching which accesses reach the card.
+ */
+
+#define CARD_SIZE (8 * 1024 * 1024UL)
+/* blocks far enough apart not to be read as a sequence */
+#define BLOCK(n) (0x100000 + (offset_t) (n) * 16 * 512)
+#define PINNED 0x10000
+
+static unsigned int hits(void)
+{
+    struct sd_raw_cache_stats stats;
+    test_cache_stats(&stats);
+    return stats.hits;
+}
+
+static unsigned int misses(void)
+{
+    struct sd_raw_cache_stats stats;
+    test_cache_stats(&stats);
+    return stats.misses;
+}
+
+static unsigned int writebacks(void)
+{
+    struct sd_raw_cache_stats stats;
+    test_cache_stats(&stats);
+    return stats.writebacks;
+}
+
+int main(void)
+{
+    uint8_t buffer[16];
+    unsigned int i;
+
+    card_insert(CARD_SDSC, CARD_SIZE, CARD_SIZE);
+    for(i = 0; i < SD_RAW_CACHE_LINES + 1; ++i)
+        memset(card_mem + BLOCK(i), i + 1, 512);
+    CHECK(sd_raw_init());
+
+    /* blocks read once are served from the cache afterwards */
+    test_reset_stats();
+    for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+        CHECK(sd_raw_read(BLOCK(i) + 100, buffer, sizeof(buffer)) && buffer[0] == i + 1);
+    for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+        CHECK(sd_raw_read(BLOCK(i) + 200, buffer, sizeof(buffer)) && buffer[0] == i + 1);
+    CHECK(misses() == SD_RAW_CACHE_LINES && hits() == SD_RAW_CACHE_LINES);
+    CHECK(card_stats.blocks_read == SD_RAW_CACHE_LINES);
+
+    /* a further block replaces the one used least recently */
+    CHECK(sd_raw_read(BLOCK(1), buffer, sizeof(buffer)));
+    test_reset_stats();
+    CHECK(sd_raw_read(BLOCK(SD_RAW_CACHE_LINES), buffer, sizeof(buffer)) && buffer[0] == SD_RAW_CACHE_LINES + 1);
+    CHECK(sd_raw_read(BLOCK(1), buffer, sizeof(buffer)));
+    CHECK(hits() == 1 && misses() == 1);
+    CHECK(sd_raw_read(BLOCK(0), buffer, sizeof(buffer)) && buffer[0] == 1);
+    CHECK(misses() == 2);
+
+    /* partial writes of cached blocks stay in the cache until they are synced */
+    test_reset_stats();
+    memset(buffer, 0xaa, sizeof(buffer));
+    CHECK(sd_raw_write(BLOCK(1) + 300, buffer, sizeof(buffer)));
+    CHECK(sd_raw_write(BLOCK(1) + 400, buffer, sizeof(buffer)));
+    CHECK(card_stats.blocks_read == 0 && card_stats.blocks_written == 0);
+    CHECK(card_mem[BLOCK(1) + 300] == 2);
+    CHECK(sd_raw_sync());
+    CHECK(writebacks() == 1 && card_stats.blocks_written == 1);
+    CHECK(card_mem[BLOCK(1) + 300] == 0xaa && card_mem[BLOCK(1) + 415] == 0xaa && card_mem[BLOCK(1) + 416] == 2);
+
+    /* modified blocks are written back when they are replaced */
+    test_reset_stats();
+    for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+        CHECK(sd_raw_write(BLOCK(i) + 10, buffer, sizeof(buffer)));
+    CHECK(card_stats.blocks_written == 0);
+    for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+        CHECK(sd_raw_read(BLOCK(20 + i), buffer, sizeof(buffer)));
+    CHECK(writebacks() == SD_RAW_CACHE_LINES && card_stats.blocks_written == SD_RAW_CACHE_LINES);
+    for(i = 0; i < SD_RAW_CACHE_LINES; ++i)
+        CHECK(card_mem[BLOCK(i) + 10] == 0xaa);
+
+    /* pinned blocks survive a stream of other blocks */
+    CHECK(sd_raw_cache_pin(PINNED, 2 * 512));
+    CHECK(sd_raw_read(PINNED, buffer, sizeof(buffer)));
+    CHECK(sd_raw_read(PINNED + 512, buffer, sizeof(buffer)));
+    for(i = 0; i < 10 * SD_RAW_CACHE_LINES; ++i)
+        CHECK(sd_raw_read(BLOCK(40 + i), buffer, sizeof(buffer)));
+    test_reset_stats();
+    CHECK(sd_raw_read(PINNED, buffer, sizeof(buffer)));
+    CHECK(sd_raw_read(PINNED + 512, buffer, sizeof(buffer)));
+    CHECK(hits() == 2 && card_stats.blocks_read == 0);
+    sd_raw_cache_unpin();
+
+    CHECK(sd_raw_sync());
+    CHECK(card_stats.errors == 0);
+
+    return test_done("cache");
+}
@@ -0,0 +1,58 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "sd_raw.h"
+#include "sd_raw_config.h"
+
+/*
+ * Checks the SPI clock sd_raw_init() derives from TRAN_SPEED, and the
+ * step down on a card which garbles data at that clock.
+ */
+
+#define CARD_SIZE (8 * 1024 * 1024UL)
+
+static void init_card(uint8_t tran_speed, unsigned long max_clock)
+{
+    card_insert(CARD_SDSC, CARD_SIZE, CARD_SIZE);
+    card_config.tran_speed = tran_speed;
+    card_config.max_clock = max_clock;
+    memset(card_mem, 0x3c, 512);
+    CHECK(sd_raw_init());
+}
+
+int main(void)
+{
+    /* 25MHz, 10MHz and 100MHz are beyond SPI0 */
+    CHECK(sd_raw_get_spi_prescaler(0x32) == SD_RAW_SPI_PRESCALE_MIN);
+    CHECK(sd_raw_get_spi_prescaler(0x0a) == SD_RAW_SPI_PRESCALE_MIN);
+    CHECK(sd_raw_get_spi_prescaler(0x0b) == SD_RAW_SPI_PRESCALE_MIN);
+    /* 2.5MHz and 1MHz, rounded up to even prescalers */
+    CHECK(sd_raw_get_spi_prescaler(0x31) == 24);
+    CHECK(sd_raw_get_spi_prescaler(0x09) == 60);
+    /* an invalid time value gives the slowest clock */
+    CHECK(sd_raw_get_spi_prescaler(0x02) == 254);
+
+    init_card(0x32, 0);
+    CHECK(sd_raw_get_spi_clock() == SD_RAW_PCLK / SD_RAW_SPI_PRESCALE_MIN);
+    CHECK(card_stats.commands[9] == 1);
+
+    init_card(0x31, 0);
+    CHECK(sd_raw_get_spi_clock() == 2500000);
+
+    /* a card which only works up to 4MHz makes the driver slow down */
+    init_card(0x32, 4000000);
+    printf("card limited to 4MHz: %luHz after %lu test reads\n", sd_raw_get_spi_clock(), card_stats.commands[17]);
+    CHECK(sd_raw_get_spi_clock() <= 4000000);
+    CHECK(sd_raw_get_spi_clock() > SD_RAW_PCLK / (SD_RAW_PCLK / 4000000 + 2));
+
+    uint8_t block[512];
+    CHECK(sd_raw_read(0, block, sizeof(block)));
+    CHECK(block[0] == 0x3c && block[511] == 0x3c);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("clock");
+}
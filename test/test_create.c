@@ -0,0 +1,135 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Creates files in directories spanning several clusters of 16
+ * entries, laid out so that each way fat16_create_file() finds room
+ * is taken: free entries on both sides of a cluster boundary, which
+ * must not be used together, a directory ending shortly before the
+ * end of its cluster, with and without a cluster following it, and
+ * a full root directory.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+
+static uint8_t* slot(uint32_t cluster, unsigned int i)
+{
+    return fatimg_cluster(&test_img, cluster) + i * 32;
+}
+
+/* adds a subdirectory holding files F0000000.TXT and on */
+static uint32_t add_dir(const char* name, unsigned int files)
+{
+    uint32_t dir = fatimg_add_dir(&test_img, 0, name);
+    test_add_files(dir, "F%07u.TXT", files);
+    return dir;
+}
+
+/* creates new.txt in a subdirectory, returns the cluster its entry ended up in */
+static uint32_t create_in(const char* path, uint32_t dir)
+{
+    struct fat16_dir_entry_struct entry;
+    CHECK(fat16_get_dir_entry_of_path(fs, path, &entry));
+    struct fat16_dir_struct* dd_sub = fat16_open_dir(fs, &entry);
+    CHECK(dd_sub);
+    CHECK(fat16_create_file(dd_sub, "new.txt", &entry));
+    fat16_close_dir(dd_sub);
+    CHECK(test_fs_ok());
+
+    struct fatimg_entry found;
+    CHECK(fatimg_find(&test_img, dir, "new.txt", &found));
+    return (found.offset - test_img.data_offset) / test_img.cluster_size + 2;
+}
+
+static uint32_t chain_length(uint32_t cluster)
+{
+    uint32_t length = 0;
+    for(; cluster >= 2 && cluster < 0xfff8; cluster = fatimg_get_fat(&test_img, cluster, 0))
+        ++length;
+    return length;
+}
+
+int main(void)
+{
+    unsigned int i;
+
+    /* one sector per cluster, 16 entries each */
+    test_card(CARD_SDSC, CARD_SIZE, 0, 1);
+
+    /* 2 + 14, 16 and 2 entries, with the entries around the first boundary deleted */
+    uint32_t span = add_dir("SPAN", 32);
+    uint32_t span2 = fatimg_get_fat(&test_img, span, 0);
+    uint32_t span3 = fatimg_get_fat(&test_img, span2, 0);
+    slot(span, 15)[0] = 0xe5;
+    slot(span2, 0)[0] = 0xe5;
+
+    /* 2 + 13 entries, the directory ends in the last entry of its cluster */
+    uint32_t grow = add_dir("GROW", 13);
+
+    /* the same, but followed by a cluster of garbage already in the chain */
+    uint32_t reuse = add_dir("REUSE", 13);
+    uint32_t spare = fatimg_add_file(&test_img, 0, "SPARE.BIN", 0, 512, 1);
+    struct fatimg_entry spare_entry;
+    CHECK(fatimg_find(&test_img, 0, "SPARE.BIN", &spare_entry));
+    test_img.mem[spare_entry.offset] = 0xe5;
+    memset(fatimg_cluster(&test_img, spare), 'G', 512);
+    fatimg_set_fat(&test_img, reuse, spare);
+    CHECK(test_fs_ok());
+    test_mount();
+
+    /* the free entries across the boundary are skipped */
+    CHECK(create_in("/SPAN", span) == span3);
+    CHECK(slot(span, 15)[0] == 0xe5 && slot(span2, 0)[0] == 0xe5);
+    CHECK(chain_length(span) == 3);
+
+    /* the last entry is marked deleted, so the directory goes on into a new cluster */
+    uint32_t free_before = fatimg_free_clusters(&test_img);
+    uint32_t grown = create_in("/GROW", grow);
+    CHECK(grown != grow && fatimg_get_fat(&test_img, grow, 0) == grown);
+    CHECK(slot(grow, 15)[0] == 0xe5);
+    CHECK(slot(grown, 2)[0] == 0);
+    CHECK(fatimg_free_clusters(&test_img) == free_before - 1);
+
+    /* the cluster already following is cleared and used */
+    free_before = fatimg_free_clusters(&test_img);
+    CHECK(create_in("/REUSE", reuse) == spare);
+    CHECK(slot(reuse, 15)[0] == 0xe5);
+    for(i = 2; i < 16; ++i)
+        CHECK(slot(spare, i)[0] == 0);
+    CHECK(chain_length(reuse) == 2);
+    CHECK(fatimg_free_clusters(&test_img) == free_before);
+    CHECK(fatimg_entries(&test_img, reuse) == 2 + 13 + 1);
+
+    /* a root directory with a single free entry */
+    test_card(CARD_SDSC, CARD_SIZE, 0, 1);
+    test_add_files(0, "R%07u.TXT", test_img.root_entries - 1);
+    test_mount();
+    CHECK(root_open_new("new.txt") == 0);
+    CHECK(test_fs_ok());
+    CHECK(fatimg_entries(&test_img, 0) == test_img.root_entries - 1);
+
+    /* two free entries apart from each other do not help */
+    CHECK(root_delete("R0000005.TXT") == 0);
+    CHECK(root_open_new("new.txt") == 0);
+    CHECK(test_fs_ok());
+
+    /* but two next to each other do */
+    CHECK(root_delete("R0000006.TXT") == 0);
+    struct fat16_file_struct* fd = root_open_new("new.txt");
+    CHECK(fd);
+    fat16_close_file(fd);
+    CHECK(test_fs_ok());
+    struct fatimg_entry entry;
+    CHECK(fatimg_find(&test_img, 0, "new.txt", &entry) && entry.offset == test_img.root_offset + 6 * 32);
+    CHECK(fatimg_entries(&test_img, 0) == test_img.root_entries - 2);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("create");
+}
@@ -0,0 +1,83 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+#include "sd_raw.h"
+
+/*
+ * Reads a file in whole sectors, as load_fw() does, and at odd
+ * positions. Whole sectors have to go straight into the caller's
+ * buffer, leaving the blocks in the cache where they are, and both
+ * ways have to return the file's content.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define FILE_SIZE (64 * 1024UL)
+#define CHUNK 2048
+
+int main(void)
+{
+    struct sd_raw_cache_stats stats;
+    uint8_t* data = malloc(FILE_SIZE);
+    uint8_t* copy = malloc(FILE_SIZE);
+    uint8_t buffer[CHUNK];
+
+    test_random(data, FILE_SIZE, 14);
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    fatimg_add_file(&test_img, 0, "fw.sfe", data, FILE_SIZE, 1);
+    test_mount();
+
+    struct fat16_file_struct* fd = root_open("fw.sfe");
+    CHECK(fd);
+
+    /* a block the cache holds before the file is read */
+    CHECK(sd_raw_read(test_img.root_offset, buffer, 32));
+
+    test_reset_stats();
+    uint32_t done;
+    for(done = 0; done < FILE_SIZE; done += CHUNK)
+        CHECK(fat16_read_file(fd, copy + done, CHUNK) == CHUNK);
+    CHECK(fat16_read_file(fd, buffer, CHUNK) == 0);
+    CHECK(memcmp(copy, data, FILE_SIZE) == 0);
+
+    /* only the fat went through the cache */
+    test_cache_stats(&stats);
+    unsigned int misses = stats.misses;
+    printf("%lu bytes in %lu data reads, %u blocks through the cache\n",
+           FILE_SIZE, io_stats.reads[IO_AREA_DATA], misses);
+    CHECK(misses <= io_stats.reads[IO_AREA_FAT]);
+    CHECK(io_stats.reads[IO_AREA_DATA] == FILE_SIZE / CHUNK);
+    CHECK(card_stats.blocks_read == FILE_SIZE / 512 + misses);
+
+    test_reset_stats();
+    CHECK(sd_raw_read(test_img.root_offset, buffer, 32));
+    test_cache_stats(&stats);
+    CHECK(stats.misses == 0 && card_stats.blocks_read == 0);
+
+    /* unaligned reads take the partial sectors from the cache */
+    int32_t offset = 100;
+    CHECK(fat16_seek_file(fd, &offset, FAT16_SEEK_SET));
+    memset(copy, 0, FILE_SIZE);
+    for(done = 100; done < FILE_SIZE; done += 1500)
+    {
+        uint16_t length = FILE_SIZE - done < 1500 ? FILE_SIZE - done : 1500;
+        CHECK(fat16_read_file(fd, copy + done, length) == length);
+    }
+    CHECK(memcmp(copy + 100, data + 100, FILE_SIZE - 100) == 0);
+    fat16_close_file(fd);
+
+    CHECK(test_fs_ok());
+    CHECK(card_stats.errors == 0);
+    free(data);
+    free(copy);
+
+    return test_done("direct");
+}
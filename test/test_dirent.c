@@ -0,0 +1,62 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "fat16_config.h"
+#include "rootdir.h"
+#include "sd_raw.h"
+
+/*
+ * Grows a file with a long name by many small writes. Its directory
+ * entry has to be written only every FAT16_DIR_ENTRY_SYNC_BYTES, set
+ * in the Makefile, and on close, each time with the long name entries
+ * and the 8.3 entry in a single write.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define WRITES 1000
+#define WRITE_SIZE 100
+#define NAME "a long file name.log"
+
+int main(void)
+{
+    uint8_t buffer[WRITE_SIZE];
+    struct fatimg_entry entry;
+    unsigned int i;
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    test_mount();
+
+    struct fat16_file_struct* fd = root_open_new(NAME);
+    CHECK(fd);
+    CHECK(test_fs_ok());
+
+    io_reset();
+    memset(buffer, 'd', sizeof(buffer));
+    for(i = 0; i < WRITES; ++i)
+        CHECK(fat16_write_file(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+
+    unsigned long syncs = (unsigned long) WRITES * WRITE_SIZE / FAT16_DIR_ENTRY_SYNC_BYTES;
+    printf("%u writes: %lu directory writes\n", WRITES, io_stats.writes[IO_AREA_ROOT]);
+    CHECK(io_stats.writes[IO_AREA_ROOT] == syncs);
+
+    /* the size on the card lags behind until the file is closed */
+    sd_raw_sync();
+    sim_sync();
+    CHECK(fatimg_find(&test_img, 0, NAME, &entry));
+    CHECK(entry.size < WRITES * WRITE_SIZE && entry.size + FAT16_DIR_ENTRY_SYNC_BYTES >= WRITES * WRITE_SIZE);
+
+    io_reset();
+    fat16_close_file(fd);
+    CHECK(io_stats.writes[IO_AREA_ROOT] == 1);
+    CHECK(test_fs_ok());
+    CHECK(fatimg_find(&test_img, 0, NAME, &entry) && entry.size == WRITES * WRITE_SIZE);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("dirent");
+}
@@ -0,0 +1,56 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Follows the chain of a fragmented file and counts the reads of FAT
+ * sectors. With the FAT cache, each sector holding links of the chain
+ * has to be read about once, not once per cluster.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define CLUSTERS 3000
+
+int main(void)
+{
+    unsigned int i;
+    uint8_t* data = malloc(CLUSTERS * 512);
+    test_random(data, CLUSTERS * 512, 11);
+
+    /* one sector per cluster, every other cluster belongs to the file */
+    test_card(CARD_SDSC, CARD_SIZE, 0, 1);
+    uint32_t cluster = fatimg_add_file(&test_img, 0, "frag.bin", data, CLUSTERS * 512, 2);
+    CHECK(fatimg_fragments(&test_img, cluster) == CLUSTERS);
+    unsigned int fat_sectors = (cluster + 2 * CLUSTERS) * 2 / 512 + 1;
+    test_mount();
+
+    io_reset();
+    struct fat16_file_struct* fd = root_open("frag.bin");
+    CHECK(fd);
+    uint8_t buffer[512];
+    for(i = 0; i < CLUSTERS; ++i)
+    {
+        CHECK(fat16_read_file(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+        CHECK(memcmp(buffer, data + i * 512, sizeof(buffer)) == 0);
+    }
+    CHECK(fat16_read_file(fd, buffer, sizeof(buffer)) == 0);
+    fat16_close_file(fd);
+
+    printf("%u clusters in %u fat sectors: %lu fat reads\n", CLUSTERS, fat_sectors, io_stats.reads[IO_AREA_FAT]);
+    CHECK(io_stats.reads[IO_AREA_FAT] <= fat_sectors + 2);
+    CHECK(io_writes() == 0);
+
+    CHECK(test_fs_ok());
+    CHECK(card_stats.errors == 0);
+    free(data);
+
+    return test_done("fat");
+}
@@ -0,0 +1,111 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Mounts FAT32 volumes, reads and writes files in the root directory,
+ * which is a cluster chain, and in a subdirectory. With a valid fsinfo
+ * sector, neither mounting nor the first allocation may scan the FAT,
+ * which is 1MB in size here. Without it, the free clusters are counted
+ * once at mount.
+ */
+
+#define CARD_SIZE (128 * 1024 * 1024UL)
+#define FILE_SIZE (100 * 1024UL)
+/* enough files to make the root directory grow by a few clusters */
+#define FILES 40
+
+static void use_volume(uint8_t fsinfo_valid)
+{
+    uint8_t* data = malloc(FILE_SIZE);
+    uint8_t* copy = malloc(FILE_SIZE);
+    struct fatimg_entry entry;
+    unsigned int i;
+    char name[16];
+
+    test_random(data, FILE_SIZE, 17);
+
+    /* one sector per cluster, the first 200000 clusters are in use */
+    test_card(CARD_SDHC, CARD_SIZE, 1, 1);
+    CHECK(test_img.fat32 && test_img.clusters > 65525);
+    uint32_t sub = fatimg_add_dir(&test_img, 0, "SUB");
+    fatimg_add_file(&test_img, sub, "old.bin", data, FILE_SIZE, 1);
+    uint32_t used = fatimg_add_file(&test_img, 0, "used.bin", 0, 200000 * 512UL, 1);
+    uint8_t* fsinfo = test_img.mem + test_img.fsinfo_offset;
+    uint32_t next_free = used + 200000;
+    if(!fsinfo_valid)
+        next_free = 0xffffffff;
+    memcpy(fsinfo + 492, &next_free, 4);
+    if(!fsinfo_valid)
+        memset(fsinfo + 488, 0xff, 4);
+
+    io_reset();
+    test_mount();
+    printf("fsinfo %s: mounting read %lu fat sectors\n", fsinfo_valid ? "valid" : "unknown", io_stats.reads[IO_AREA_FAT]);
+    /* at most the link of the root directory's first cluster */
+    if(fsinfo_valid)
+        CHECK(io_stats.reads[IO_AREA_FAT] <= 1);
+    CHECK(fat16_get_fs_free(fs) == (offset_t) fatimg_free_clusters(&test_img) * 512);
+
+    /* a file in the subdirectory */
+    struct fat16_dir_entry_struct dir_entry;
+    CHECK(fat16_get_dir_entry_of_path(fs, "/SUB/old.bin", &dir_entry));
+    struct fat16_file_struct* fd = fat16_open_file(fs, &dir_entry);
+    CHECK(fd);
+    uint32_t done;
+    for(done = 0; done < FILE_SIZE; done += 1024)
+        CHECK(fat16_read_file(fd, copy + done, 1024) == 1024);
+    CHECK(memcmp(copy, data, FILE_SIZE) == 0);
+    fat16_close_file(fd);
+
+    /* the first allocation starts at the hint of the fsinfo sector */
+    io_reset();
+    fd = root_open_new("new.bin");
+    CHECK(fd);
+    for(done = 0; done < FILE_SIZE; done += 1024)
+        CHECK(fat16_write_file(fd, data + done, 1024) == 1024);
+    fat16_close_file(fd);
+    printf("fsinfo %s: writing %lu bytes read %lu fat sectors\n", fsinfo_valid ? "valid" : "unknown", FILE_SIZE, io_stats.reads[IO_AREA_FAT]);
+    /* free runs are searched in a window following the hint only, which
+     * the free cluster count at mount provides without the fsinfo sector
+     */
+    CHECK(io_stats.reads[IO_AREA_FAT] < test_img.fat_size / 512 / 8);
+
+    /* the root directory grows beyond its first cluster */
+    for(i = 0; i < FILES; ++i)
+    {
+        sprintf(name, "log%02u.txt", i);
+        fd = root_open_new(name);
+        CHECK(fd && fat16_write_file(fd, (const uint8_t*) name, strlen(name)) == (int16_t) strlen(name));
+        fat16_close_file(fd);
+    }
+    CHECK(root_delete("log07.txt") == 0);
+
+    CHECK(test_fs_ok());
+    CHECK(fatimg_find(&test_img, 0, "new.bin", &entry) && entry.size == FILE_SIZE);
+    CHECK(fatimg_read(&test_img, &entry, copy, FILE_SIZE) == FILE_SIZE && memcmp(copy, data, FILE_SIZE) == 0);
+    CHECK(fatimg_find(&test_img, 0, "log39.txt", &entry) && entry.size == 9);
+    CHECK(fatimg_count(&test_img, 0, "log07.txt") == 0);
+    CHECK(fatimg_entries(&test_img, 0) > 512 / 32);
+    CHECK(fat16_get_fs_free(fs) == (offset_t) fatimg_free_clusters(&test_img) * 512);
+    CHECK(card_stats.errors == 0);
+
+    free(data);
+    free(copy);
+}
+
+int main(void)
+{
+    use_volume(1);
+    use_volume(0);
+
+    return test_done("fat32");
+}
@@ -0,0 +1,78 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Counts the free clusters once at mount, reading each FAT sector a
+ * single time, and checks the count is kept right while files grow,
+ * shrink and are deleted, without reading the FAT again.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+
+static int free_ok(void)
+{
+    return fat16_get_fs_free(fs) == (offset_t) fatimg_free_clusters(&test_img) * test_img.cluster_size;
+}
+
+int main(void)
+{
+    uint8_t buffer[1000];
+    unsigned int i;
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    fatimg_fill(&test_img, 30);
+    io_reset();
+    test_mount();
+    printf("mounting read %lu of %lu fat sectors\n", io_stats.reads[IO_AREA_FAT], (unsigned long) test_img.fat_size / 512);
+    CHECK(io_stats.reads[IO_AREA_FAT] <= test_img.fat_size / 512);
+    CHECK(free_ok());
+
+    /* queries do not touch the card */
+    io_reset();
+    for(i = 0; i < 100; ++i)
+        CHECK(free_ok());
+    CHECK(io_reads() == 0);
+
+    /* growing, shrinking and deleting files */
+    memset(buffer, 0x5a, sizeof(buffer));
+    struct fat16_file_struct* fd = root_open_new("grow.bin");
+    CHECK(fd);
+    for(i = 0; i < 100; ++i)
+        CHECK(fat16_write_file(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    fat16_close_file(fd);
+    CHECK(test_fs_ok() && free_ok());
+
+    fd = root_open("grow.bin");
+    CHECK(fd && fat16_resize_file(fd, 10000));
+    fat16_close_file(fd);
+    CHECK(test_fs_ok() && free_ok());
+
+    fd = root_open("grow.bin");
+    CHECK(fd && fat16_resize_file(fd, 60000));
+    fat16_close_file(fd);
+    CHECK(test_fs_ok() && free_ok());
+
+    CHECK(root_delete("grow.bin") == 0);
+    CHECK(test_fs_ok() && free_ok());
+
+    /* a file of the filled volume, in a subdirectory */
+    struct fat16_dir_entry_struct entry;
+    CHECK(fat16_get_dir_entry_of_path(fs, "/FILL/F0000003.BIN", &entry));
+    CHECK(fat16_delete_file(fs, &entry));
+    CHECK(test_fs_ok() && free_ok());
+
+    /* the count is read back after remounting */
+    test_mount();
+    CHECK(free_ok());
+    CHECK(card_stats.errors == 0);
+
+    return test_done("free");
+}
@@ -0,0 +1,93 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "fat16_config.h"
+#include "rootdir.h"
+
+/*
+ * Looks up files in a root directory of hundreds of files, the way
+ * main.c does at boot. Names held by the directory index have to be
+ * found with a single read, and names not in a complete index without
+ * any. Files created through another handle of the same directory
+ * must still be found, and never created twice.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define FILES 300
+
+int main(void)
+{
+    struct fat16_dir_entry_struct entry;
+    unsigned int i;
+    char name[13];
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    fatimg_add_file(&test_img, 0, "splash.bin", (const uint8_t*) "splash", 6, 1);
+    fatimg_add_file(&test_img, 0, "FW.SFE", (const uint8_t*) "firmware", 8, 1);
+    test_add_files(0, "N%07u.LOG", FILES);
+    test_mount();
+
+    /* the names indexed when the directory was opened */
+    io_reset();
+    CHECK(root_file_exists("splash.bin"));
+    CHECK(root_file_exists("FW.SFE"));
+    for(i = 0; i < FAT16_DIR_INDEX_ENTRIES - 2; ++i)
+    {
+        sprintf(name, "N%07u.LOG", i);
+        CHECK(root_file_exists(name));
+    }
+    printf("%u indexed lookups: %lu reads\n", FAT16_DIR_INDEX_ENTRIES, io_reads());
+    CHECK(io_reads() == FAT16_DIR_INDEX_ENTRIES);
+
+    /* names beyond the index are found by searching */
+    CHECK(root_file_exists("N0000299.LOG"));
+    CHECK(!root_file_exists("missing.txt"));
+
+    /* a directory the index holds all names of, growing */
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    fatimg_add_file(&test_img, 0, "n0.log", 0, 0, 1);
+    test_mount();
+    for(i = 1; i < 10; ++i)
+    {
+        sprintf(name, "n%u.log", i);
+        struct fat16_file_struct* fd = root_open_new(name);
+        CHECK(fd);
+        fat16_close_file(fd);
+    }
+    io_reset();
+    CHECK(!root_file_exists("missing.txt"));
+    CHECK(root_file_exists("n9.log"));
+    CHECK(io_reads() <= 1);
+
+    /* deleted files are no longer found, and no longer indexed */
+    CHECK(root_delete("n3.log") == 0);
+    io_reset();
+    CHECK(!root_file_exists("n3.log"));
+    CHECK(io_reads() == 0);
+    CHECK(root_file_exists("n4.log"));
+
+    /* a file created through a second handle of the root directory */
+    CHECK(fat16_get_dir_entry_of_path(fs, "/", &entry));
+    struct fat16_dir_struct* other = fat16_open_dir(fs, &entry);
+    CHECK(other);
+    CHECK(fat16_create_file(other, "dup.txt", &entry));
+    CHECK(root_file_exists("dup.txt"));
+    struct fat16_file_struct* fd = root_open_new("dup.txt");
+    CHECK(fd);
+    fat16_close_file(fd);
+    fat16_close_dir(other);
+
+    CHECK(test_fs_ok());
+    CHECK(fatimg_count(&test_img, 0, "dup.txt") == 1);
+    CHECK(fatimg_count(&test_img, 0, "n3.log") == 0);
+    CHECK(fatimg_entries(&test_img, 0) == 10);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("index");
+}
@@ -0,0 +1,79 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Lists a root directory and a subdirectory of 500 files each. Every
+ * entry has to be read about once, so the bytes read grow with the
+ * size of the directory, not with its square.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define FILES 500
+
+/* reads the whole directory, returns the number of files with the expected names */
+static unsigned int list(struct fat16_dir_struct* dir)
+{
+    struct fat16_dir_entry_struct entry;
+    unsigned int found = 0;
+    char name[13];
+
+    while(fat16_read_dir(dir, &entry))
+    {
+        sprintf(name, "L%07u.TXT", found);
+        if(strcmp(entry.long_name, name) == 0)
+            ++found;
+    }
+    return found;
+}
+
+int main(void)
+{
+    /* one sector per cluster, the subdirectory spans 32 clusters */
+    test_card(CARD_SDSC, CARD_SIZE, 0, 1);
+    uint32_t sub = fatimg_add_dir(&test_img, 0, "SUB");
+    test_add_files(0, "L%07u.TXT", FILES);
+    test_add_files(sub, "L%07u.TXT", FILES);
+    test_mount();
+
+    /* the root directory, through the handle main.c lists it with */
+    fat16_reset_dir(dd);
+    io_reset();
+    CHECK(list(dd) == FILES);
+    printf("%u root entries: %lu reads, %lu bytes\n", FILES + 1, io_reads(), io_stats.read_bytes);
+    CHECK(io_stats.read_bytes <= 2 * test_img.root_entries * 32);
+
+    /* the stream of names the USB side sends */
+    rootDirectory_files_stream(1);
+    io_reset();
+    unsigned int commas = 0;
+    char c;
+    while((c = rootDirectory_files_stream(0)) != 0)
+        commas += c == ',';
+    CHECK(commas == FILES + 1);
+    CHECK(io_stats.read_bytes <= 2 * test_img.root_entries * 32);
+
+    /* a subdirectory, whose cursor moves across clusters */
+    struct fat16_dir_entry_struct sub_entry;
+    CHECK(fat16_get_dir_entry_of_path(fs, "/SUB", &sub_entry));
+    struct fat16_dir_struct* sub_dd = fat16_open_dir(fs, &sub_entry);
+    CHECK(sub_dd);
+    io_reset();
+    CHECK(list(sub_dd) == FILES);
+    printf("%u subdirectory entries: %lu reads, %lu bytes\n", FILES + 2, io_reads(), io_stats.read_bytes);
+    CHECK(io_stats.read_bytes <= 2 * (FILES + 2) * 32);
+    fat16_close_dir(sub_dd);
+
+    CHECK(io_writes() == 0);
+    CHECK(test_fs_ok());
+    CHECK(card_stats.errors == 0);
+
+    return test_done("list");
+}
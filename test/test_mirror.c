@@ -0,0 +1,116 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+#include "sd_raw.h"
+
+/*
+ * Grows, shrinks and deletes files and compares the two FAT copies
+ * byte for byte after each step. Each FAT sector changed has to be
+ * written about once per copy, not once per entry, also while two
+ * files grow in turn on a volume with scattered free clusters.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+
+/* marks the fat sectors the chain of a file goes through, returns the number of sectors newly marked */
+static unsigned int chain_sectors(const char* name, uint8_t* touched)
+{
+    struct fatimg_entry entry;
+    unsigned int sectors = 0;
+    uint32_t cluster;
+
+    CHECK(fatimg_find(&test_img, 0, name, &entry));
+    for(cluster = entry.cluster; cluster < 0xfff8; cluster = fatimg_get_fat(&test_img, cluster, 0))
+    {
+        if(!touched[cluster / 256]++)
+            ++sectors;
+    }
+    return sectors;
+}
+
+static int copies_equal(void)
+{
+    sd_raw_sync();
+    sim_sync();
+    return memcmp(test_img.mem + test_img.fat_offset,
+                  test_img.mem + test_img.fat_offset + test_img.fat_size,
+                  test_img.fat_size) == 0;
+}
+
+int main(void)
+{
+    uint8_t buffer[2048];
+    unsigned int i;
+
+    /* one sector per cluster */
+    test_card(CARD_SDSC, CARD_SIZE, 0, 1);
+    CHECK(test_img.fat_copies == 2);
+    fatimg_fill(&test_img, 20);
+    test_mount();
+    memset(buffer, 0xc3, sizeof(buffer));
+
+    /* 2048 clusters, whose links spread over at least 8 fat sectors */
+    io_reset();
+    struct fat16_file_struct* fd = root_open_new("big.bin");
+    CHECK(fd);
+    for(i = 0; i < 512; ++i)
+        CHECK(fat16_write_file(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    fat16_close_file(fd);
+    CHECK(copies_equal());
+
+    static uint8_t touched[CARD_SIZE / 512 / 256];
+    unsigned int sectors = chain_sectors("big.bin", touched);
+    printf("2048 clusters over %u fat sectors: %lu fat writes\n", sectors, io_stats.writes[IO_AREA_FAT]);
+    CHECK(io_stats.writes[IO_AREA_FAT] <= 2 * (sectors + 1));
+
+    /* shrinking and deleting */
+    fd = root_open("big.bin");
+    CHECK(fd && fat16_resize_file(fd, 100000));
+    fat16_close_file(fd);
+    CHECK(copies_equal());
+
+    for(i = 0; i < 20; ++i)
+    {
+        char name[16];
+        sprintf(name, "small%u.txt", i);
+        fd = root_open_new(name);
+        CHECK(fd && fat16_write_file(fd, buffer, 700) == 700);
+        fat16_close_file(fd);
+    }
+    CHECK(copies_equal());
+
+    io_reset();
+    CHECK(root_delete("big.bin") == 0);
+    CHECK(root_delete("small5.txt") == 0);
+    CHECK(copies_equal());
+    CHECK(io_stats.writes[IO_AREA_FAT] <= 2 * 3);
+
+    /* two files growing a cluster at a time in turn, the links of both stay cached */
+    struct fat16_file_struct* fds[2];
+    fds[0] = root_open_new("a.bin");
+    fds[1] = root_open_new("b.bin");
+    CHECK(fds[0] && fds[1]);
+    io_reset();
+    for(i = 0; i < 2 * 256; ++i)
+        CHECK(fat16_write_file(fds[i % 2], buffer, 512) == 512);
+    fat16_close_file(fds[0]);
+    fat16_close_file(fds[1]);
+    CHECK(copies_equal());
+
+    memset(touched, 0, sizeof(touched));
+    sectors = chain_sectors("a.bin", touched) + chain_sectors("b.bin", touched);
+    printf("2 x 256 clusters over %u fat sectors: %lu fat writes\n", sectors, io_stats.writes[IO_AREA_FAT]);
+    CHECK(io_stats.writes[IO_AREA_FAT] <= 2 * (sectors + 1));
+
+    CHECK(test_fs_ok());
+    CHECK(card_stats.errors == 0);
+
+    return test_done("mirror");
+}
@@ -0,0 +1,82 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "blockdev.h"
+#include "sd_raw.h"
+
+/*
+ * Drives the card through the USB mass storage block device after the
+ * bootloader has used it, and checks that both see the same blocks.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define BLOCKS 16
+
+int main(void)
+{
+    uint8_t data[BLOCKS][512];
+    uint8_t block[512];
+    U32 size;
+    unsigned int i;
+
+    for(i = 0; i < BLOCKS; ++i)
+        memset(data[i], 0x80 + i, 512);
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    test_mount();
+
+    /* the card is not initialized again */
+    unsigned long resets = card_stats.commands[0];
+    CHECK(BlockDevInit() == 0);
+    CHECK(card_stats.commands[0] == resets);
+    CHECK(BlockDevGetSize(&size) == 0 && size == CARD_SIZE / 512);
+
+    /* a WRITE(10) of several blocks becomes a single stream */
+    U32 lba = test_img.data_offset / 512 + 64;
+    uint8_t cached;
+    CHECK(sd_raw_read((offset_t) (lba + 3) * 512, &cached, 1));
+    card_reset_stats();
+    CHECK(BlockDevWriteStart(lba, BLOCKS) == 0);
+    for(i = 0; i < BLOCKS; ++i)
+        CHECK(BlockDevWrite(lba + i, data[i]) == 0);
+    CHECK(card_stats.commands[25] == 1 && card_stats.commands[24] == 0);
+    CHECK(card_stats.blocks_written == BLOCKS);
+    CHECK(memcmp(card_mem + (offset_t) lba * 512, data, sizeof(data)) == 0);
+
+    /* the bootloader's cached copy follows */
+    CHECK(sd_raw_read((offset_t) (lba + 3) * 512, block, sizeof(block)));
+    CHECK(memcmp(block, data[3], 512) == 0);
+
+    /* and blocks modified by the bootloader reach the host before they are synced */
+    memset(block, 0x11, 100);
+    CHECK(sd_raw_write((offset_t) (lba + 5) * 512, block, 100));
+    CHECK(card_mem[(offset_t) (lba + 5) * 512] == 0x85);
+    CHECK(BlockDevRead(lba + 5, block) == 0);
+    CHECK(block[0] == 0x11 && block[99] == 0x11 && block[100] == 0x85);
+
+    /* a block outside the announced ones ends the stream and goes where it belongs */
+    card_reset_stats();
+    CHECK(BlockDevWriteStart(lba + 200, 4) == 0);
+    CHECK(BlockDevWrite(lba + 200, data[0]) == 0);
+    CHECK(BlockDevWrite(lba + 300, data[1]) == 0);
+    CHECK(BlockDevWrite(lba + 201, data[2]) == 0);
+    CHECK(card_stats.commands[25] == 1 && card_stats.commands[24] == 2);
+    CHECK(memcmp(card_mem + (offset_t) (lba + 200) * 512, data[0], 512) == 0);
+    CHECK(memcmp(card_mem + (offset_t) (lba + 300) * 512, data[1], 512) == 0);
+    CHECK(memcmp(card_mem + (offset_t) (lba + 201) * 512, data[2], 512) == 0);
+
+    /* single block writes and reads */
+    CHECK(BlockDevWrite(lba + 100, data[7]) == 0);
+    CHECK(BlockDevRead(lba + 100, block) == 0 && memcmp(block, data[7], 512) == 0);
+    CHECK(memcmp(card_mem + (offset_t) (lba + 100) * 512, data[7], 512) == 0);
+
+    CHECK(sd_raw_sync());
+    CHECK(test_fs_ok());
+    CHECK(card_stats.errors == 0);
+
+    return test_done("msc");
+}
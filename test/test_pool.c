@@ -0,0 +1,130 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "fat16.h"
+#include "fat16_config.h"
+#include "partition.h"
+#include "rootdir.h"
+#include "sd_raw.h"
+
+/*
+ * Takes every handle of each pool. Opening one more has to fail
+ * without disturbing the handles in use, and has to work again once
+ * a handle is closed. Closing a handle twice must not let the pool
+ * hand it out twice, and mounting again, as the USB side does, must
+ * not use up handles.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+
+int main(void)
+{
+    struct fat16_file_struct* fds[FAT16_FILE_HANDLES];
+    char name[16];
+    unsigned int i;
+    uint8_t fs_peak;
+    uint8_t file_peak;
+    uint8_t dir_peak;
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    fatimg_add_dir(&test_img, 0, "SUB1");
+    fatimg_add_dir(&test_img, 0, "SUB2");
+
+    /* mounting again gives the old handles back first, the card is synchronized before as load_data() does */
+    for(i = 0; i < 10; ++i)
+    {
+        test_mount();
+        sd_raw_sync();
+    }
+    fat16_get_pool_peaks(&fs_peak, &file_peak, &dir_peak);
+    CHECK(partition_get_pool_peak() == 1);
+    CHECK(fs_peak == 1 && file_peak == 0 && dir_peak == 1);
+
+    /* no second partition or filesystem while the card is mounted */
+    CHECK(FAT16_PARTITION_HANDLES == 1 && FAT16_FS_HANDLES == 1);
+    CHECK(partition_open((device_read_t) sd_raw_read,
+                         (device_read_interval_t) sd_raw_read_interval,
+                         (device_read_blocks_t) sd_raw_read_blocks,
+                         (device_write_t) sd_raw_write,
+                         -1) == 0);
+    CHECK(fat16_open(partition) == 0);
+
+    /* a pointer which is none of the handles frees none, even if its distance is a multiple of 256 */
+    CHECK(partition_close(partition + 256) == 0);
+    CHECK(partition_open((device_read_t) sd_raw_read,
+                         (device_read_interval_t) sd_raw_read_interval,
+                         (device_read_blocks_t) sd_raw_read_blocks,
+                         (device_write_t) sd_raw_write,
+                         -1) == 0);
+
+    /* files */
+    for(i = 0; i < FAT16_FILE_HANDLES; ++i)
+    {
+        sprintf(name, "file%u.log", i);
+        fds[i] = root_open_new(name);
+        CHECK(fds[i]);
+        CHECK(fat16_write_file(fds[i], (const uint8_t*) name, strlen(name)) == (int16_t) strlen(name));
+    }
+    /* the file is created, but cannot be opened */
+    CHECK(root_open_new("late.log") == 0);
+    sd_raw_sync();
+    sim_sync();
+    CHECK(fatimg_entries(&test_img, 0) == 2 + FAT16_FILE_HANDLES + 1);
+
+    fat16_close_file(fds[0]);
+    fds[0] = root_open("late.log");
+    CHECK(fds[0]);
+    CHECK(fat16_write_file(fds[0], (const uint8_t*) "late", 4) == 4);
+
+    /* a handle closed twice is handed out once */
+    fat16_close_file(fds[0]);
+    fat16_close_file(fds[0]);
+    fds[0] = root_open("late.log");
+    CHECK(fds[0]);
+    CHECK(root_open("file0.log") == 0);
+    for(i = 0; i < FAT16_FILE_HANDLES; ++i)
+        fat16_close_file(fds[i]);
+    CHECK(test_fs_ok());
+
+    struct fatimg_entry entry;
+    CHECK(fatimg_find(&test_img, 0, "late.log", &entry) && entry.size == 4);
+    CHECK(fatimg_find(&test_img, 0, "file1.log", &entry) && entry.size == strlen("file1.log"));
+
+    /* directories, the root directory holds one handle, and looking up a path takes one */
+    CHECK(FAT16_DIR_HANDLES == 2);
+    struct fat16_dir_entry_struct sub1;
+    struct fat16_dir_entry_struct sub2;
+    CHECK(fat16_get_dir_entry_of_path(fs, "/SUB1", &sub1));
+    CHECK(fat16_get_dir_entry_of_path(fs, "/SUB2", &sub2));
+    struct fat16_dir_struct* dd_sub = fat16_open_dir(fs, &sub1);
+    CHECK(dd_sub);
+    CHECK(fat16_open_dir(fs, &sub2) == 0);
+    fat16_close_dir(dd_sub);
+    fat16_close_dir(dd_sub);
+    dd_sub = fat16_open_dir(fs, &sub2);
+    CHECK(dd_sub);
+    CHECK(fat16_open_dir(fs, &sub1) == 0);
+    fat16_close_dir(dd_sub);
+    CHECK(fat16_get_dir_entry_of_path(fs, "/SUB1", &sub1));
+
+    /* the root directory still works */
+    struct fat16_dir_entry_struct dir_entry;
+    unsigned int entries = 0;
+    fat16_reset_dir(dd);
+    while(fat16_read_dir(dd, &dir_entry))
+        ++entries;
+    CHECK(entries == 5);
+
+    fat16_get_pool_peaks(&fs_peak, &file_peak, &dir_peak);
+    printf("peaks: %u filesystem, %u file, %u directory handles\n", fs_peak, file_peak, dir_peak);
+    CHECK(partition_get_pool_peak() == FAT16_PARTITION_HANDLES);
+    CHECK(fs_peak == FAT16_FS_HANDLES && file_peak == FAT16_FILE_HANDLES && dir_peak == FAT16_DIR_HANDLES);
+    CHECK(test_fs_ok());
+    CHECK(card_stats.errors == 0);
+
+    return test_done("pool");
+}
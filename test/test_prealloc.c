@@ -0,0 +1,115 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Two loggers write 512KB each at the same time, in chunks of 512
+ * bytes, once growing their files cluster by cluster and once into
+ * space reserved beforehand. Reserved files have to end up in one
+ * piece each. Space reserved but not written is given back on close.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define FILE_SIZE (512 * 1024UL)
+#define CHUNK 512
+
+static void write_pair(uint8_t preallocate)
+{
+    uint8_t buffer[CHUNK];
+    struct fatimg_entry entry_a;
+    struct fatimg_entry entry_b;
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    test_mount();
+
+    struct fat16_file_struct* fd_a = root_open_new("a.log");
+    struct fat16_file_struct* fd_b = root_open_new("b.log");
+    CHECK(fd_a && fd_b);
+    if(preallocate)
+    {
+        CHECK(fat16_preallocate_file(fd_a, FILE_SIZE));
+        CHECK(fat16_preallocate_file(fd_b, FILE_SIZE));
+    }
+
+    test_reset_stats();
+    uint32_t done;
+    for(done = 0; done < FILE_SIZE; done += CHUNK)
+    {
+        memset(buffer, done / CHUNK, sizeof(buffer));
+        CHECK(fat16_write_file(fd_a, buffer, CHUNK) == CHUNK);
+        memset(buffer, ~(done / CHUNK), sizeof(buffer));
+        CHECK(fat16_write_file(fd_b, buffer, CHUNK) == CHUNK);
+    }
+    fat16_close_file(fd_a);
+    fat16_close_file(fd_b);
+    CHECK(test_fs_ok());
+
+    CHECK(fatimg_find(&test_img, 0, "a.log", &entry_a) && entry_a.size == FILE_SIZE);
+    CHECK(fatimg_find(&test_img, 0, "b.log", &entry_b) && entry_b.size == FILE_SIZE);
+    uint32_t fragments = fatimg_fragments(&test_img, entry_a.cluster) + fatimg_fragments(&test_img, entry_b.cluster);
+    printf("%s: %u fragments, %lu fat writes, %lu data writes\n",
+           preallocate ? "preallocated" : "growing", (unsigned int) fragments,
+           io_stats.writes[IO_AREA_FAT], io_stats.writes[IO_AREA_DATA]);
+    if(preallocate)
+        CHECK(fragments == 2);
+    else
+        CHECK(fragments > 2);
+
+    uint8_t* copy = malloc(FILE_SIZE);
+    CHECK(fatimg_read(&test_img, &entry_b, copy, FILE_SIZE) == FILE_SIZE);
+    CHECK(copy[0] == 0xff && copy[FILE_SIZE - 1] == (uint8_t) ~(FILE_SIZE / CHUNK - 1));
+    free(copy);
+    CHECK(card_stats.errors == 0);
+}
+
+int main(void)
+{
+    write_pair(0);
+    write_pair(1);
+
+    /* space which is not written is released on close */
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    test_mount();
+    uint32_t free_before = fatimg_free_clusters(&test_img);
+    struct fat16_file_struct* fd = root_open_new("short.log");
+    CHECK(fd && fat16_preallocate_file(fd, FILE_SIZE));
+    CHECK(fat16_write_file(fd, (const uint8_t*) "short", 5) == 5);
+    fat16_close_file(fd);
+    CHECK(test_fs_ok());
+    CHECK(fatimg_free_clusters(&test_img) == free_before - 1);
+    CHECK(fat16_get_fs_free(fs) == (offset_t) (free_before - 1) * test_img.cluster_size);
+
+    /* as is space reserved for a file never written to */
+    fd = root_open_new("empty.log");
+    CHECK(fd && fat16_preallocate_file(fd, FILE_SIZE));
+    fat16_close_file(fd);
+    CHECK(test_fs_ok());
+    CHECK(fatimg_free_clusters(&test_img) == free_before - 1);
+
+    /* a file written in runs of whole clusters has nothing to trim or update on close */
+    static uint8_t run[4 * 2048];
+    struct fatimg_entry entry;
+    unsigned int i;
+    memset(run, 'r', sizeof(run));
+    fd = root_open_new("runs.log");
+    CHECK(fd);
+    for(i = 0; i < 4; ++i)
+        CHECK(fat16_write_file(fd, run, sizeof(run)) == sizeof(run));
+    CHECK(fat16_sync_file(fd));
+    io_reset();
+    fat16_close_file(fd);
+    CHECK(io_writes() == 0);
+    CHECK(test_fs_ok());
+    CHECK(fatimg_find(&test_img, 0, "runs.log", &entry) && entry.size == 4 * sizeof(run));
+    CHECK(card_stats.errors == 0);
+
+    return test_done("prealloc");
+}
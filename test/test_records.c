@@ -0,0 +1,100 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Appends 32 byte records to two files in turn, as a logger with two
+ * channels does. Records collect in the sector buffers of the files,
+ * so no sector has to be read back from the card before it is written.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define RECORDS 2000
+#define RECORD_SIZE 32
+
+static void record(uint8_t* buffer, unsigned int file, unsigned int n)
+{
+    memset(buffer, 0, RECORD_SIZE);
+    sprintf((char*) buffer, "%u:%06u", file, n);
+}
+
+int main(void)
+{
+    uint8_t buffer[RECORD_SIZE];
+    uint8_t expected[RECORD_SIZE];
+    struct fatimg_entry entry;
+    unsigned int i;
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    test_mount();
+
+    struct fat16_file_struct* fd[2];
+    fd[0] = root_open_new("chan0.log");
+    fd[1] = root_open_new("chan1.log");
+    CHECK(fd[0] && fd[1]);
+
+    test_reset_stats();
+    for(i = 0; i < RECORDS; ++i)
+    {
+        record(buffer, 0, i);
+        CHECK(fat16_write_file(fd[0], buffer, RECORD_SIZE) == RECORD_SIZE);
+        record(buffer, 1, i);
+        CHECK(fat16_write_file(fd[1], buffer, RECORD_SIZE) == RECORD_SIZE);
+    }
+    CHECK(fat16_sync_file(fd[0]) && fat16_sync_file(fd[1]));
+    printf("%u records: %lu data reads, %lu data writes, %lu blocks read from the card\n",
+           2 * RECORDS, io_stats.reads[IO_AREA_DATA], io_stats.writes[IO_AREA_DATA], card_stats.blocks_read);
+    /* only the fat and the directory are read from the card, never a data sector */
+    CHECK(io_stats.reads[IO_AREA_DATA] == 0);
+    CHECK(card_stats.blocks_read <= io_stats.reads[IO_AREA_FAT] + io_stats.reads[IO_AREA_ROOT]);
+    CHECK(io_stats.writes[IO_AREA_DATA] <= 2 * (RECORDS * RECORD_SIZE / 512 + 1));
+
+    /* overwriting a record away from the buffered sector */
+    int32_t offset = 10 * RECORD_SIZE;
+    CHECK(fat16_seek_file(fd[0], &offset, FAT16_SEEK_SET));
+    memset(buffer, 'x', sizeof(buffer));
+    CHECK(fat16_write_file(fd[0], buffer, RECORD_SIZE) == RECORD_SIZE);
+    offset = 0;
+    CHECK(fat16_seek_file(fd[0], &offset, FAT16_SEEK_END));
+    record(buffer, 0, RECORDS);
+    CHECK(fat16_write_file(fd[0], buffer, RECORD_SIZE) == RECORD_SIZE);
+
+    /* reading sees the buffered records */
+    offset = -RECORD_SIZE;
+    CHECK(fat16_seek_file(fd[0], &offset, FAT16_SEEK_END));
+    CHECK(fat16_read_file(fd[0], expected, RECORD_SIZE) == RECORD_SIZE && memcmp(expected, buffer, RECORD_SIZE) == 0);
+
+    fat16_close_file(fd[0]);
+    fat16_close_file(fd[1]);
+    CHECK(test_fs_ok());
+
+    uint8_t* copy = malloc((RECORDS + 1) * RECORD_SIZE);
+    CHECK(fatimg_find(&test_img, 0, "chan0.log", &entry) && entry.size == (RECORDS + 1) * RECORD_SIZE);
+    CHECK(fatimg_read(&test_img, &entry, copy, entry.size) == entry.size);
+    for(i = 0; i <= RECORDS; ++i)
+    {
+        record(expected, 0, i);
+        if(i == 10)
+            memset(expected, 'x', RECORD_SIZE);
+        CHECK(memcmp(copy + i * RECORD_SIZE, expected, RECORD_SIZE) == 0);
+    }
+    CHECK(fatimg_find(&test_img, 0, "chan1.log", &entry) && entry.size == RECORDS * RECORD_SIZE);
+    CHECK(fatimg_read(&test_img, &entry, copy, entry.size) == entry.size);
+    for(i = 0; i < RECORDS; ++i)
+    {
+        record(expected, 1, i);
+        CHECK(memcmp(copy + i * RECORD_SIZE, expected, RECORD_SIZE) == 0);
+    }
+    free(copy);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("records");
+}
@@ -0,0 +1,83 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "fat16.h"
+#include "rootdir.h"
+#include "sd_raw.h"
+
+/*
+ * Brings up SD 1, SD 2 and SDHC cards, uses a filesystem on each, and
+ * accesses an SDHC card beyond 4GB, where byte offsets overflow 32 bits.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+
+static void use_card(enum card_type type)
+{
+    static const uint8_t text[] = "written on the card\n";
+    uint8_t buffer[sizeof(text)];
+    struct sd_raw_info info;
+
+    test_card(type, CARD_SIZE, 0, 4);
+    fatimg_add_file(&test_img, 0, "read.txt", text, sizeof(text), 1);
+    test_mount();
+
+    CHECK(card_stats.commands[8] == 1);
+    CHECK(sd_raw_get_info(&info) && info.capacity == CARD_SIZE);
+
+    struct fat16_file_struct* fd = root_open("read.txt");
+    CHECK(fd && fat16_read_file(fd, buffer, sizeof(buffer)) == sizeof(text) && memcmp(buffer, text, sizeof(text)) == 0);
+    fat16_close_file(fd);
+
+    fd = root_open_new("write.txt");
+    CHECK(fd && fat16_write_file(fd, text, sizeof(text)) == sizeof(text));
+    fat16_close_file(fd);
+    CHECK(test_fs_ok());
+
+    struct fatimg_entry entry;
+    CHECK(fatimg_find(&test_img, 0, "write.txt", &entry) && entry.size == sizeof(text));
+    CHECK(fatimg_read(&test_img, &entry, buffer, sizeof(buffer)) == sizeof(text) && memcmp(buffer, text, sizeof(text)) == 0);
+
+    CHECK(card_stats.errors == 0);
+}
+
+int main(void)
+{
+    use_card(CARD_SDSC_V1);
+    use_card(CARD_SDSC);
+    use_card(CARD_SDHC);
+
+    /* a 16GB card, of which only the start is kept in memory */
+    uint64_t capacity = 16ULL * 1024 * 1024 * 1024;
+    offset_t far = capacity - 3 * 512;
+    uint8_t block[512];
+    uint8_t copy[512];
+    struct sd_raw_info info;
+    unsigned int i;
+
+    card_insert(CARD_SDHC, capacity, CARD_SIZE);
+    CHECK(sd_raw_init());
+    CHECK(sd_raw_get_info(&info) && info.capacity == capacity);
+
+    for(i = 0; i < sizeof(block); ++i)
+        block[i] = i * 7;
+    CHECK(sd_raw_write(far, block, sizeof(block)));
+    CHECK(sd_raw_write(far + 512 + 100, block, 20));
+    CHECK(sd_raw_sync());
+    CHECK(memcmp(card_block(far), block, sizeof(block)) == 0);
+    CHECK(memcmp(card_block(far + 512) + 100, block, 20) == 0);
+    /* the low 32 bits of the offset, as a driver truncating it would hit */
+    CHECK(card_block((uint32_t) far)[0] == 0);
+
+    card_insert(CARD_SDHC, capacity, CARD_SIZE);
+    memcpy(card_block(far), block, sizeof(block));
+    CHECK(sd_raw_init());
+    CHECK(sd_raw_read(far, copy, sizeof(copy)) && memcmp(copy, block, sizeof(block)) == 0);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("sdhc");
+}
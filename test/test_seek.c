@@ -0,0 +1,75 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Seeks to random positions of a file in a few fragments and reads
+ * there. Once the file's extent map has been built, finding the
+ * cluster of a position must not read the FAT anymore.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define CLUSTERS 2000
+#define SEEKS 500
+#define READ_SIZE 256
+
+int main(void)
+{
+    uint8_t buffer[READ_SIZE];
+    unsigned int i;
+
+    test_card(CARD_SDSC, CARD_SIZE, 0, 4);
+    uint32_t size = CLUSTERS * test_img.cluster_size;
+    uint8_t* data = malloc(size);
+    test_random(data, size, 13);
+
+    /* the clusters of pad.bin split the file into five runs */
+    fatimg_add_file(&test_img, 0, "pad.bin", 0, 5 * test_img.cluster_size, 400);
+    uint32_t cluster = fatimg_add_file(&test_img, 0, "big.bin", data, size, 1);
+    CHECK(fatimg_fragments(&test_img, cluster) == 5);
+    test_mount();
+
+    struct fat16_file_struct* fd = root_open("big.bin");
+    CHECK(fd);
+
+    /* the first seek to the end walks the chain once */
+    io_reset();
+    int32_t offset = size - READ_SIZE;
+    CHECK(fat16_seek_file(fd, &offset, FAT16_SEEK_SET));
+    CHECK(fat16_read_file(fd, buffer, READ_SIZE) == READ_SIZE);
+    CHECK(memcmp(buffer, data + size - READ_SIZE, READ_SIZE) == 0);
+    unsigned long walk_reads = io_stats.reads[IO_AREA_FAT];
+
+    /* reads which stay within a cluster do not need the next link */
+    io_reset();
+    for(i = 0; i < SEEKS; ++i)
+    {
+        uint32_t pos = (uint32_t) rand() % (CLUSTERS - 1) * test_img.cluster_size +
+                       (uint32_t) rand() % (test_img.cluster_size - READ_SIZE);
+        offset = pos;
+        CHECK(fat16_seek_file(fd, &offset, FAT16_SEEK_SET) && offset == (int32_t) pos);
+        CHECK(fat16_read_file(fd, buffer, READ_SIZE) == READ_SIZE);
+        CHECK(memcmp(buffer, data + pos, READ_SIZE) == 0);
+    }
+    fat16_close_file(fd);
+
+    printf("first seek to the end: %lu fat reads, %u random seeks: %lu fat reads\n",
+           walk_reads, SEEKS, io_stats.reads[IO_AREA_FAT]);
+    CHECK(walk_reads <= (cluster + CLUSTERS) * 2 / 512 + 1);
+    CHECK(io_stats.reads[IO_AREA_FAT] == 0);
+    CHECK(io_writes() == 0);
+
+    CHECK(test_fs_ok());
+    CHECK(card_stats.errors == 0);
+    free(data);
+
+    return test_done("seek");
+}
@@ -0,0 +1,93 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sd_raw.h"
+#include "sd_raw_config.h"
+
+/*
+ * Reads a run of blocks in small pieces, built with SD_RAW_READ_AHEAD
+ * set. The run has to be fetched by one open multiple block read, with
+ * blocks prefetched into the cache, and be faster than reading the
+ * same blocks in an order which is not sequential.
+ */
+
+#if !SD_RAW_READ_AHEAD
+#error test_seq has to be built with SD_RAW_READ_AHEAD set
+#endif
+
+#define CARD_SIZE (8 * 1024 * 1024UL)
+#define BLOCKS 64
+#define PIECE 64
+
+static uint8_t data[BLOCKS * 512];
+
+/* reads the blocks of the run in pieces, in the given order of blocks */
+static unsigned long long read_run(offset_t offset, const unsigned int* order)
+{
+    unsigned long long start = sim_cycles;
+    unsigned int i;
+    unsigned int j;
+    for(i = 0; i < BLOCKS; ++i)
+    {
+        for(j = 0; j < 512; j += PIECE)
+        {
+            uint8_t piece[PIECE];
+            offset_t position = order[i] * 512 + j;
+            CHECK(sd_raw_read(offset + position, piece, PIECE));
+            CHECK(memcmp(piece, data + position, PIECE) == 0);
+        }
+    }
+    sd_raw_sync();
+    return sim_cycles - start;
+}
+
+int main(void)
+{
+    struct sd_raw_cache_stats stats;
+    unsigned int order[BLOCKS];
+    unsigned int i;
+
+    test_random(data, sizeof(data), 10);
+
+    card_insert(CARD_SDSC, CARD_SIZE, CARD_SIZE);
+    memcpy(card_mem + 0x100000, data, sizeof(data));
+    memcpy(card_mem + 0x200000, data, sizeof(data));
+    CHECK(sd_raw_init());
+
+    for(i = 0; i < BLOCKS; ++i)
+        order[i] = i;
+    card_reset_stats();
+    unsigned long long sequential = read_run(0x100000, order);
+    CHECK(card_stats.commands[18] == 1);
+    CHECK(card_stats.commands[17] <= 1);
+    CHECK(card_stats.blocks_read <= BLOCKS + SD_RAW_READ_AHEAD + 1);
+    CHECK(sd_raw_get_cache_stats(&stats));
+    printf("read-ahead: %u prefetched blocks used, %u wasted\n", stats.prefetch_hits, stats.prefetch_wasted);
+    CHECK(stats.prefetch_hits > BLOCKS / 2);
+
+    /* the same blocks, every other one first */
+    for(i = 0; i < BLOCKS; ++i)
+        order[i] = (i * 2) % BLOCKS + (i * 2 >= BLOCKS);
+    card_reset_stats();
+    unsigned long long scattered = read_run(0x200000, order);
+    printf("%u blocks in pieces of %u bytes: %.2fms sequential, %.2fms scattered\n", BLOCKS, PIECE, sim_ms(sequential), sim_ms(scattered));
+    CHECK(sequential < scattered);
+
+    /* a block written while it is prefetched is read back as written */
+    uint8_t piece[PIECE];
+    CHECK(sd_raw_read(0x100000, piece, PIECE));
+    CHECK(sd_raw_read(0x100000 + 100, piece, PIECE));
+    memset(piece, 0xee, PIECE);
+    CHECK(sd_raw_write(0x100000 + 512, piece, PIECE));
+    CHECK(sd_raw_read(0x100000 + 512, piece, PIECE) && piece[0] == 0xee && piece[PIECE - 1] == 0xee);
+    CHECK(sd_raw_sync());
+    CHECK(card_mem[0x100000 + 512] == 0xee);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("seq");
+}
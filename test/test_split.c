@@ -0,0 +1,93 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sd_raw.h"
+
+/*
+ * Reads blocks with sd_raw_read_start() and sd_raw_read_poll() from a
+ * card of varying access times. Each poll has to return after a few
+ * bytes, reads have to be abortable, and a card which never delivers
+ * has to end in a timeout instead of a hang.
+ */
+
+#define CARD_SIZE (8 * 1024 * 1024UL)
+/* blocks far enough apart not to be read as a sequence */
+#define BLOCK(n) (0x100000 + (offset_t) (n) * 16 * 512)
+/* bytes a poll may clock at most */
+#define POLL_BYTES_MAX 40
+
+/* reads a block by polling, returns the result and counts the polls */
+static unsigned char read_polled(offset_t offset, uint8_t* buffer, unsigned long* polls)
+{
+    unsigned char result;
+    *polls = 0;
+    if(!sd_raw_read_start(offset))
+        return SD_RAW_READ_FAILED;
+
+    while(1)
+    {
+        unsigned long bytes = card_stats.bytes;
+        result = sd_raw_read_poll(buffer);
+        if(result != SD_RAW_READ_BUSY)
+            break;
+        CHECK(card_stats.bytes - bytes <= POLL_BYTES_MAX);
+        ++*polls;
+    }
+    return result;
+}
+
+int main(void)
+{
+    uint8_t block[512];
+    unsigned long polls;
+    unsigned int i;
+
+    card_insert(CARD_SDSC, CARD_SIZE, CARD_SIZE);
+    for(i = 0; i < 40; ++i)
+        memset(card_mem + BLOCK(i), i + 1, 512);
+    CHECK(sd_raw_init());
+
+    /* access times from none to 5ms */
+    srand(7);
+    unsigned long total_polls = 0;
+    for(i = 0; i < 20; ++i)
+    {
+        card_config.read_latency = SIM_US(rand() % 5000);
+        CHECK(read_polled(BLOCK(i), block, &polls) == SD_RAW_READ_DONE);
+        CHECK(block[0] == i + 1 && block[511] == i + 1);
+        total_polls += polls;
+    }
+    printf("20 reads with up to 5ms access time: %lu polls\n", total_polls);
+    CHECK(total_polls > 20);
+
+    /* an abandoned read leaves the card ready for the next one */
+    card_config.read_latency = SIM_US(1000);
+    CHECK(sd_raw_read_start(BLOCK(20)));
+    CHECK(sd_raw_read_poll(block) == SD_RAW_READ_BUSY);
+    sd_raw_read_abort();
+    CHECK(sd_raw_read(BLOCK(21), block, sizeof(block)) && block[0] == 22);
+    CHECK(card_stats.errors == 0);
+
+    /* a card which never delivers */
+    card_config.read_latency = SIM_US(10000000);
+    unsigned long long start = sim_cycles;
+    CHECK(read_polled(BLOCK(22), block, &polls) == SD_RAW_READ_FAILED);
+    printf("timeout after %.0fms\n", sim_ms(sim_cycles - start));
+    CHECK(sim_ms(sim_cycles - start) < 1000);
+    start = sim_cycles;
+    CHECK(!sd_raw_read(BLOCK(23), block, sizeof(block)));
+    CHECK(sim_ms(sim_cycles - start) < 1000);
+    CHECK(!card_is_selected());
+
+    /* the card works again once it answers */
+    card_config.read_latency = SIM_US(100);
+    CHECK(sd_raw_read(BLOCK(24), block, sizeof(block)) && block[0] == 25);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("split");
+}
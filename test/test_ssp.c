@@ -0,0 +1,62 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sd_raw.h"
+#include "sd_raw_config.h"
+
+/*
+ * Reads and writes block runs over the SSP, built with SD_RAW_USE_SSP
+ * set. The pipelined transfers have to lose no frames, and keep the
+ * bus shifting at least 90% of the time.
+ */
+
+#if !SD_RAW_USE_SSP
+#error test_ssp has to be built with SD_RAW_USE_SSP set
+#endif
+
+#define CARD_SIZE (8 * 1024 * 1024UL)
+#define BLOCKS 64
+/* PCLK cycles SPI0 needs to shift a block at its fastest clock */
+#define SPI0_BLOCK_CYCLES (512 * 8 * 8ULL)
+
+static uint8_t data[BLOCKS * 512];
+static uint8_t copy[BLOCKS * 512];
+
+int main(void)
+{
+    test_random(data, sizeof(data), 6);
+
+    card_insert(CARD_SDSC, CARD_SIZE, CARD_SIZE);
+    CHECK(sd_raw_init());
+    printf("SSP clock %luHz\n", sd_raw_get_spi_clock());
+    CHECK(sd_raw_get_spi_clock() > SD_RAW_PCLK / 8);
+
+    unsigned long long start = sim_cycles;
+    CHECK(sd_raw_write(0x100000, data, sizeof(data)));
+    CHECK(sd_raw_sync());
+    unsigned long long write_cycles = sim_cycles - start;
+    CHECK(memcmp(card_mem + 0x100000, data, sizeof(data)) == 0);
+
+    card_reset_stats();
+    start = sim_cycles;
+    CHECK(sd_raw_read_blocks(0x100000, copy, BLOCKS, 0, 0));
+    unsigned long long read_cycles = sim_cycles - start;
+    CHECK(memcmp(copy, data, sizeof(data)) == 0);
+
+    /* the time the bytes clocked take on the bus alone */
+    unsigned long long bus_cycles = card_stats.bytes * 8ULL * (SD_RAW_PCLK / sd_raw_get_spi_clock());
+
+    printf("%u blocks: written in %.2fms, read in %.2fms, SPI0 needs %.2fms to shift them\n",
+           BLOCKS, sim_ms(write_cycles), sim_ms(read_cycles), sim_ms(BLOCKS * SPI0_BLOCK_CYCLES));
+    CHECK(read_cycles * 9 < bus_cycles * 10);
+    CHECK(read_cycles < BLOCKS * SPI0_BLOCK_CYCLES);
+    CHECK(sim_ssp_overruns == 0);
+    CHECK(card_stats.errors == 0);
+
+    return test_done("ssp");
+}
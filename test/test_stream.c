@@ -0,0 +1,109 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "fat16.h"
+#include "rootdir.h"
+#include "sd_raw.h"
+
+/*
+ * Streams a contiguous and a fragmented file with fat16_stream_file(),
+ * which needs one multiple block read per run of clusters, and compares
+ * the bus traffic per block with a lone block read. Both files are
+ * also read through fat16_read_file().
+ */
+
+#define FILE_SIZE (200 * 1024UL + 100)
+
+static uint8_t data[FILE_SIZE];
+static uint8_t copy[FILE_SIZE + 512];
+
+static uint8_t stream_callback(uint8_t* buffer, offset_t offset, void* p)
+{
+    (void) p;
+    memcpy(copy + offset, buffer, 512);
+    return 1;
+}
+
+static unsigned long stream(const char* name)
+{
+    unsigned long bytes = card_stats.bytes;
+    uint8_t buffer[512];
+    struct fat16_file_struct* fd = root_open((char*) name);
+    CHECK(fd);
+    if(!fd)
+        return 0;
+
+    memset(copy, 0, sizeof(copy));
+    CHECK(fat16_stream_file(fd, buffer, stream_callback, 0));
+    CHECK(memcmp(copy, data, FILE_SIZE) == 0);
+    /* bytes beyond the end of the file are zeroed */
+    CHECK(copy[FILE_SIZE] == 0 && copy[FILE_SIZE + 411] == 0);
+    fat16_close_file(fd);
+    return card_stats.bytes - bytes;
+}
+
+static void read_loop(const char* name)
+{
+    uint32_t done = 0;
+    struct fat16_file_struct* fd = root_open((char*) name);
+    CHECK(fd);
+    if(!fd)
+        return;
+
+    while(1)
+    {
+        int16_t length = fat16_read_file(fd, copy + done, 512);
+        if(length <= 0)
+            break;
+        done += length;
+    }
+    CHECK(done == FILE_SIZE && memcmp(copy, data, FILE_SIZE) == 0);
+    fat16_close_file(fd);
+}
+
+int main(void)
+{
+    test_random(data, FILE_SIZE, 1);
+
+    test_card(CARD_SDSC, 32 * 1024 * 1024UL, 0, 4);
+    uint32_t cluster = fatimg_add_file(&test_img, 0, "stream.bin", data, FILE_SIZE, 1);
+    CHECK(fatimg_fragments(&test_img, cluster) == 1);
+    cluster = fatimg_add_file(&test_img, 0, "frag.bin", data, FILE_SIZE, 3);
+    uint32_t fragments = fatimg_fragments(&test_img, cluster);
+    test_mount();
+
+    /* the cost of a lone block read */
+    uint8_t block[512];
+    card_reset_stats();
+    CHECK(sd_raw_read(test_img.data_offset + 100 * 512, block, 512));
+    sd_raw_sync();
+    unsigned long single = card_stats.bytes;
+    unsigned long blocks = (FILE_SIZE + 511) / 512;
+
+    card_reset_stats();
+    unsigned long streamed = stream("stream.bin");
+    CHECK(card_stats.commands[18] == 1);
+    printf("contiguous: %lu bus bytes per block streamed, %lu for a single block read\n", streamed / blocks, single);
+    CHECK(streamed / blocks < single);
+    read_loop("stream.bin");
+
+    card_reset_stats();
+    streamed = stream("frag.bin");
+    /* one transfer per run of consecutive clusters */
+    CHECK(card_stats.commands[18] == fragments);
+    printf("%u fragments: %lu bus bytes per block streamed\n", (unsigned int) fragments, streamed / blocks);
+    CHECK(streamed / blocks < single);
+    read_loop("frag.bin");
+
+    /* as in main(), the card is released before the firmware is called */
+    sd_raw_sync();
+    CHECK(!card_is_selected());
+    CHECK(card_stats.errors == 0);
+
+    return test_done("stream");
+}
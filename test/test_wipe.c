@@ -0,0 +1,112 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "test.h"
+#include "io.h"
+#include "fat16.h"
+#include "rootdir.h"
+
+/*
+ * Wipes a card holding hundreds of logs with root_format(), as the USB
+ * side does, and once more deleting them one by one. A batch of files
+ * has to cost a write per directory sector it is in and per FAT sector
+ * its chains go through, for each copy of the FAT, no matter how the
+ * chains are interleaved.
+ */
+
+#define CARD_SIZE (32 * 1024 * 1024UL)
+#define LOGS 400
+#define BATCH 16
+
+static void add_logs(void)
+{
+    unsigned int i;
+    char name[16];
+
+    /* one sector per cluster, every third log in pieces */
+    test_card(CARD_SDSC, CARD_SIZE, 0, 1);
+    for(i = 0; i < LOGS; ++i)
+    {
+        sprintf(name, "L%07u.LOG", i);
+        fatimg_add_file(&test_img, 0, name, 0, (1 + i % 30) * 512, i % 3 ? 1 : 3);
+    }
+    test_mount();
+}
+
+/* counts the fat sectors the chains of each batch of logs go through */
+static unsigned int batch_fat_sectors(void)
+{
+    static uint8_t touched[CARD_SIZE / 512 * 2 / 512];
+    unsigned int sectors = 0;
+    unsigned int i;
+
+    for(i = 0; i < LOGS; ++i)
+    {
+        char name[16];
+        struct fatimg_entry entry;
+        if(i % BATCH == 0)
+            memset(touched, 0, sizeof(touched));
+        sprintf(name, "L%07u.LOG", i);
+        CHECK(fatimg_find(&test_img, 0, name, &entry));
+        uint32_t cluster;
+        for(cluster = entry.cluster; cluster >= 2 && cluster < 0xfff8; cluster = fatimg_get_fat(&test_img, cluster, 0))
+        {
+            if(!touched[cluster / 256])
+                ++sectors;
+            touched[cluster / 256] = 1;
+        }
+    }
+    return sectors;
+}
+
+int main(void)
+{
+    unsigned int i;
+
+    /* one by one, for comparison */
+    add_logs();
+    io_reset();
+    for(i = 0; i < LOGS; ++i)
+    {
+        char name[16];
+        sprintf(name, "L%07u.LOG", i);
+        CHECK(root_delete(name) == 0);
+    }
+    CHECK(test_fs_ok());
+    unsigned long single_fat_writes = io_stats.writes[IO_AREA_FAT];
+    unsigned long single_dir_writes = io_stats.writes[IO_AREA_ROOT];
+    CHECK(fatimg_entries(&test_img, 0) == 0);
+
+    add_logs();
+    uint32_t used_clusters = test_img.clusters - fatimg_free_clusters(&test_img);
+    unsigned int fat_sectors = batch_fat_sectors();
+    unsigned int dir_sectors = LOGS * 32 / 512;
+    io_reset();
+    root_format();
+    CHECK(test_fs_ok());
+    printf("%u logs in %u clusters: %lu fat writes for %u fat sectors in batches, %lu directory writes for %u sectors\n",
+           LOGS, (unsigned int) used_clusters, io_stats.writes[IO_AREA_FAT], fat_sectors,
+           io_stats.writes[IO_AREA_ROOT], dir_sectors);
+    printf("one by one: %lu fat writes, %lu directory writes\n", single_fat_writes, single_dir_writes);
+    CHECK(fatimg_entries(&test_img, 0) == 0);
+    CHECK(fatimg_free_clusters(&test_img) == test_img.clusters);
+    CHECK(fat16_get_fs_free(fs) == (offset_t) test_img.clusters * test_img.cluster_size);
+
+    /* a batch of 16 entries sits in one directory sector, or two when the previous batch ended in it */
+    CHECK(io_stats.writes[IO_AREA_ROOT] <= dir_sectors + (LOGS + BATCH - 1) / BATCH);
+    CHECK(io_stats.writes[IO_AREA_FAT] <= 2 * fat_sectors);
+    CHECK(io_stats.writes[IO_AREA_FAT] < single_fat_writes / 4);
+    CHECK(io_stats.writes[IO_AREA_ROOT] < single_dir_writes / 4);
+
+    /* the card is usable afterwards */
+    struct fat16_file_struct* fd = root_open_new("fresh.log");
+    CHECK(fd && fat16_write_file(fd, (const uint8_t*) "fresh", 5) == 5);
+    fat16_close_file(fd);
+    CHECK(test_fs_ok());
+    CHECK(card_stats.errors == 0);
+
+    return test_done("wipe");
+}
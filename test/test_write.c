@@ -0,0 +1,75 @@
+/* This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "sd_raw.h"
+
+/*
+ * Writes a run of blocks with one CMD25 and compares the time with
+ * writing the blocks one by one with CMD24. Also shows what becomes of
+ * blocks announced with ACMD23 but never sent, on a card which erases
+ * them in advance.
+ */
+
+#define CARD_SIZE (8 * 1024 * 1024UL)
+#define BLOCKS 64
+
+static uint8_t data[BLOCKS * 512];
+
+int main(void)
+{
+    uint32_t i;
+    test_random(data, sizeof(data), 2);
+
+    card_insert(CARD_SDSC, CARD_SIZE, CARD_SIZE);
+    CHECK(sd_raw_init());
+
+    /* a run of whole blocks goes to the card in one transfer */
+    card_reset_stats();
+    unsigned long long start = sim_cycles;
+    CHECK(sd_raw_write(0x100000, data, sizeof(data)));
+    CHECK(sd_raw_sync());
+    unsigned long long multiple = sim_cycles - start;
+    CHECK(card_stats.commands[25] == 1);
+    CHECK(card_stats.app_commands[23] == 1);
+    CHECK(card_stats.commands[24] == 0);
+    CHECK(card_stats.blocks_written == BLOCKS);
+    CHECK(memcmp(card_mem + 0x100000, data, sizeof(data)) == 0);
+
+    /* the same blocks, one at a time */
+    card_reset_stats();
+    start = sim_cycles;
+    for(i = 0; i < BLOCKS; ++i)
+    {
+        CHECK(sd_raw_write(0x200000 + i * 512, data + i * 512, 512));
+        CHECK(sd_raw_sync());
+    }
+    unsigned long long single = sim_cycles - start;
+    CHECK(card_stats.commands[24] == BLOCKS);
+    CHECK(memcmp(card_mem + 0x200000, data, sizeof(data)) == 0);
+
+    printf("%u blocks: %.2fms with CMD25, %.2fms with CMD24\n", BLOCKS, sim_ms(multiple), sim_ms(single));
+    CHECK(multiple * 4 < single * 3);
+
+    /* announced blocks which are not sent are left erased by such a card */
+    card_config.pre_erase = 1;
+    memset(card_mem + 0x300000, 0x55, 4 * 512);
+    CHECK(sd_raw_write_start(0x300000, 4));
+    CHECK(sd_raw_write_next(0x300000, data));
+    CHECK(sd_raw_write_next(0x300200, data + 512));
+    sd_raw_write_stop();
+    CHECK(sd_raw_sync());
+    CHECK(memcmp(card_mem + 0x300000, data, 2 * 512) == 0);
+    CHECK(card_mem[0x300000 + 2 * 512] == 0xff && card_mem[0x300000 + 4 * 512 - 1] == 0xff);
+    /* blocks after the announced ones are untouched */
+    CHECK(card_mem[0x300000 + 4 * 512] == 0x00);
+
+    CHECK(card_stats.errors == 0);
+    CHECK(!card_is_selected());
+
+    return test_done("write");
+}